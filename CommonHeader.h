@@ -185,6 +185,7 @@ enum
     Pterm_Dclock,       // disk clock
     Pterm_Mz80,
     Pterm_PasteTimer,   // paste key generation pacing
+    Pterm_PresentTimer, // display update pacing
     //other items
     Pterm_Exec,         // execute URL
     Pterm_MailTo,       // execute email client
@@ -444,6 +444,7 @@ BEGIN_EVENT_TABLE (PtermFrame, wxFrame)
     EVT_TIMER (Pterm_Dclock, PtermFrame::OnDclock)
     EVT_TIMER (Pterm_Mz80, PtermFrame::OnMz80)
     EVT_TIMER (Pterm_PasteTimer, PtermFrame::OnPasteTimer)
+    EVT_TIMER (Pterm_PresentTimer, PtermFrame::OnPresentTimer)
     EVT_ACTIVATE (PtermFrame::OnActivate)
     EVT_MENU (Pterm_ConnectAgain, PtermFrame::OnConnectAgain)
     EVT_MENU (Pterm_Close, PtermFrame::OnQuit)
@@ -540,16 +541,59 @@ void PtermCanvas::Unadjust (int x, int y, int *xx, int *yy) const
     *yy = 511 - (yu / m_owner->m_yscale - m_owner->m_ymargin);
 }
 
+// Return the part of the screen bitmap, in bitmap coordinates, that is
+// covered by the current update region.  A pixel of slop is added on
+// each side to cover rounding when the scale is not an integer.  If
+// there is no update region (not called from a paint event) the whole
+// bitmap is returned.
+wxRect PtermCanvas::UpdateBitmapRect (void) const
+{
+    wxRect r = GetUpdateRegion ().GetBox ();
+    int x1, y1, x2, y2;
+
+    if (r.IsEmpty ())
+    {
+        return wxRect (0, 0, 512, 512);
+    }
+
+    CalcUnscrolledPosition (r.x, r.y, &x1, &y1);
+    x2 = x1 + r.width;
+    y2 = y1 + r.height;
+    x1 = (int) floor (x1 / m_owner->m_xscale) - m_owner->m_xmargin - 1;
+    y1 = (int) floor (y1 / m_owner->m_yscale) - m_owner->m_ymargin - 1;
+    x2 = (int) ceil (x2 / m_owner->m_xscale) - m_owner->m_xmargin + 1;
+    y2 = (int) ceil (y2 / m_owner->m_yscale) - m_owner->m_ymargin + 1;
+    x1 = (x1 < 0) ? 0 : x1;
+    y1 = (y1 < 0) ? 0 : y1;
+    x2 = (x2 > 512) ? 512 : x2;
+    y2 = (y2 > 512) ? 512 : y2;
+    if (x2 <= x1 || y2 <= y1)
+    {
+        return wxRect ();
+    }
+    
+    return wxRect (x1, y1, x2 - x1, y2 - y1);
+}
+
 void PtermCanvas::OnDraw (wxDC &dc)
 {
     const int rh = m_owner->m_regionHeight;
     const int rw = m_owner->m_regionWidth;
     const int PScale = m_owner->GetContentScaleFactor ();
+    const wxRect ur = UpdateBitmapRect ();
+    const bool full = (ur.width == 512 && ur.height == 512);
     
+    // Make sure pending drawing is committed to the bitmaps.
+    m_owner->ptermReleaseRaster ();
     dc.DestroyClippingRegion ();
 
-    if (PScale == 1 || m_owner->m_xscale < 1 ||
-        m_owner->m_yscale < 1)
+    if (ur.IsEmpty ())
+    {
+        // Only the margins need repainting, and the background erase
+        // takes care of that.
+    }
+    else if (PScale == 1 || m_owner->m_xscale < 1 ||
+             m_owner->m_yscale < 1)
     {
         // simple scaling
         if (!m_owner->m_FancyScaling ||
@@ -558,84 +602,108 @@ void PtermCanvas::OnDraw (wxDC &dc)
             (m_owner->m_xscale == 3 && m_owner->m_yscale == 3))
             )
         {
+            m_owner->ptermFreeScaled ();
             dc.SetUserScale (m_owner->m_xscale, m_owner->m_yscale);
-            if (!m_owner->m_fullScreen)
+            dc.SetClippingRegion (m_owner->m_xmargin + ur.x,
+                                  m_owner->m_ymargin + ur.y,
+                                  ur.width, ur.height);
+            if (full && m_owner->m_scrollRows == 0)
+            {
+                dc.DrawBitmap (*m_owner->m_bitmap, m_owner->m_xmargin,
+                               m_owner->m_ymargin, false);
+            }
+            else
             {
-                dc.SetClippingRegion (m_owner->m_xmargin,
-                    m_owner->m_ymargin, 512, 512);
+                // Draw the rows in at most two pieces, since they
+                // wrap around the bitmap if the screen has scrolled.
+                int y, h, py;
+
+                for (y = ur.y; y < ur.y + ur.height; y += h)
+                {
+                    py = (y + m_owner->m_scrollRows) & 0777;
+                    h = ur.y + ur.height - y;
+                    h = (py + h > 512) ? 512 - py : h;
+                    dc.DrawBitmap (m_owner->m_bitmap->GetSubBitmap
+                                   (wxRect (ur.x, py, ur.width, h)),
+                                   m_owner->m_xmargin + ur.x,
+                                   m_owner->m_ymargin + y, false);
+                }
             }
-            dc.DrawBitmap (*m_owner->m_bitmap, m_owner->m_xmargin,
-                m_owner->m_ymargin, false);
         }
         // BILINEAR scaling 
         else
         {
-            int x1 = m_owner->m_xmargin + (m_owner->m_xscale - 1)*m_owner->m_xmargin;
-            int y1 = m_owner->m_ymargin + (m_owner->m_yscale - 1)*m_owner->m_ymargin;
-            wxImage scaleImage = m_owner->m_bitmap->ConvertToImage ();
-            wxImage rescaledImage =  scaleImage.Scale (m_owner->m_xscale * 512,
-                m_owner->m_yscale * 512,
-                wxIMAGE_QUALITY_BILINEAR);
-             if (!m_owner->m_fullScreen)
+            // Bring the scaled copy of the screen up to date for the
+            // part being repainted, and draw that part of it.
+            const double xs = m_owner->m_xscale;
+            const double ys = m_owner->m_yscale;
+            int x1 = m_owner->m_xmargin + (xs - 1)*m_owner->m_xmargin;
+            int y1 = m_owner->m_ymargin + (ys - 1)*m_owner->m_ymargin;
+            wxRect dst = m_owner->ptermUpdateScaled (ur);
+
+            dc.SetClippingRegion (x1 + (int) floor (xs * ur.x),
+                                  y1 + (int) floor (ys * ur.y),
+                                  (int) ceil (xs * ur.width),
+                                  (int) ceil (ys * ur.height));
+            if (full)
+            {
+                dc.DrawBitmap (*m_owner->m_scaled, x1, y1, false);
+            }
+            else if (!dst.IsEmpty ())
             {
-                dc.SetClippingRegion (x1, y1,
-                    m_owner->m_xscale * 512, m_owner->m_yscale * 512);
+                dc.DrawBitmap (m_owner->m_scaled->GetSubBitmap (dst),
+                               x1 + dst.x, y1 + dst.y, false);
             }
-            dc.DrawBitmap (rescaledImage, x1, y1, false);
         }
     }
     else
     {
-        PixelData pixmap (*m_owner->m_bitmap);
-        PixelData pixmap2 (*m_owner->m_bitmap2);
-        PixelData::Iterator p (pixmap);
-        PixelData::Iterator p2 (pixmap2);
-        PixelData::Iterator p2b (pixmap2);
-        u32 *pmap, *pmap2;
-        u32 pd;
-        int i, j;
-        
-        for (i = 0; i < 512; i++)
-        {
-            for (j = 0; j < 512; j++)
-            {
-                p.MoveTo (pixmap, j, i);
-                p2.MoveTo (pixmap2, j * 2, i * 2);
-                pd = *(u32 *) (p.m_ptr);
-                pmap2 = (u32 *) (p2.m_ptr);
-                *pmap2++ = pd;
-                *pmap2   = pd;
-            }
-            p2.MoveTo (pixmap2, 0, i * 2);
-            p2b.MoveTo (pixmap2, 0, i * 2 + 1);
-            pmap = (u32 *) (p2.m_ptr);
-            pmap2 = (u32 *) (p2b.m_ptr);
-            memcpy (pmap2, pmap, 2 * 512 * sizeof (u32));
-        }
+        // Bring the enlarged copy of the screen up to date for the
+        // part that is about to be drawn.
+        m_owner->ptermFreeScaled ();
+        m_owner->ptermUpdateZoomed (ur, PScale);
+
         dc.SetUserScale (m_owner->m_xscale / PScale,
                          m_owner->m_yscale / PScale);
-        if (!m_owner->m_fullScreen)
+        dc.SetClippingRegion ((m_owner->m_xmargin + ur.x) * PScale, 
+                              (m_owner->m_ymargin + ur.y) * PScale,
+                              ur.width * PScale, ur.height * PScale);
+        if (full)
         {
-            dc.SetClippingRegion (m_owner->m_xmargin * PScale, 
-                                  m_owner->m_ymargin * PScale,
-                                  512 * PScale, 512 * PScale);
+            dc.DrawBitmap (*m_owner->m_bitmap2,
+                           m_owner->m_xmargin * PScale,
+                           m_owner->m_ymargin * PScale, false);
+        }
+        else
+        {
+            dc.DrawBitmap (m_owner->m_bitmap2->GetSubBitmap
+                           (wxRect (ur.x * PScale, ur.y * PScale,
+                                    ur.width * PScale, ur.height * PScale)),
+                           (m_owner->m_xmargin + ur.x) * PScale,
+                           (m_owner->m_ymargin + ur.y) * PScale, false);
         }
-        dc.DrawBitmap (*m_owner->m_bitmap2,
-                       m_owner->m_xmargin * PScale,
-                       m_owner->m_ymargin * PScale, false);
     }
+    dc.DestroyClippingRegion ();
     
     debug ("Drawing bitmap onto the window canvas");
 
     if (rh != 0 && rw != 0)
     {
+        wxRect sr (8 * m_owner->m_regionX,
+                   511 - (16 * (m_owner->m_regionY + rh)),
+                   rw * 8, rh * 16);
+
         dc.SetUserScale (m_owner->m_xscale, m_owner->m_yscale);
-        dc.SetClippingRegion (m_owner->m_xmargin + (8 * m_owner->m_regionX), 
-                              m_owner->m_ymargin + 511 -
-                              (16 * (m_owner->m_regionY + rh)), 
-                              rw * 8, rh * 16);
-        dc.DrawBitmap (*m_owner->m_selmap, m_owner->m_xmargin,
-                       m_owner->m_ymargin, false);
+        dc.SetClippingRegion (m_owner->m_xmargin + sr.x, 
+                              m_owner->m_ymargin + sr.y,
+                              sr.width, sr.height);
+        sr.Intersect (wxRect (0, 0, 512, 512));
+        if (!sr.IsEmpty ())
+        {
+            dc.DrawBitmap (m_owner->ptermSelectionBitmap (sr),
+                           m_owner->m_xmargin + sr.x,
+                           m_owner->m_ymargin + sr.y, false);
+        }
         dc.DestroyClippingRegion ();
     
         debug ("Drawing selection region, top %d %d, size %d %d",
@@ -770,12 +838,26 @@ void PtermCanvas::OnCharHook (wxKeyEvent &event)
         return;
     }
 
+    if (ctrl && shift && key == ']') // control-shift-] : z80 profile
+    {
+        m_owner->ptermSetProfile (!m_owner->Z80Profiling ());
+        return;
+    }
+
     if (ctrl && key == ']')         // control-] : trace
     {
         m_owner->ptermSetTrace (!m_owner->tracePterm);
         return;
     }
 
+    if (ctrl && (key == WXK_RIGHT || key == WXK_LEFT) &&
+        m_owner->HasConnection () && m_owner->m_conn->ConnType () == TEST)
+    {
+        // control-right/left : step through trace or capture playback
+        m_owner->ptermStep ((key == WXK_RIGHT) ? 1 : -1);
+        return;
+    }
+
 
 #if 0
     if (ctrl && key == '\\')         // Reset Mtutor
@@ -1253,6 +1335,23 @@ void PtermCanvas::ptermTouchPanel (bool enable)
     }
 }
 
+// Handle an event for the canvas, with the decode thread stopped; see
+// PtermFrame::ProcessEvent.
+bool PtermCanvas::ProcessEvent (wxEvent &event)
+{
+    const wxEventType type = event.GetEventType ();
+    bool done;
+    
+    if (type == wxEVT_IDLE || type == wxEVT_UPDATE_UI)
+    {
+        return wxScrolledCanvas::ProcessEvent (event);
+    }
+    m_owner->DecodeHold ();
+    done = wxScrolledCanvas::ProcessEvent (event);
+    m_owner->DecodeRelease ();
+    return done;
+}
+
 #if defined (__WXMSW__)
 // Override the window proc to avoid F10 being handled  as a hotkey
 WXLRESULT PtermCanvas::MSWWindowProc (WXUINT message, WXWPARAM wParam,
@@ -1379,7 +1478,8 @@ PtermFrame::PtermFrame (const wxString& title, PtermProfile *profile,
       m_pasteIndex (-1),
       m_nextword (C_NODATA),
       m_delay (0),
-      mt_key (-1),
+      m_mtKeyIn (0),
+      m_mtKeyOut (0),
       modexor (false),
       currentX (0),
       currentY (496),
@@ -1406,7 +1506,49 @@ PtermFrame::PtermFrame (const wxString& title, PtermProfile *profile,
       m_regionX (0),
       m_regionY (0),
       m_regionHeight (0),
-      m_regionWidth (0)
+      m_regionWidth (0),
+      m_damageCount (0),
+      m_lastDamage (0),
+      m_presentTimer (this, Pterm_PresentTimer),
+      m_lastPresent (0),
+      m_frameMs (1000 / 60),
+      m_decodeYield (false),
+      m_delayMs (0),
+      m_decodeEnd (C_NODATA),
+      m_wordIndex (0),
+      m_wordCount (0),
+      m_backDirty (false),
+      m_fontDC (false),
+      m_scrollRows (0),
+      m_scaled (NULL),
+      m_scaledX (0.0),
+      m_scaledY (0.0),
+      m_scaleXTab (NULL),
+      m_scaleYTab (NULL),
+      m_z80Wake (m_z80Lock),
+      m_z80Done (m_z80Lock),
+      m_z80Started (false),
+      m_z80Quit (false),
+      m_z80Go (false),
+      m_z80Busy (false),
+      m_z80Call (false),
+      m_z80Waiting (false),
+      m_z80Result (0),
+      m_microRun (false),
+      m_z80Colors (host),
+      m_colorsFor (host),
+      m_decodeWake (m_decodeLock),
+      m_decodeDone (m_decodeLock),
+      m_decodeId (0),
+      m_decodeStarted (false),
+      m_decodeQuit (false),
+      m_decodeGo (false),
+      m_decodeBusy (false),
+      m_decodeWaiting (false),
+      m_decodeRun (false),
+      m_decodeHold (0),
+      m_guiReq (GuiNone),
+      m_guiServing (false)
 {
     int i;
 
@@ -1415,14 +1557,19 @@ PtermFrame::PtermFrame (const wxString& title, PtermProfile *profile,
     mode = 017;             // default to character mode, rewrite
 
     mt_ksw = 0;             // route input to terminal
-    mt_key = -1;
     mjobs = 0;
+    memset (m_glyphValid, 0, sizeof (m_glyphValid));
 
     modexor = false;
     setMargin (0);
     RAM[M_CCR] = 0;
     RAM[M_TYPE] = 0x3c;
 
+    // Branches into the resident go to check_pcZ80: the entry points
+    // are emulated there, and anything else is a wild jump.  Branches
+    // within RAM don't need it.
+    Z80Trap (0, WORKRAM - 1, true);
+
     m_classicSpeed = profile->m_classicSpeed;
     m_gswEnable = profile->m_gswEnable;
     m_numpadArrows = profile->m_numpadArrows;
@@ -1566,10 +1713,12 @@ PtermFrame::PtermFrame (const wxString& title, PtermProfile *profile,
 #endif
         *pmap = t;
     }
+    memset (m_backStale, 0, sizeof (m_backStale));
+    ptermSetRows ();
     m_memDC = new wxMemoryDC ();
-    m_selmap = new wxBitmap (512, 512, 32);
-    // for 2x scalling for Retina display, if active
-    m_bitmap2 = new wxBitmap (512 * 2, 512 * 2, 32);
+    // The enlarged bitmap for Retina displays is allocated when first needed
+    m_bitmap2 = NULL;
+    m_zoom = 0;
     m_canvas = new PtermCanvas (this);
 
     SetColors (m_currentFg, m_currentBg);    
@@ -1682,19 +1831,24 @@ void PtermFrame::trace (const char *fmt, ...) const
 
 PtermFrame::~PtermFrame ()
 {
+    DecodeStop ();
+    MicroStop ();
     if (m_conn != NULL)
     {
         delete m_conn;
         m_conn = NULL;
     }
+    ptermReleaseRaster ();
     delete m_bitmap;
     if (m_bitmap2 != NULL)
     {
         delete m_bitmap2;
     }
-    delete m_selmap;
+    delete m_scaled;
+    delete [] m_scaleXTab;
+    delete [] m_scaleYTab;
     delete m_memDC;
-    m_bitmap = m_bitmap2 = m_selmap = NULL;
+    m_bitmap = m_bitmap2 = NULL;
     m_memDC = NULL;
 
     // If this is the help frame, remember we no longer have it
@@ -2102,12 +2256,35 @@ void PtermFrame::OnIdle (wxIdleEvent& event)
     // In every case, let others see this event too.
     event.Skip ();
 
+    // While the decode thread is running, the terminal is its own; all
+    // there is to do is whatever GUI work it is asking for.  It wakes
+    // us up when it needs us again, and when it is done.
+    if (DecodeService ())
+    {
+        return;
+    }
+
+    // Send the keys gathered up while handling events.  If the
+    // transmit ring is full, come back for the rest.
+    if (m_conn != NULL && m_conn->FlushData ())
+    {
+        event.RequestMore ();
+    }
+
     if (m_needtoBoot)
     {
         m_needtoBoot = false;
         BootMtutor();
     }
 
+    // Do any resident calls the z80 is waiting for.  If it is still
+    // running, that's all for now; the z80 thread wakes us up when it
+    // needs us again.
+    if (MicroService ())
+    {
+        return;
+    }
+
     // Do nothing for the help window.
     // If our timer is running, we're using the timer event to drive
     // the display, so ignore idle events.
@@ -2118,63 +2295,46 @@ void PtermFrame::OnIdle (wxIdleEvent& event)
 
     if ( ppt_running && !in_r_exec )
     {
-        SaveRestoreColors (save, host);
-        SaveRestoreColors (restore, micro);
-        MicroEmulate;
-        SaveRestoreColors (save, micro);
-        SaveRestoreColors (restore, host);
+        MicroStart (micro);
         return;
     }
 
-    procDataLoop ();
-
-    if (m_MReturnz80.IsRunning())
+    // If this is a dialog's event loop, started by one of our event
+    // handlers, the handler isn't done with the terminal yet.
+    if (m_decodeHold > 0)
     {
-        m_MReturnz80.Stop();
-        SaveRestoreColors (save, host);
-        SaveRestoreColors (restore, micro);
-        MicroEmulate;
-        SaveRestoreColors (save, micro);
-        SaveRestoreColors (restore, host);
+        return;
     }
+
+    DecodeStart ();
 }
 
 void PtermFrame::OnTimer (wxTimerEvent &)
 {
+    bool busy;
+    
     if (m_needtoBoot)
     {
         m_needtoBoot = false;
         BootMtutor();
     }
 
-    if (--m_delay > 0)
+    busy = MicroService ();
+    if (--m_delay > 0 || busy)
     {
         return;
     }
 
     if (ppt_running && !in_r_exec)
     {
-        SaveRestoreColors (save, host);
-        SaveRestoreColors (restore, micro);
-        MicroEmulate;
-        SaveRestoreColors (save, micro);
-        SaveRestoreColors (restore, host);
+        MicroStart (micro);
         return;
     }
 
+    // The delay is over.  The decode thread goes on with the data,
+    // starting with the delayed word, when we next go idle.
     m_timer.Stop ();
-
-    procDataLoop ();
-
-    if (m_MReturnz80.IsRunning())
-    {
-        m_MReturnz80.Stop();
-        SaveRestoreColors (save, host);
-        SaveRestoreColors (restore, micro);
-        MicroEmulate;
-        SaveRestoreColors (save, micro);
-        SaveRestoreColors (restore, host);
-    }
+    wxWakeUpIdle ();
 }
 
 // ppt m.clock
@@ -2199,39 +2359,70 @@ void PtermFrame::OnDclock(wxTimerEvent &)
 // resume z80 execution after it gives up control to resident
 void PtermFrame::OnMz80(wxTimerEvent &)
 {
-    SaveRestoreColors (save, host);
-    SaveRestoreColors (restore, micro);
-    MicroEmulate;
-    SaveRestoreColors (save, micro);
-    SaveRestoreColors (restore, host);
+    Z80YieldEnd ();
+    MicroStart (micro);
 }
 
 
-// Common code for processing pending PLATO data.  This is used by the
-// OnIdle handler for the normal (no delay, no pacing) case, and by
-// the OnTimer handler if delay is currently being done.
-void PtermFrame::procDataLoop (void)
+// Process pending PLATO data.  This is a run of the decode thread,
+// started by DecodeStart from the OnIdle handler, or after a delay
+// from OnTimer.
+//
+// Processing stops after about half a frame interval even if there is
+// more data, or sooner if an event is waiting to be handled (see
+// DecodeHold), and m_decodeYield is set, so that a big screen load
+// does not hold off keyboard, menu and paint events.  Another run picks
+// up where this left off.  Returns false if there was nothing to do.
+bool PtermFrame::procDataLoop (void)
 {
     int word = 0;   // Initialize to prevent randomness below
-    bool refresh = false;
+    bool work = false;
+    const long start = m_presentWatch.Time ();
+    const long budget = (m_frameMs > 2) ? m_frameMs / 2 : 1;
+    int count = 0;
+    int first;
     
     mjobs = 0;
+    m_decodeYield = false;
+    UseColors (host);
 
     if (m_nextword != C_NODATA)
     {
         m_ignoreDelay = false;      // Assume it's not block erase
-        refresh = procPlatoWord (m_nextword, m_conn->Ascii ());
+        procPlatoWord (m_nextword, m_conn->Ascii ());
         m_nextword = C_NODATA;
+        work = true;
     }
 
     // If in local mode (booted from floppy) we never process input
     // because we don't have a connection at all.
     while (!m_mtutorBoot)
     {
+        // If the last word started the z80 (mode 5, 6 or 7), give it
+        // the rest of this interval to finish.  If it isn't done by
+        // then, the rest of the data waits for it.
+        if (m_microRun)
+        {
+            work = true;
+            if (MicroService ())
+            {
+                m_decodeYield = true;
+                break;
+            }
+        }
+
         /*
-        **  Process words until there is nothing left.
+        **  Process words until there is nothing left.  Words are
+        **  taken from the connection a batch at a time; the rest of
+        **  a batch is dropped if the connection has flushed it since.
         */
-        word = m_conn->NextWord ();
+        m_wordIndex = m_conn->LiveWord (m_wordIndex, m_wordCount);
+        if (m_wordIndex == m_wordCount)
+        {
+            m_wordIndex = 0;
+            m_wordCount = m_conn->NextWords (m_words, WordBatch);
+        }
+        word = (m_wordIndex < m_wordCount) ? m_words[m_wordIndex++] : C_NODATA;
     
         if (word == C_NODATA || word == C_DISCONNECT ||
             word == C_CONNFAIL1 || word == C_CONNFAIL2)
@@ -2252,84 +2443,120 @@ void PtermFrame::procDataLoop (void)
                 continue;
             }
             
+            // The GUI thread starts the delay timer, see DecodeFinish
             m_delay = word >> 19;
             m_nextword = word & 01777777;
             if (m_conn->Ascii ())
             {
-                m_timer.Start (8);  // 16.67 / (21 / 10), rounded
+                m_delayMs = 8;      // 16.67 / (21 / 10), rounded
             }
             else
             {
-                m_timer.Start (17);
+                m_delayMs = 17;
             }
             
-            if (refresh)
-            {
-                m_canvas->Refresh (false);
-            }
+            ptermReleaseRaster ();
 
-            return;
+            return true;
         }
         
         debug ("processing data from plato %07o", word);
         m_ignoreDelay = false;      // Assume it's not block erase
-        refresh |= procPlatoWord (word, m_conn->Ascii ());
-    }
+        work = true;
+        if (word >= 040 && word < 0177 && m_conn->Ascii () && !m_dumbTty &&
+            m_ascState == none && (mode >> 2) == 3)
+        {
+            // A printable character in ASCII text mode.  Take it and
+            // any that follow it in this batch as one run.
+            first = m_wordIndex - 1;
+            while (m_wordIndex < m_wordCount &&
+                   m_words[m_wordIndex] >= 040 && m_words[m_wordIndex] < 0177)
+            {
+                m_wordIndex++;
+            }
+            procAsciiText (m_words + first, m_wordIndex - first);
+            count += m_wordIndex - first - 1;
+        }
+        else
+        {
+            procPlatoWord (word, m_conn->Ascii ());
+        }
 
-    if (refresh)
-    {
-        m_canvas->Refresh (false);
+        // Checking the time is cheap, but not free, so only do it
+        // every so many words.
+        if (++count >= 0100)
+        {
+            count = 0;
+            if (m_decodeHold > 0 || m_presentWatch.Time () - start >= budget)
+            {
+                m_decodeYield = true;
+                break;
+            }
+        }
     }
+
+    ptermReleaseRaster ();
     
     // must check m_mtutorBoot else word has not been initialized.
     if (!m_mtutorBoot && (word == C_DISCONNECT ||
                           word == C_CONNFAIL2 ||
                           word == C_CONNFAIL2))
     {
-        wxString msg;
+        // The GUI thread reports it, see DecodeFinish
+        m_decodeEnd = word;
+        work = true;
+    }
 
-        // Report the problem
-        if (m_statusBar != NULL)
-        {
-            m_statusBar->SetStatusText (_(" Not connected"),
-                                        STATUS_CONN);
-        }
+    return work;
+}
 
-        wxDateTime ldt;
+// Report a connection that failed or was dropped; "word" is the
+// connection status code that said so.
+void PtermFrame::ptermConnFailed (int word)
+{
+    wxString msg;
 
-        ldt.SetToCurrent ();
-        if (word == C_CONNFAIL1 || word == C_CONNFAIL2)
-        {
-            msg.Printf (_("Connection failed @ %s on "),
-                        ldt.FormatTime ());
-        }
-        else
-        {
-            msg.Printf (_("Dropped connection @ %s on "),
-                        ldt.FormatTime ());
-        }
-        msg.Append (ldt.FormatDate ());
-        WriteTraceMessage (msg);
-        msg.Printf (_("%s on "), ldt.FormatTime ());
-        msg.Append (ldt.FormatDate ());   // fits in dialog box title
-        
-        Iconize (false);    // make window visible when connection fails
+    // Report the problem
+    if (m_statusBar != NULL)
+    {
+        m_statusBar->SetStatusText (_(" Not connected"),
+                                    STATUS_CONN);
+    }
 
-        PtermConnFailDialog dlg (wxID_ANY, msg, wxDefaultPosition,
-                                 wxSize (320, 140), word, m_profile);
-        dlg.CenterOnScreen ();
+    wxDateTime ldt;
 
-        int action = dlg.ShowModal ();
-        
-        switch (action)
-        {
-        case wxID_OK:
-            // ???
-            ptermApp->DoConnectDialog ();
-            break;
-        default:
-            Close (true);
-        }
+    ldt.SetToCurrent ();
+    if (word == C_CONNFAIL1 || word == C_CONNFAIL2)
+    {
+        msg.Printf (_("Connection failed @ %s on "),
+                    ldt.FormatTime ());
+    }
+    else
+    {
+        msg.Printf (_("Dropped connection @ %s on "),
+                    ldt.FormatTime ());
+    }
+    msg.Append (ldt.FormatDate ());
+    WriteTraceMessage (msg);
+    msg.Printf (_("%s on "), ldt.FormatTime ());
+    msg.Append (ldt.FormatDate ());   // fits in dialog box title
+    
+    Iconize (false);    // make window visible when connection fails
+
+    PtermConnFailDialog dlg (wxID_ANY, msg, wxDefaultPosition,
+                             wxSize (320, 140), word, m_profile);
+    dlg.CenterOnScreen ();
+
+    int action = dlg.ShowModal ();
+    
+    switch (action)
+    {
+    case wxID_OK:
+        // ???
+        ptermApp->DoConnectDialog ();
+        break;
+    default:
+        Close (true);
     }
 }
 
@@ -2697,6 +2924,7 @@ void PtermFrame::OnCopyScreen (wxCommandEvent &)
 {
     wxBitmapDataObject *screen;
 
+    ptermUnscroll ();
     screen = new wxBitmapDataObject (*m_bitmap);
 
     if (wxTheClipboard->Open ())
@@ -3081,6 +3309,7 @@ void PtermFrame::OnSaveScreen (wxCommandEvent &)
     filename = fd.GetPath ();
     idx = fd.GetFilterIndex ();
 
+    ptermUnscroll ();
     wxImage screenImage = m_bitmap->ConvertToImage ();
     wxFileName fn (filename);
     wxString filt_ext (exts[idx]);
@@ -3206,6 +3435,8 @@ void PtermFrame::OnSessionSettings (wxCommandEvent &)
 
 void PtermFrame::UpdateSessionSettings (void)
 {
+    // This comes from the dialog's events, not ours
+    DecodeHold ();
     *m_profile = *ptermApp->m_sessDialog->m_profile;
 
     if ( m_profile->m_noColor || m_conn->Classic ())
@@ -3270,6 +3501,7 @@ void PtermFrame::UpdateSessionSettings (void)
     }
     ptermApp->m_sessDialog->Destroy ();
     ptermApp->m_sessDialog = NULL;
+    DecodeRelease ();
 }
 
 void PtermFrame::OnPrint (wxCommandEvent &)
@@ -3372,7 +3604,7 @@ void PtermFrame::OnResize (wxSizeEvent& )
 // mode flags and the window or display size.
 void PtermFrame::UpdateDisplayState (void)
 {
-    int client_h, client_w, canvas_h, canvas_w;
+    int client_h, client_w, canvas_h, canvas_w, rate;
     wxDisplay d (wxDisplay::GetFromWindow (this));
     wxRect r;
 
@@ -3381,6 +3613,19 @@ void PtermFrame::UpdateDisplayState (void)
         return;
     }
 
+    // Display updates are paced to the profile's frame rate if it has
+    // one, otherwise to the refresh rate of the monitor we're on.
+    rate = m_profile->m_frameRate;
+    if (rate <= 0)
+    {
+        rate = d.GetCurrentMode ().refresh;
+    }
+    if (rate <= 0)
+    {
+        rate = 60;
+    }
+    m_frameMs = (rate > 1000) ? 1 : 1000 / rate;
+
     if (m_fullScreen)
     {
         r = d.GetGeometry ();
@@ -3498,14 +3743,74 @@ void PtermFrame::fixAlpha (void)
 }
 #endif
 
-void PtermFrame::ptermDrawChar (int x, int y, int snum, int cnum, bool autobs)
+// Character cell geometry for each glyph orientation (see ptermGlyph):
+// width and height of the cell in pixels, and the offset of its lower
+// left corner from the character position.  Vertical characters are
+// rotated so they extend to the left of the position; large vertical
+// ones also extend one row below it.
+static const struct
 {
-    u32 fpix, bpix;
-    const u16 *charp, *svcharp;
-    PixelData pixmap (*m_bitmap);
-    PixelData selmap (*m_selmap);
+    int w, h, ox, oy;
+} glyphGeom[4] =
+{
+    { 8, 16, 0, 0 },            // normal
+    { 16, 32, 0, 0 },           // large
+    { 16, 8, -15, 0 },          // vertical
+    { 32, 16, -30, -1 }         // large vertical
+};
+
+#define GlyphOrient ((large ? 1 : 0) | (vertical ? 2 : 0))
+
+// Expand a character pattern (8 column words, bit 0 at the bottom) into
+// one pixel mask per row of the character cell for the given
+// orientation.  Bit b of row r is the pixel at offset b, r from the
+// lower left corner of the cell.  This reproduces the pixels the
+// dot by dot drawing loop used to set, including the doubled dots for
+// large characters.
+static void expandGlyph (const u16 *charp, int orient, u32 *rows)
+{
+    int i, j;
+
+    memset (rows, 0, 32 * sizeof (u32));
+    for (j = 0; j < 8; j++)
+    {
+        for (i = 0; i < 16; i++)
+        {
+            if ((charp[j] & (1 << i)) == 0)
+            {
+                continue;
+            }
+            switch (orient)
+            {
+            case 0:
+                rows[i] |= 1U << j;
+                break;
+            case 1:
+                rows[2 * i] |= 3U << (2 * j);
+                rows[2 * i + 1] |= 3U << (2 * j);
+                break;
+            case 2:
+                rows[j] |= 1U << (15 - i);
+                break;
+            case 3:
+                rows[2 * j] |= 3U << (30 - 2 * i);
+                rows[2 * j + 1] |= 3U << (30 - 2 * i);
+                break;
+            }
+        }
+    }
+}
+
+// Return the expanded row masks for character cnum of set snum, in the
+// current size and orientation.  Sets M0 to M3 are cached; the entries
+// for the loadable sets are invalidated by mode2 as characters are
+// loaded.  M4 to M7 have no character memory behind them, so those are
+// expanded each time from wherever the set pointer ends up.
+const u32 *PtermFrame::ptermGlyph (int snum, int cnum)
+{
+    const int orient = GlyphOrient;
+    const u16 *charp;
     
-    // Drawing a character is done simply by drawing the dots one by one.
     if (snum == 0)
     {
         charp = plato_m0;
@@ -3519,8 +3824,35 @@ void PtermFrame::ptermDrawChar (int x, int y, int snum, int cnum, bool autobs)
         charp = plato_m23 + (snum - 2) * (8 * 64);
     }
     charp += 8 * cnum;
-    svcharp = charp;
-    //debug ("char %d mem %d addr %p", cnum, snum, charp);
+
+    if (snum > 3)
+    {
+        expandGlyph (charp, orient, m_glyphScratch);
+        return m_glyphScratch;
+    }
+    if ((m_glyphValid[snum][cnum] & (1 << orient)) == 0)
+    {
+        expandGlyph (charp, orient, m_glyphs[snum][cnum][orient]);
+        m_glyphValid[snum][cnum] |= 1 << orient;
+    }
+    
+    return m_glyphs[snum][cnum][orient];
+}
+
+void PtermFrame::ptermDrawChar (int x, int y, int snum, int cnum, bool autobs)
+{
+    u32 fpix, bpix;
+    const u32 *glyph, *svglyph;
+    u32 **pixmap = ptermScreenRows ();
+    const int orient = GlyphOrient;
+    const int gx = glyphGeom[orient].ox;
+    const int gy = glyphGeom[orient].oy;
+    const int gw = glyphGeom[orient].w;
+    const int gh = glyphGeom[orient].h;
+    
+    glyph = ptermGlyph (snum, cnum);
+    svglyph = glyph;
+    //debug ("char %d mem %d addr %p", cnum, snum, glyph);
 
     if (modexor || (wemode & 1))
     {
@@ -3537,7 +3869,7 @@ void PtermFrame::ptermDrawChar (int x, int y, int snum, int cnum, bool autobs)
         {
             // mode erase, so clear the savemap entry (write M0 entry 055
             // which is a space)
-            svcharp = plato_m0 + 8 * 055;
+            svglyph = ptermGlyph (0, 055);
         }
     }
 
@@ -3546,71 +3878,121 @@ void PtermFrame::ptermDrawChar (int x, int y, int snum, int cnum, bool autobs)
     // the text currently stored in the savemap, which is coarse grid
     // aligned.  Selection region bitmap entries are normally drawn
     // in mode rewrite, except for autobackspace where we want to
-    // save the resulting combined character shape.
-    ptermDrawCharInto (x, y, charp, fpix, bpix, mode, modexor, pixmap);
-    ptermDrawCharInto (x & 0770, y & 0760, svcharp, m_selpixf, m_selpixb,
-                       (autobs ? 3 : 1), false, selmap);
+    // save the resulting combined character shape.  The latter only
+    // shows on screen if a region is currently selected.
+    ptermDamage (x + gx, y + gy, x + gx + gw - 1, y + gy + gh - 1);
+    if (m_regionWidth != 0)
+    {
+        ptermDamage ((x & 0770) + gx, (y & 0760) + gy,
+                     (x & 0770) + gx + gw - 1, (y & 0760) + gy + gh - 1);
+    }
+    ptermDrawCharInto (x, y, glyph, fpix, bpix, mode, modexor, pixmap);
+    ptermDrawCharSel (x & 0770, y & 0760, svglyph, !autobs);
 }
 
-void PtermFrame::ptermDrawCharInto (int x, int y, const u16 *charp,
-                                    u32 fpix, u32 bpix, int cmode,
-                                    bool xor_p, PixelData &pixmap)
+// Write "w" bits (at most 32) into a row of a one bit per pixel plane,
+// starting at bit x and wrapping around the end of the row.  Bits that
+// are clear in "bits" are cleared in the row if "rewrite" is true, and
+// left alone otherwise.
+static void planeWrite (u32 *row, int x, u32 bits, int w, bool rewrite)
 {
-    int &cx = (vertical) ? y : x;
-    int &cy = (vertical) ? x : y;
-    int i, j, saveY, dx, dy, sdy;
-    u16 charw;
+    const u32 mask = (w == 32) ? 0xffffffff : ((1U << w) - 1);
+    const int i = (x >> 5) & 017;
+    const int s = x & 31;
+    const u64 m = (u64) mask << s;
+    const u64 b = (u64) (bits & mask) << s;
 
-    saveY = cy;
-    dx = dy = (large) ? 2 : 1;
-    sdy = 1;
-    if (vertical)
+    if (rewrite)
     {
-        sdy = -1;
-        dy = -dy;
+        row[i] &= ~(u32) m;
+    }
+    row[i] |= (u32) b;
+    if ((m >> 32) != 0)
+    {
+        // Spills into the next word, which is word 0 at the end of the row
+        if (rewrite)
+        {
+            row[(i + 1) & 017] &= ~(u32) (m >> 32);
+        }
+        row[(i + 1) & 017] |= (u32) (b >> 32);
     }
+}
 
-    for (j = 0; j < 8; j++)
+// Draw a character from its expanded row masks, a row at a time.  In
+// modes rewrite and inverse (cmode bit 1 clear) every pixel of the
+// cell is written; in write and erase only the character's dots are.
+// The cell wraps around the screen edges, as the dots always did.
+void PtermFrame::ptermDrawCharInto (int x, int y, const u32 *glyph,
+                                    u32 fpix, u32 bpix, int cmode,
+                                    bool xor_p, u32 **pixmap)
+{
+    const int orient = GlyphOrient;
+    const int gw = glyphGeom[orient].w;
+    const int gh = glyphGeom[orient].h;
+    int r, b;
+    u32 *row, *pmap, bits;
+
+    x += glyphGeom[orient].ox;
+    y += glyphGeom[orient].oy;
+
+    for (r = 0; r < gh; r++)
     {
-        cy = saveY;
-        charw = *charp++;
-        for (i = 0; i < 16; i++)
+        row = pixmap[YMADJUST ((y + r) & 0777)];
+        bits = glyph[r];
+        if ((cmode & 2) == 0)
         {
-            if ((charw & 1) == 0)
+            for (b = 0; b < gw; b++)
             {
-                // background, do we erase it?
-                if ((cmode & 2) == 0)
+                pmap = row + XMADJUST ((x + b) & 0777);
+                if ((bits >> b) & 1)
                 {
-                    ptermUpdatePoint (x, y, bpix, false, pixmap);
-                    if (large)
-                    {
-                        ptermUpdatePoint (x + 1, y, bpix, false, pixmap);
-                        ptermUpdatePoint (x, y + sdy, bpix, false, pixmap);
-                        ptermUpdatePoint (x + 1, y + sdy, bpix, false, pixmap);
-                    }
+                    *pmap = (xor_p) ? ((*pmap ^ fpix) | m_maxalpha) : fpix;
+                }
+                else
+                {
+                    *pmap = bpix;
                 }
             }
-            else
+        }
+        else
+        {
+            for (b = 0; bits != 0; b++, bits >>= 1)
             {
-                ptermUpdatePoint (x, y, fpix, xor_p, pixmap);
-                if (large)
+                if (bits & 1)
                 {
-                    ptermUpdatePoint (x + 1, y, fpix, xor_p, pixmap);
-                    ptermUpdatePoint (x, y + sdy, fpix, xor_p, pixmap);
-                    ptermUpdatePoint (x + 1, y + sdy, fpix, xor_p, pixmap);
+                    pmap = row + XMADJUST ((x + b) & 0777);
+                    *pmap = (xor_p) ? ((*pmap ^ fpix) | m_maxalpha) : fpix;
                 }
             }
-            charw >>= 1;
-            cy += dy;
         }
-        cx += dx;
+    }
+}
+
+// Draw a character into the selection image.  This is mode rewrite,
+// or mode write if "rewrite" is false; there is no xor.
+void PtermFrame::ptermDrawCharSel (int x, int y, const u32 *glyph,
+                                   bool rewrite)
+{
+    const int orient = GlyphOrient;
+    const int gw = glyphGeom[orient].w;
+    const int gh = glyphGeom[orient].h;
+    int r;
+
+    x += glyphGeom[orient].ox;
+    y += glyphGeom[orient].oy;
+
+    for (r = 0; r < gh; r++)
+    {
+        planeWrite (ptermSelRow (YMADJUST ((y + r) & 0777)), XMADJUST (x),
+                    glyph[r], gw, rewrite);
     }
 }
 
 void PtermFrame::ptermDrawPoint (int x, int y)
 {
-    PixelData pixmap (*m_bitmap);
+    u32 **pixmap = ptermScreenRows ();
 
+    ptermDamage (x & 0777, y & 0777, x & 0777, y & 0777);
     if (modexor || (wemode & 1))
     {
         // mode rewrite or write
@@ -3627,6 +4009,24 @@ void PtermFrame::ptermDrawLine (int x1, int y1, int x2, int y2)
 {
     int dx, dy;
     int stepx, stepy;
+    u32 **pixmap = ptermScreenRows ();
+    u32 pix;
+    bool xor_p;
+
+    // Same pixel rules as ptermDrawPoint, but worked out once for
+    // the whole line.
+    if (modexor || (wemode & 1))
+    {
+        // mode rewrite or write
+        pix = m_fgpix;
+        xor_p = modexor;
+    }
+    else
+    {
+        // mode inverse or erase
+        pix = m_bgpix;
+        xor_p = false;
+    }
 
     dx = x2 - x1;
     dy = y2 - y1;
@@ -3635,8 +4035,10 @@ void PtermFrame::ptermDrawLine (int x1, int y1, int x2, int y2)
     dx <<= 1;
     dy <<= 1;
     
+    ptermDamage (x1, y1, x2, y2);
+
     // draw first point
-    ptermDrawPoint (x1, y1);
+    ptermUpdatePoint (x1, y1, pix, xor_p, pixmap);
     
     //check for shallow line
     if (dx > dy) 
@@ -3651,7 +4053,7 @@ void PtermFrame::ptermDrawLine (int x1, int y1, int x2, int y2)
             }
             x1 += stepx;
             fraction += dy;
-            ptermDrawPoint (x1, y1);
+            ptermUpdatePoint (x1, y1, pix, xor_p, pixmap);
         }
     } 
     //otherwise steep line
@@ -3667,7 +4069,7 @@ void PtermFrame::ptermDrawLine (int x1, int y1, int x2, int y2)
             }
             y1 += stepy;
             fraction += dx;
-            ptermDrawPoint (x1, y1);
+            ptermUpdatePoint (x1, y1, pix, xor_p, pixmap);
         }
     }
 }
@@ -3676,7 +4078,6 @@ void PtermFrame::ptermFullErase (void)
 {
     const bool savexor = modexor;
     const int savemode = mode;
-    wxClientDC dc (m_canvas);
 
     m_usefont = false;
 
@@ -3696,8 +4097,8 @@ void PtermFrame::ptermBlockErase (int x1, int y1, int x2, int y2)
     int t;
     int x, y;
     u32 pix;
-    PixelData pixmap (*m_bitmap);
-    PixelData selmap (*m_selmap);
+    u32 *row, *p, *end;
+    u32 **pixmap = ptermScreenRows ();
     
     if (x1 > x2)
         t = x1, x1 = x2, x2 = t;
@@ -3715,11 +4116,40 @@ void PtermFrame::ptermBlockErase (int x1, int y1, int x2, int y2)
         pix = m_bgpix;
     }
 
-    for (y = y1; y <= y2; y++)
+    ptermDamage (x1, y1, x2, y2);
+    if (x1 < 0 || x2 > 511)
+    {
+        // Wraps around the edge; not done by the host, but do it
+        // the slow way in case.
+        for (y = y1; y <= y2; y++)
+        {
+            for (x = x1; x <= x2; x++)
+            {
+                ptermUpdatePoint (x, y, pix, modexor, pixmap);
+            }
+        }
+    }
+    else
     {
-        for (x = x1; x <= x2; x++)
+        // Fill a row at a time through the row table.
+        for (y = y1; y <= y2; y++)
         {
-            ptermUpdatePoint (x, y, pix, modexor, pixmap);
+            row = pixmap[YMADJUST (y & 0777)];
+            end = row + XMADJUST (x2) + 1;
+            if (modexor)
+            {
+                for (p = row + XMADJUST (x1); p < end; p++)
+                {
+                    *p = (*p ^ pix) | m_maxalpha;
+                }
+            }
+            else
+            {
+                for (p = row + XMADJUST (x1); p < end; p++)
+                {
+                    *p = pix;
+                }
+            }
         }
     }
     
@@ -3732,19 +4162,26 @@ void PtermFrame::ptermBlockErase (int x1, int y1, int x2, int y2)
     {
         for (int col = scol; col < scol + cols; col++)
         {
-            textmap[row * 64 + col][0] = ' ';
-            textmap[row * 64 + col][1] = '\0';
-            textmap[row * 64 + col][2] = '\0';
-            textmap[row * 64 + col][3] = '\0';
+            textcell (col, row)[0] = ' ';
+            textcell (col, row)[1] = '\0';
+            textcell (col, row)[2] = '\0';
+            textcell (col, row)[3] = '\0';
         }
     }
     
     // Wipe the corresponding region of the selection image
+    if (m_regionWidth != 0)
+    {
+        ptermDamage (scol * 8, srow * 16,
+                     (scol + cols) * 8 - 1, (srow + rows) * 16 - 1);
+    }
     for (y = srow * 16; y < (srow + rows) * 16; y++)
     {
-        for (x = scol * 8; x < (scol + cols) * 8; x++)
+        for (x = scol * 8; x < (scol + cols) * 8; x += 32)
         {
-            ptermUpdatePoint (x, y, m_selpixb, false, selmap);
+            t = (scol + cols) * 8 - x;
+            planeWrite (ptermSelRow (YMADJUST (y & 0777)), XMADJUST (x),
+                        0, (t < 32) ? t : 32, true);
         }
     }
 }
@@ -3769,48 +4206,8 @@ void PtermFrame::ptermBlockErase (int x1, int y1, int x2, int y2)
 
 void PtermFrame::ptermPaint (int pat)
 {
-    int xm, ym;
-    PixelData pixmap (*m_bitmap);
-    
-    xm = XMADJUST (currentX);
-    ym = YMADJUST (currentY);
-
-    ptermPaintWalker (xm, ym, pixmap, pat, 0);
-    ptermPaintWalker (xm, ym, pixmap, pat, 1);
-}
-
-// Pass 0 means: stop if you hit background pixels; set all other pixels
-// as visited.
-// Pass 1 means: stop if you hit a pixel that's not been marked as visited;
-// for a visited pixel, set it to foreground if it is supposed to be
-// painted, or back to not visited if it is supposed to be unchanged.
-//
-// Since normal pixel values all have alpha == 255, we use alpha == 0
-// as the marker value.
-#define wdone(pmap, pass) ((pass && (*pmap & m_maxalpha) != 0) ||   \
-                           (!pass && (*pmap == m_bgpix ||           \
-                                      (*pmap & m_maxalpha) == 0)))
-
-// This stack is used to implement what amounts to the trivial recursive
-// fill algorithm without actual recursion.  All we need is one byte per
-// recursion level, which is an acceptable hit.  Worst case (filling a 
-// blank screen) depth is the number of pixels on the screen, plus one
-// because we use one to visit a pixel that is already filled or is not
-// going to be filled.  So allocate that plus one more; the one extra
-// entry allows a stack overflow sanity check.
-static u8 walkstack[512 * 512 + 2];
-
-void PtermFrame::ptermPaintWalker (int x, int y, PixelData & pixmap, 
-                                   int pat, int pass)
-{
-    PixelData::Iterator p (pixmap);
-    u32 *pmap;
-    int sp;
-#define PUSH walkstack[++sp] = 0
-    int maxsp = 0;
-    int pixels = 0;
-    int w, i, d;
-    const u16 *cp = NULL;
+    int i, d;
+    const u16 *cp = NULL;
     
     if (pat)
     {
@@ -3857,128 +4254,738 @@ void PtermFrame::ptermPaintWalker (int x, int y, PixelData & pixmap,
         cp += 8 * d;
     }
     
-    sp = -1;
-    PUSH;
+    ptermPaintFill (XMADJUST (currentX), YMADJUST (currentY),
+                    ptermScreenRows (), cp);
+}
+
+// Scanline flood fill for -paint-.  The area filled is the 4-connected
+// region of pixels, starting at x/y (bitmap coordinates), that are not
+// background; if the starting pixel is background nothing is filled.
+// For a plain fill every pixel in the region is set to the foreground
+// color.  For a character fill (cp not NULL) the character pattern is
+// tiled on coarse grid boundaries and only its foreground dots are set.
+//
+// The region is found a horizontal run at a time: each run is extended
+// as far left and right as it goes, filled, and then the rows above and
+// below it are scanned for runs still to be filled, one seed per run.
+// Filled pixels are tracked in a visited bitmap local to this call, so
+// the screen bitmap is only ever changed inside the region and pixels
+// not yet visited still have their original values when they are
+// examined.  Pixels with alpha of zero are treated as boundary, as the
+// earlier pixel walker did.
+#define fillable(pmap) (*(pmap) != m_bgpix && (*(pmap) & m_maxalpha) != 0)
+#define visited(x, y)  ((vmap[y][(x) >> 5] >> ((x) & 31)) & 1)
+
+void PtermFrame::ptermPaintFill (int x, int y, u32 **pixmap, const u16 *cp)
+{
+    u32 vmap[512][512 / 32];
+    struct seed
+    {
+        short x, y;
+    } *stack;
+    int sp, maxsp = 0, stacksize = 1024;
+    int spans = 0, pixels = 0;
+    int xl, xr, nx, ny, i;
+    int xmin = x, xmax = x, ymin = y, ymax = y;
+    u32 *row, *nrow;
+    
+    if (!fillable (pixmap[y] + x))
+    {
+        return;
+    }
+    
+    memset (vmap, 0, sizeof (vmap));
+    stack = (struct seed *) malloc (stacksize * sizeof (*stack));
+    if (stack == NULL)
+    {
+        return;
+    }
+    sp = 0;
+    stack[0].x = x;
+    stack[0].y = y;
+    
     while (sp >= 0)
     {
-        if (sp > maxsp)
+        x = stack[sp].x;
+        y = stack[sp].y;
+        sp--;
+        row = pixmap[y];
+
+        // A seed may have been filled by another run since it was pushed.
+        if (visited (x, y))
         {
-            assert (sp < sizeof (walkstack) - 1);
-            maxsp = sp;
+            continue;
         }
-        p.MoveTo (pixmap, x, y);
-        pmap = (u32 *)(p.m_ptr);
+        
+        // Find the extent of this run
+        for (xl = x; xl > 0 && !visited (xl - 1, y) &&
+                 fillable (row + xl - 1); xl--) ;
+        for (xr = x; xr < 511 && !visited (xr + 1, y) &&
+                 fillable (row + xr + 1); xr++) ;
 
-        // Each time through the loop we increment the top of stack
-        // value, to reflect progress in the walk
-        w = walkstack[sp];
-        walkstack[sp]++;
+        // Fill it and mark it visited
+        for (i = xl; i <= xr; i++)
+        {
+            vmap[y][i >> 5] |= 1U << (i & 31);
+            if (cp == NULL || (cp[i & 7] & (0x8000 >> (y & 15))) != 0)
+            {
+                row[i] = m_fgpix;
+            }
+            else
+            {
+                row[i] |= m_maxalpha;
+            }
+        }
+        spans++;
+        pixels += xr - xl + 1;
+        xmin = (xl < xmin) ? xl : xmin;
+        xmax = (xr > xmax) ? xr : xmax;
+        ymin = (y < ymin) ? y : ymin;
+        ymax = (y > ymax) ? y : ymax;
         
-        switch (w)
+        // Push a seed for each run in the rows above and below that
+        // is adjacent to this one and still to be filled.
+        for (ny = y - 1; ny <= y + 1; ny += 2)
         {
-        case 0:
-            // If the pixel is already filled, leave this level.
-            // Otherwise, fill the pixel and explore to the left.
-            if (wdone (pmap, pass))
+            if (ny < 0 || ny > 511)
             {
-                walkstack[sp] = 4;
-                break;
+                continue;
             }
-            if (pass)
+            nrow = pixmap[ny];
+            nx = xl;
+            while (nx <= xr)
             {
-                if (cp != NULL)
+                if (visited (nx, ny) || !fillable (nrow + nx))
                 {
-                    // Character fill.  We draw the characters on 
-                    // coarse grid boundaries.
-                    const int cx = x & 7;
-                    const int cy = y & 15;
+                    nx++;
+                    continue;
+                }
+                if (++sp == stacksize)
+                {
+                    struct seed *ns;
 
-                    if ((cp[cx] & (0x8000 >> cy)) != 0)
+                    stacksize *= 2;
+                    ns = (struct seed *) realloc (stack, stacksize * sizeof (*stack));
+                    if (ns == NULL)
                     {
-                        // Foreground pixel, paint it
-                        *pmap = m_fgpix;
-                    }
-                    else
-                    {
-                        // Backround pixel, unmark it
-                        *pmap |= m_maxalpha;
+                        // Out of memory; stop with what we have filled
+                        sp = -1;
+                        break;
                     }
+                    stack = ns;
                 }
-                else
+                stack[sp].x = nx;
+                stack[sp].y = ny;
+                if (sp > maxsp)
                 {
-                    // Plain flood fill
-                    *pmap = m_fgpix;
+                    maxsp = sp;
+                }
+                // Skip the rest of this run
+                while (nx <= xr && !visited (nx, ny) && fillable (nrow + nx))
+                {
+                    nx++;
                 }
             }
-            else
-            {
-                // Mark the pixel by setting alpha to zero
-                *pmap &= ~m_maxalpha;
-            }
-            pixels++;
-            if (x > 0)
-            {
-                x--;
-                PUSH;
-            }
-            break;
-        case 1:
-            // Explore to the right
-            if (x < 511)
-            {
-                x++;
-                PUSH;
-            }
-            break;
-        case 2:
-            // Explore up
-            if (y < 511)
-            {
-                y++;
-                PUSH;
-            }
-            break;
-        case 3:
-            // Explore down
-            if (y > 0)
+        }
+    }
+    free (stack);
+
+    // Fill coordinates are bitmap coordinates
+    ptermDamage (xmin, YMADJUST (ymin), xmax, YMADJUST (ymax));
+    
+    trace ("paint: %d pixels, %d spans, %d max stack", pixels, spans, maxsp);
+}
+
+#undef fillable
+#undef visited
+
+// Fill in the row table the drawing primitives use, for the current
+// row origin.
+void PtermFrame::ptermSetRows (void)
+{
+    int y;
+    
+    for (y = 0; y < 512; y++)
+    {
+        m_rows[y] = m_back[(y + m_scrollRows) & 0777];
+    }
+}
+
+// Bring the screen bitmap up to date: let go of it if it is selected
+// into the font drawing DC, and copy what has changed in the back
+// buffer to it.  This must be done before the bitmap is used in any
+// way (drawn, selected into a DC, converted to an image, etc.).  On the
+// decode thread, this just asks the GUI thread to let go of the font
+// DC; the copy is done when the GUI thread next uses the bitmap.
+void PtermFrame::ptermReleaseRaster (void)
+{
+    int x1, x2, y;
+    u16 stale;
+    
+    if (DecodeThread ())
+    {
+        if (m_fontDC)
+        {
+            guiCall (GuiRelease);
+        }
+        return;
+    }
+    if (m_fontDC)
+    {
+#ifdef __WXMSW__
+        // On Windows, the Alpha channel gets messed up by
+        // the DrawText operation, which makes for very
+        // strange looking displays.  So fix it.  It's a 
+        // bit crude, but it gets the job done.
+        fixAlpha ();
+#endif
+        m_memDC->SelectObject (wxNullBitmap);
+        m_fontDC = false;
+        ptermReadBack (m_fontArea);
+    }
+    if (!m_backDirty)
+    {
+        return;
+    }
+    m_backDirty = false;
+    
+    PixelData pixmap (*m_bitmap);
+    PixelData::Iterator p (pixmap);
+
+    // Rows are looked up one at a time because on some OS (Windows)
+    // the bitmap is stored bottom up.  Each row is copied from its
+    // first changed 32 pixels to its last.
+    for (y = 0; y < 512; y++)
+    {
+        stale = m_backStale[y];
+        if (stale == 0)
+        {
+            continue;
+        }
+        m_backStale[y] = 0;
+        for (x1 = 0; (stale & (1U << x1)) == 0; x1++)
+            ;
+        for (x2 = 15; (stale & (1U << x2)) == 0; x2--)
+            ;
+        p.MoveTo (pixmap, x1 * 32, y);
+        memcpy (p.m_ptr, &m_back[y][x1 * 32],
+                (x2 - x1 + 1) * 32 * sizeof (u32));
+    }
+}
+
+// Copy the part of the screen bitmap given by r (bitmap coordinates)
+// to the back buffer, after drawing on the bitmap with a DC.  Whole
+// rows are copied, since font characters can stick out a bit on
+// either side of their nominal size.
+void PtermFrame::ptermReadBack (const wxRect &rect)
+{
+    wxRect r (rect);
+    int y;
+    
+    r.Intersect (wxRect (0, 0, 512, 512));
+    if (r.IsEmpty ())
+    {
+        return;
+    }
+    
+    PixelData pixmap (*m_bitmap);
+    PixelData::Iterator p (pixmap);
+
+    for (y = r.y; y < r.y + r.height; y++)
+    {
+        p.MoveTo (pixmap, 0, (y + m_scrollRows) & 0777);
+        memcpy (m_rows[y], p.m_ptr, sizeof (m_back[0]));
+    }
+}
+
+// Scroll the screen up by one line (16 dots) for dumb terminal mode.
+// No pixels are moved: the row origin is advanced, so what was the top
+// line becomes the bottom one, and the row table is rotated to match.
+// The new bottom line still holds what scrolled off the top; the caller
+// erases it.  The text map moves with the origin, and its new bottom
+// line is cleared here.
+void PtermFrame::ptermScrollUp (void)
+{
+    u32 *top[16];
+    
+    if (m_fontDC)
+    {
+        ptermReleaseRaster ();
+    }
+    memcpy (top, m_rows, sizeof (top));
+    memmove (m_rows, m_rows + 16, (512 - 16) * sizeof (m_rows[0]));
+    memcpy (m_rows + 512 - 16, top, sizeof (top));
+    m_scrollRows = (m_scrollRows + 16) & 0777;
+    
+    // Note that the textmap has y==0 for the bottom line
+    memset (&textcell (0, 0), 0, sizeof (textmap) / 32);
+}
+
+// Put the back buffer, selection image and text map back in their
+// natural row order, and bring the screen bitmap up to date.  This is
+// done before the screen bitmap is used other than through the row
+// table (selected into a DC, converted to an image, etc.) and only
+// costs a full copy if the screen has been scrolled in dumb terminal
+// mode.
+void PtermFrame::ptermUnscroll (void)
+{
+    const int n = m_scrollRows;
+    u32 (*save)[512];
+    u32 selplane[512][512 / 32];
+    cmentry text[32 * 64];
+    int y;
+    
+    if (n == 0)
+    {
+        ptermReleaseRaster ();
+        return;
+    }
+    // Anything drawn with the font DC goes to the back buffer first,
+    // while the rows are still where it expects them.
+    if (m_fontDC)
+    {
+        ptermReleaseRaster ();
+    }
+
+    // Screen row y is in row (y + n) of the back buffer, so the first n
+    // rows of it are the bottom of the screen.  Save those, move the
+    // rest up by n, and put the saved ones at the end.
+    save = (u32 (*)[512]) malloc (n * sizeof (*save));
+    if (save == NULL)
+    {
+        ptermReleaseRaster ();
+        return;
+    }
+    memcpy (save, m_back, n * sizeof (*save));
+    memmove (m_back, m_back + n, (512 - n) * sizeof (m_back[0]));
+    memcpy (m_back + 512 - n, save, n * sizeof (*save));
+    free (save);
+
+    memcpy (selplane, m_selplane, sizeof (selplane));
+    for (y = 0; y < 512; y++)
+    {
+        memcpy (m_selplane[y], selplane[(y + n) & 0777], sizeof (selplane[y]));
+    }
+    memcpy (text, textmap, sizeof (text));
+    for (y = 0; y < 32 * 64; y++)
+    {
+        memcpy (textmap[y], text[(y - (n << 2)) & 03777], sizeof (text[y]));
+    }
+
+    m_scrollRows = 0;
+    ptermSetRows ();
+    memset (m_backStale, 0xff, sizeof (m_backStale));
+    m_backDirty = true;
+    ptermReleaseRaster ();
+}
+
+// Expand the part of the selection image given by r (bitmap coordinates,
+// within the screen) into a bitmap of native pixels for drawing.
+wxBitmap PtermFrame::ptermSelectionBitmap (const wxRect &r)
+{
+    wxBitmap bm (r.width, r.height, 32);
+    PixelData pixmap (bm);
+    PixelData::Iterator p (pixmap);
+    u32 *pmap, *srow;
+    int x, y;
+
+    for (y = 0; y < r.height; y++)
+    {
+        p.MoveTo (pixmap, 0, y);
+        pmap = (u32 *) (p.m_ptr);
+        srow = ptermSelRow (r.y + y);
+        for (x = r.x; x < r.x + r.width; x++)
+        {
+            *pmap++ = ((srow[x >> 5] >> (x & 31)) & 1) ? m_selpixf : m_selpixb;
+        }
+    }
+    
+    return bm;
+}
+
+// Bilinear interpolation between two pixels, with weight w (0 to 256)
+// for pixel b.  Each 32-bit pixel is done as two pairs of 8-bit
+// channels, each pair in one multiply, so this works whatever the
+// channel order is.
+static inline u32 pixLerp (u32 a, u32 b, u32 w)
+{
+    const u32 iw = 256 - w;
+    const u32 rb = (((a & 0xff00ff) * iw + (b & 0xff00ff) * w) >> 8) & 0xff00ff;
+    const u32 ag = (((a >> 8) & 0xff00ff) * iw +
+                    ((b >> 8) & 0xff00ff) * w) & 0xff00ff00;
+
+    return rb | ag;
+}
+
+// Free the scaled copy of the screen, when bilinear scaling is no
+// longer in use; at large window sizes it is several megabytes.
+void PtermFrame::ptermFreeScaled (void)
+{
+    if (m_scaled == NULL)
+    {
+        return;
+    }
+    delete m_scaled;
+    delete [] m_scaleXTab;
+    delete [] m_scaleYTab;
+    m_scaled = NULL;
+    m_scaleXTab = m_scaleYTab = NULL;
+}
+
+// Bring the scaled copy of the screen bitmap, used for bilinear
+// scaling, up to date for the window scale and for the part of the
+// screen in ur (bitmap coordinates).  The copy is only rebuilt from
+// scratch when the scale changes; otherwise just the tiles marked as
+// changed by ptermDamage are scaled again.  Each scaled pixel depends
+// only on the source pixels around it, so the result is the same as
+// rescaling the whole screen.  Returns the rectangle of the scaled
+// copy that corresponds to ur.
+wxRect PtermFrame::ptermUpdateScaled (const wxRect &ur)
+{
+    const double xs = m_xscale;
+    const double ys = m_yscale;
+    const int dw = (int) ceil (512 * xs);
+    const int dh = (int) ceil (512 * ys);
+    int tx, ty, x, y, dx1, dy1, dx2, dy2, s;
+    double f;
+    
+    if (m_scaled == NULL || xs != m_scaledX || ys != m_scaledY)
+    {
+        delete m_scaled;
+        delete [] m_scaleXTab;
+        delete [] m_scaleYTab;
+        m_scaled = new wxBitmap (dw, dh, 32);
+        m_scaledX = xs;
+        m_scaledY = ys;
+
+        // Each table entry is the source pixel to the left of (or
+        // above) the sample point, times 512, plus the weight out of
+        // 256 of the pixel after it.
+        m_scaleXTab = new int[dw];
+        m_scaleYTab = new int[dh];
+        for (x = 0; x < dw; x++)
+        {
+            f = (x + 0.5) / xs - 0.5;
+            f = (f < 0) ? 0 : ((f > 511) ? 511 : f);
+            s = (int) f;
+            m_scaleXTab[x] = (s << 9) + (int) ((f - s) * 256 + 0.5);
+        }
+        for (y = 0; y < dh; y++)
+        {
+            f = (y + 0.5) / ys - 0.5;
+            f = (f < 0) ? 0 : ((f > 511) ? 511 : f);
+            s = (int) f;
+            m_scaleYTab[y] = (s << 9) + (int) ((f - s) * 256 + 0.5);
+        }
+        memset (m_scaleStale, 0xff, sizeof (m_scaleStale));
+    }
+
+    {
+        PixelData pixmap (*m_bitmap);
+        PixelData dstmap (*m_scaled);
+        PixelData::Iterator p (pixmap);
+        PixelData::Iterator d (dstmap);
+        u32 *rows[512];
+        u32 *drow, *s0, *s1;
+        int xt, yt, x0, x1, y0, y1;
+        wxRect tr (ur);
+        
+        // Scaled pixels at the edges of ur sample the source pixel just
+        // outside it, so tiles touching that need to be current too.
+        tr.Inflate (1);
+        tr.Intersect (wxRect (0, 0, 512, 512));
+        
+        for (y = 0; y < 512; y++)
+        {
+            p.MoveTo (pixmap, 0, (y + m_scrollRows) & 0777);
+            rows[y] = (u32 *) (p.m_ptr);
+        }
+
+        for (ty = tr.y >> 5; ty <= (tr.y + tr.height - 1) >> 5; ty++)
+        {
+            for (tx = tr.x >> 5; tx <= (tr.x + tr.width - 1) >> 5; tx++)
             {
-                y--;
-                PUSH;
+                if ((m_scaleStale[ty] & (1U << tx)) == 0)
+                {
+                    continue;
+                }
+                m_scaleStale[ty] &= ~(1U << tx);
+
+                // Scaled pixels whose samples touch this tile, which
+                // includes a source pixel of overlap on each side.
+                dx1 = (int) floor ((tx * 32 - 1) * xs);
+                dx2 = (int) ceil ((tx * 32 + 34) * xs);
+                dy1 = (int) floor ((ty * 32 - 1) * ys);
+                dy2 = (int) ceil ((ty * 32 + 34) * ys);
+                dx1 = (dx1 < 0) ? 0 : dx1;
+                dy1 = (dy1 < 0) ? 0 : dy1;
+                dx2 = (dx2 > dw) ? dw : dx2;
+                dy2 = (dy2 > dh) ? dh : dy2;
+
+                for (y = dy1; y < dy2; y++)
+                {
+                    yt = m_scaleYTab[y];
+                    y0 = yt >> 9;
+                    y1 = (y0 < 511) ? y0 + 1 : y0;
+                    s0 = rows[y0];
+                    s1 = rows[y1];
+                    d.MoveTo (dstmap, dx1, y);
+                    drow = (u32 *) (d.m_ptr);
+                    for (x = dx1; x < dx2; x++)
+                    {
+                        xt = m_scaleXTab[x];
+                        x0 = xt >> 9;
+                        x1 = (x0 < 511) ? x0 + 1 : x0;
+                        *drow++ = pixLerp (pixLerp (s0[x0], s0[x1], xt & 511),
+                                           pixLerp (s1[x0], s1[x1], xt & 511),
+                                           yt & 511);
+                    }
+                }
             }
-            break;
-        case 4:
-            // Done exploring at this pixel.  Pop the stack.  We have
-            // to adjust the coordinate, which is done based on the
-            // next to top stack entry -- that one reflects where the
-            // previous level is in its exploration, i.e., which coordinate
-            // adjustment it made before pushing this level.  Note that
-            // the previous level entry reflects the increment of the
-            // stack value, so the case labels are one higher than
-            // the corresponding ones above.
-            --sp;
-            if (sp < 0)
+        }
+    }
+
+    dx1 = (int) floor (xs * ur.x);
+    dy1 = (int) floor (ys * ur.y);
+    dx2 = (int) ceil (xs * (ur.x + ur.width));
+    dy2 = (int) ceil (ys * (ur.y + ur.height));
+    dx2 = (dx2 > dw) ? dw : dx2;
+    dy2 = (dy2 > dh) ? dh : dy2;
+    
+    return wxRect (dx1, dy1, dx2 - dx1, dy2 - dy1);
+}
+
+// Bring the enlarged copy of the screen bitmap, used on displays with
+// an integer content scale ("zoom") of 2 or more, up to date for the
+// part of the screen in ur (bitmap coordinates).  Only tiles marked as
+// changed by ptermDamage are redone: each source row of the tile is
+// widened into the first of its zoom rows, and that is copied to the
+// rest.
+void PtermFrame::ptermUpdateZoomed (const wxRect &ur, int zoom)
+{
+    int tx, ty, x, y, i;
+    
+    if (m_bitmap2 == NULL || m_zoom != zoom)
+    {
+        delete m_bitmap2;
+        m_bitmap2 = new wxBitmap (512 * zoom, 512 * zoom, 32);
+        m_zoom = zoom;
+        memset (m_zoomStale, 0xff, sizeof (m_zoomStale));
+    }
+    
+    PixelData pixmap (*m_bitmap);
+    PixelData pixmap2 (*m_bitmap2);
+    PixelData::Iterator p (pixmap);
+    PixelData::Iterator p2 (pixmap2);
+    const u32 *src;
+    u32 *dst, *first;
+    u32 pd;
+    
+    for (ty = ur.y >> 5; ty <= (ur.y + ur.height - 1) >> 5; ty++)
+    {
+        for (tx = ur.x >> 5; tx <= (ur.x + ur.width - 1) >> 5; tx++)
+        {
+            if ((m_zoomStale[ty] & (1U << tx)) == 0)
             {
-                break;
+                continue;
             }
-            switch (walkstack[sp])
+            m_zoomStale[ty] &= ~(1U << tx);
+
+            for (y = ty * 32; y < ty * 32 + 32; y++)
             {
-            case 1:
-                x++;
-                break;
-            case 2:
-                x--;
-                break;
-            case 3:
-                y--;
-                break;
-            case 4:
-                y++;
-                break;
+                p.MoveTo (pixmap, tx * 32, (y + m_scrollRows) & 0777);
+                p2.MoveTo (pixmap2, tx * 32 * zoom, y * zoom);
+                src = (const u32 *) (p.m_ptr);
+                first = dst = (u32 *) (p2.m_ptr);
+                if (zoom == 2)
+                {
+                    for (x = 0; x < 32; x++)
+                    {
+                        pd = *src++;
+                        dst[0] = pd;
+                        dst[1] = pd;
+                        dst += 2;
+                    }
+                }
+                else
+                {
+                    for (x = 0; x < 32; x++)
+                    {
+                        pd = *src++;
+                        for (i = 0; i < zoom; i++)
+                        {
+                            *dst++ = pd;
+                        }
+                    }
+                }
+                for (i = 1; i < zoom; i++)
+                {
+                    p2.MoveTo (pixmap2, tx * 32 * zoom, y * zoom + i);
+                    memcpy (p2.m_ptr, first, 32 * zoom * sizeof (u32));
+                }
             }
         }
     }
+}
+
+// Record that the screen area from x1/y1 to x2/y2 (PLATO coordinates,
+// inclusive, in either order) has changed.  Areas are kept as a short
+// list of rectangles in bitmap coordinates; an area that touches or
+// overlaps one already in the list is merged into it.  If the list is
+// full, the new area is merged into whichever entry grows the least.
+// The back buffer rows it covers are marked to be copied to the bitmap.
+void PtermFrame::ptermDamage (int x1, int y1, int x2, int y2)
+{
+    int t, i, best, area, bestarea;
+    u32 mask;
+    wxRect r, u;
     
-    trace ("paintwalker: %d pixels, %d max stack", pixels, maxsp);
+    if (x1 > x2)
+        t = x1, x1 = x2, x2 = t;
+    if (y1 > y2)
+        t = y1, y1 = y2, y2 = t;
+
+    // Drawing wraps around the screen edges, so anything that crosses
+    // an edge is treated as affecting that entire dimension.
+    if (x1 < 0 || x2 > 511)
+    {
+        x1 = 0;
+        x2 = 511;
+    }
+    if (y1 < 0 || y2 > 511)
+    {
+        y1 = 0;
+        y2 = 511;
+    }
+    r = wxRect (XMADJUST (x1), YMADJUST (y2), x2 - x1 + 1, y2 - y1 + 1);
+
+    // Mark the tiles of the scaled screen copies that this affects
+    mask = (2U << (XMADJUST (x2) >> 5)) - (1U << (XMADJUST (x1) >> 5));
+    for (i = YMADJUST (y2) >> 5; i <= YMADJUST (y1) >> 5; i++)
+    {
+        m_scaleStale[i] |= mask;
+        m_zoomStale[i] |= mask;
+    }
+    for (i = YMADJUST (y2); i <= YMADJUST (y1); i++)
+    {
+        m_backStale[(i + m_scrollRows) & 0777] |= mask;
+    }
+    m_backDirty = true;
+    
+    // Quick check for the common case of a series of points or
+    // characters inside an area we already have.
+    if (m_damageCount > 0 && m_damage[m_lastDamage].Contains (r))
+    {
+        return;
+    }
+    
+    u = r;
+    u.Inflate (1);
+    for (i = 0; i < m_damageCount; i++)
+    {
+        if (m_damage[i].Intersects (u))
+        {
+            m_damage[i].Union (r);
+            m_lastDamage = i;
+            return;
+        }
+    }
+    if (m_damageCount < MaxDamage)
+    {
+        m_lastDamage = m_damageCount;
+        m_damage[m_damageCount++] = r;
+        return;
+    }
+    
+    best = 0;
+    bestarea = 512 * 512 + 1;
+    for (i = 0; i < m_damageCount; i++)
+    {
+        u = m_damage[i];
+        u.Union (r);
+        area = u.width * u.height - m_damage[i].width * m_damage[i].height;
+        if (area < bestarea)
+        {
+            best = i;
+            bestarea = area;
+        }
+    }
+    m_damage[best].Union (r);
+    m_lastDamage = best;
+}
+
+void PtermFrame::ptermDamageAll (void)
+{
+    m_damage[0] = wxRect (0, 0, 512, 512);
+    m_damageCount = 1;
+    m_lastDamage = 0;
+    memset (m_scaleStale, 0xff, sizeof (m_scaleStale));
+    memset (m_zoomStale, 0xff, sizeof (m_zoomStale));
+    memset (m_backStale, 0xff, sizeof (m_backStale));
+    m_backDirty = true;
+}
+
+// Ask for the areas recorded by ptermDamage to be repainted.  This is
+// done right away if it has been at least a frame interval since the
+// last time, otherwise the timer is set to do it when the interval is
+// up.  Either way the screen is never more than one frame behind, and
+// PLATO data keeps being processed in the meantime; anything drawn
+// before the timer runs just adds to the damage list.  The decode
+// thread leaves this to the GUI thread, which does it at the end of
+// each run (see DecodeFinish).
+void PtermFrame::ptermRefresh (void)
+{
+    long elapsed;
+    
+    if (DecodeThread ())
+    {
+        return;
+    }
+    if (m_damageCount == 0 || m_presentTimer.IsRunning ())
+    {
+        return;
+    }
+    elapsed = m_presentWatch.Time () - m_lastPresent;
+    if (elapsed >= m_frameMs || elapsed < 0)
+    {
+        ptermPresent ();
+    }
+    else
+    {
+        m_presentTimer.StartOnce (m_frameMs - elapsed);
+    }
+}
+
+void PtermFrame::OnPresentTimer (wxTimerEvent &)
+{
+    ptermPresent ();
+}
+
+// Ask the canvas to repaint the areas recorded by ptermDamage, and
+// start a new damage list.
+void PtermFrame::ptermPresent (void)
+{
+    int i, x1, y1, x2, y2, w, h;
+    
+    m_lastPresent = m_presentWatch.Time ();
+    
+    for (i = 0; i < m_damageCount; i++)
+    {
+        const wxRect &r = m_damage[i];
+
+        // Convert to canvas coordinates.  Round outward, plus a pixel
+        // of slop since the scaled image is not an exact multiple of
+        // the bitmap when the scale is not an integer.
+        x1 = (int) floor ((m_xmargin + r.x - 1) * m_xscale);
+        y1 = (int) floor ((m_ymargin + r.y - 1) * m_yscale);
+        x2 = (int) ceil ((m_xmargin + r.x + r.width + 1) * m_xscale);
+        y2 = (int) ceil ((m_ymargin + r.y + r.height + 1) * m_yscale);
+        w = x2 - x1;
+        h = y2 - y1;
+        m_canvas->CalcScrolledPosition (x1, y1, &x1, &y1);
+        m_canvas->RefreshRect (wxRect (x1, y1, w, h), false);
+    }
+    m_damageCount = 0;
 }
 
 void PtermFrame::ptermSetName (wxString &winName)
@@ -3998,6 +5005,12 @@ void PtermFrame::ptermSetName (wxString &winName)
 
 void PtermFrame::ptermSetStatus (wxString &str)
 {
+    if (DecodeThread ())
+    {
+        m_guiText = str;
+        guiCall (GuiStatus);
+        return;
+    }
     if (m_statusBar != NULL)
     {
         m_statusBar->SetStatusText (str, STATUS_CONN);
@@ -4035,9 +5048,23 @@ void PtermFrame::drawFontChar (int x, int y, int c)
 {
     wxString chr;
 
+    // Fonts are drawn with a DC, which only the GUI thread may use.
+    if (DecodeThread ())
+    {
+        guiCall (GuiFontChar, x, y, c);
+        return;
+    }
     chr.Printf (wxT ("%c"), c);
 
-    m_memDC->SelectObject (*m_bitmap);
+    // The bitmap is put in order and selected once for a run of
+    // characters, not for each one.
+    if (!m_fontDC)
+    {
+        ptermUnscroll ();
+        m_memDC->SelectObject (*m_bitmap);
+        m_fontDC = true;
+        m_fontArea = wxRect ();
+    }
     switch (wemode)
     {
     case 0:         // inverse
@@ -4062,8 +5089,10 @@ void PtermFrame::drawFontChar (int x, int y, int c)
     
     m_memDC->GetTextExtent (chr, &m_fontwidth, &m_fontheight);
 
+    ptermDamage (x, y, x + m_fontwidth - 1, y + m_fontheight - 1);
     x = XMADJUST (x);
     y = YMADJUST (BOUND (y + m_fontheight - 1));
+    m_fontArea.Union (wxRect (x, y, m_fontwidth, m_fontheight));
 
     currentX += m_fontwidth;
     
@@ -4076,15 +5105,88 @@ void PtermFrame::drawFontChar (int x, int y, int c)
         m_memDC->SetLogicalFunction (wxCOPY);
     }
     m_memDC->DrawText (chr, x, y);
+}
 
-#ifdef __WXMSW__
-    // On Windows, the Alpha channel gets messed up by
-    // the DrawText operation, which makes for very
-    // strange looking displays.  So fix it.  It's a 
-    // bit crude, but it gets the job done.
-    fixAlpha ();
-#endif
-    m_memDC->SelectObject (wxNullBitmap);
+// Draw a printable character in ASCII text mode, and advance to the
+// next character position (unless a font does that).
+void PtermFrame::drawAsciiChar (u32 d, int deltax)
+{
+    int &cx = (vertical) ? currentY : currentX;
+    int i = currentCharset;
+    bool autobs;
+    
+    if (m_usefont && i == 0)
+    {
+        SaveChar (currentX, currentY, d, large);
+        drawFontChar (currentX, currentY, d);
+    }
+    else
+    {
+        if (i == 0)
+        {
+            d = asciiM0[d];
+            // The ROM vs. RAM choice is given by the current character
+            // set.  For the ROM characters, the even vs. odd (M0 vs. M1)
+            // choice is given by the top bit of the ASCII translation
+            // table.
+            i = (d & 0x80) >> 7;
+        }
+        else if (i == 1)
+        {
+            d = asciiM1[d];
+            i = (d & 0x80) >> 7;
+        }
+        else
+        {
+            // RAM characters are indexed by printable ASCII characters;
+            // the RAM character offset is simply the character code - 32.
+            // The set choice is simply what the host sent.
+            d = (d - 040) & 077;
+        }
+        if (d != 0xff)
+        {
+            d &= 0x7f;
+            autobs = SaveChar (currentX, currentY, rom01char[d + i * 64],
+                               large);
+            ptermDrawChar (currentX, currentY, i, d, autobs);
+            cx = (cx + deltax) & 0777;
+        }
+    }
+}
+
+// Process a run of printable characters in ASCII text mode.
+// procDataLoop hands such runs over here as a whole, since the protocol
+// state cannot change in the middle of one; that saves going through
+// the whole procPlatoWord dispatch for each character.
+void PtermFrame::procAsciiText (const int *words, int n)
+{
+    int deltax;
+    int k;
+    u32 d;
+
+    // Same as what procPlatoWord works out.
+    if (m_usefont && currentCharset <= 1)
+    {
+        deltax = 8;
+    }
+    else
+    {
+        deltax = (reverse) ? -8 : 8;
+        if (large)
+        {
+            deltax *= 2;
+        }
+    }
+    
+    m_ascBytes = 0;
+    for (k = 0; k < n; k++)
+    {
+        d = words[k];
+        seq++;
+        m_currentWord = d;
+        trace ("char %03o (%c)", d, d);
+        drawAsciiChar (d, deltax);
+    }
 }
 
 /*--------------------------------------------------------------------------
@@ -4104,7 +5206,6 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
     int i, n = 0;
     AscState    ascState;
     bool changed = false;
-    bool autobs;
     
     // used in load coordinate
     int &coord = (d & 01000) ? currentY : currentX;
@@ -4178,41 +5279,14 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                     }
                     else
                     {
-                        // On the bottom line... scroll both the
-                        // display and the selection image bitmaps.
-                        // And scroll the saved text map.  And cancel
-                        // any selected region because the image
-                        // scrolled out from under the region.  No,
-                        // we're not going to adjust the region
+                        // On the bottom line... scroll the display,
+                        // the selection image and the saved text map.
+                        // And cancel any selected region because the
+                        // image scrolled out from under the region.
+                        // No, we're not going to adjust the region
                         // positions...
-                        int row;
-                        PixelData pixmap (*m_bitmap);
-                        PixelData selmap (*m_selmap);
-
-                        PixelData::Iterator from (pixmap);
-                        PixelData::Iterator to (pixmap);
-                        PixelData::Iterator sfrom (selmap);
-                        PixelData::Iterator sto (selmap);
-
-                        // We move row at a time because apparently on
-                        // some OS (Windows) the rows are not
-                        // contiguous.
-                        for (row = 16; row < 512; row++)
-                        {
-                            from.MoveTo (pixmap, 0, row);
-                            to.MoveTo (pixmap, 0, row - 16);
-                            sfrom.MoveTo (selmap, 0, row);
-                            sto.MoveTo (selmap, 0, row - 16);
-
-                            memmove (to.m_ptr, from.m_ptr, 512 * 4);
-                            memmove (sto.m_ptr, sfrom.m_ptr, 512 * 4);
-                        }
-                        
-                        // Note that the textmap has y==0 for the bottom line
-                        memmove (&textmap[64], &textmap[0],
-                                 (sizeof (textmap) / 32) * 31);
-                        memset (&textmap[0], 0, sizeof (textmap) / 32);
-
+                        ptermScrollUp ();
+                        ptermDamageAll ();
                         ClearRegion ();
                     }
                     // Erase the line we just moved to.
@@ -4556,11 +5630,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                             if (m_beepEnable)
                             {
                                 trace ("beep");
-                                wxBell ();
-                                if (!IsActive ())
-                                {
-                                    RequestUserAttention (wxUSER_ATTENTION_INFO);
-                                }
+                                ptermBell (true);
                             }
                             break;
                         case 0x7d:
@@ -4736,7 +5806,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                     if (n != -1)
                     {
                         trace ("ssf %04x", n);
-                        m_canvas->ptermTouchPanel ((n & 0x20) != 0);
+                        ptermSetTouch ((n & 0x20) != 0);
                     }
                     switch (n)
                     {
@@ -4752,7 +5822,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                         break;
                     default:
                         trace ("ssf %04x", n);
-                        m_canvas->ptermTouchPanel ((n & 0x20) != 0);
+                        ptermSetTouch ((n & 0x20) != 0);
                         break;
                     }
                     break;
@@ -4821,48 +5891,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                         m_ascState = none;
                         m_ascBytes = 0;
                         changed = true;
-                        i = currentCharset;
-                        if (m_usefont && i == 0)
-                        {
-                            SaveChar (currentX, currentY, d, large);
-                            drawFontChar (currentX, currentY, d);
-                        }
-                        else
-                        {
-                            if (i == 0)
-                            {
-                                d = asciiM0[d];
-                                // The ROM vs. RAM choice is given by the
-                                // current character set.  
-                                // For the ROM characters, the even vs. odd
-                                // (M0 vs. M1) choice is given by the top bit
-                                // of the ASCII translation table.
-                                i = (d & 0x80) >> 7;
-                            }
-                            else if (i == 1)
-                            {
-                                d = asciiM1[d];
-                                i = (d & 0x80) >> 7;
-                            }
-                            else
-                            {
-                                // RAM characters are indexed by printable
-                                // ASCII characters; the RAM character offset
-                                // is simply the character code - 32.
-                                // The set choice is simply what the host sent.
-                                d = (d - 040) & 077;
-                            }
-                            if (d != 0xff)
-                            {
-                                d &= 0x7f;
-                                autobs = SaveChar (currentX, currentY,
-                                                   rom01char[d + i * 64],
-                                                   large);
-                                ptermDrawChar (currentX, currentY, 
-                                               i, d, autobs);
-                                cx = (cx + deltax) & 0777;
-                            }
-                        }
+                        drawAsciiChar (d, deltax);
                         break;
                     case 4:
                         if (AssembleCoord (d))
@@ -5072,11 +6101,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                     if (m_beepEnable)
                     {
                         trace ("beep");
-                        wxBell ();
-                        if (!IsActive ())
-                        {
-                            RequestUserAttention (wxUSER_ATTENTION_INFO);
-                        }
+                        ptermBell (true);
                     }
                     break;
                 case 0x7d:
@@ -5118,7 +6143,7 @@ bool PtermFrame::procPlatoWord (u32 d, bool ascii)
                 {
                 case 1: // Touch panel control ?
                     trace ("ssf touch %o", d);
-                    m_canvas->ptermTouchPanel ((d & 040) != 0);
+                    ptermSetTouch ((d & 040) != 0);
                     break;
                 default:
                     trace ("ssf %o", d);
@@ -5550,6 +6575,11 @@ void PtermFrame::ptermUpdateTitle ()
 {
     wxString l_str;
     
+    if (DecodeThread ())
+    {
+        guiCall (GuiTitle);
+        return;
+    }
     //make title string based on flags
     l_str = wxT ("");
     if (m_profile->m_showSignon && m_name != wxT ("") && m_group != wxT (""))
@@ -5681,6 +6711,11 @@ void PtermFrame::SetFontFlags (int n)
 **------------------------------------------------------------------------*/
 void PtermFrame::SetFontActive ()
 {
+    if (DecodeThread ())
+    {
+        guiCall (GuiFontActive);
+        return;
+    }
     m_usefont = (m_fontface.Cmp (wxT (""))!=0 && m_fontface.Cmp (wxT ("default"))!=0);
     if (m_usefont)
     {
@@ -5700,6 +6735,7 @@ void PtermFrame::SetFontActive ()
         
         // We need to select a bitmap into the memDC for GetTextExtent
         // to be accepted.
+        ptermUnscroll ();
         m_memDC->SelectObject (*m_bitmap);
         m_memDC->SetFont (*m_font);
         m_memDC->GetTextExtent (wxT (" "), &m_fontwidth, &m_fontheight);
@@ -5718,6 +6754,12 @@ void PtermFrame::SetFontActive ()
 **------------------------------------------------------------------------*/
 void PtermFrame::ptermSaveWindow (int d)
 {
+    if (DecodeThread ())
+    {
+        guiCall (GuiSaveWindow, d);
+        return;
+    }
+
     wxBitmap *bm = new wxBitmap (512, 512, 32);
     wxMemoryDC dc (*bm);
 
@@ -5728,6 +6770,7 @@ void PtermFrame::ptermSaveWindow (int d)
     // easily.
     trace ("CWS: process save; window %d", d);
     cwswindow[d].ok = true;
+    ptermUnscroll ();
     m_memDC->SelectObject (*m_bitmap);
     dc.Blit (0, 0, 512, 512, m_memDC, 0, 0);
     m_memDC->SelectObject (wxNullBitmap);
@@ -5747,6 +6790,11 @@ void PtermFrame::ptermRestoreWindow (int d)
 {
     int x, y, w, h;
 
+    if (DecodeThread ())
+    {
+        guiCall (GuiRestoreWindow, d);
+        return;
+    }
     x = XMADJUST (BOUND (cwswindow[d].data[0]));
     y = YMADJUST (BOUND (cwswindow[d].data[1]));
     w = BOUND (cwswindow[d].data[2] - cwswindow[d].data[0]);
@@ -5755,6 +6803,7 @@ void PtermFrame::ptermRestoreWindow (int d)
     {
         trace ("CWS: process restore; window %d, region %d %d %d %d",
                d, x, y, w, h);
+        ptermUnscroll ();
         m_memDC->SelectObject (*m_bitmap);
         // Blit would seem like a logical way to do this, but for some
         // reason it hits an Assert on Windows because some (but not all!)
@@ -5765,6 +6814,11 @@ void PtermFrame::ptermRestoreWindow (int d)
         m_memDC->SetClippingRegion (x, y, w, h);
         m_memDC->DrawBitmap (*cwswindow[d].bm, 0, 0, false);
         m_memDC->SelectObject (wxNullBitmap);
+        ptermReadBack (wxRect (x, y, w, h));
+        ptermDamage (BOUND (cwswindow[d].data[0]),
+                     BOUND (cwswindow[d].data[3]),
+                     BOUND (cwswindow[d].data[2]),
+                     BOUND (cwswindow[d].data[1]));
 
         cwswindow[d].ok = false;
         delete cwswindow[d].bm;
@@ -5786,6 +6840,29 @@ void PtermFrame::WriteTraceMessage (wxString msg)
     return;
 }
 
+/*--------------------------------------------------------------------------
+**  Purpose:        Step through a trace or capture being played back
+**
+**  Parameters:     Name        Description.
+**                  dir         > 0 to step forward, < 0 to step back
+**
+**  Returns:        nothing
+**
+**  Stepping back plays the session again from the start, so the screen
+**  and the words not yet processed are thrown away first.
+**
+**------------------------------------------------------------------------*/
+void PtermFrame::ptermStep (int dir)
+{
+    if (m_conn->Step (dir))
+    {
+        m_timer.Stop ();
+        m_nextword = C_NODATA;
+        m_wordIndex = m_wordCount = 0;
+        ptermFullErase ();
+    }
+}
+
 /*--------------------------------------------------------------------------
 **  Purpose:        Display visual indication of trace status
 **
@@ -5808,27 +6885,85 @@ void PtermFrame::ptermSetTrace (bool trace)
         tracex ("Trace off");
         traceF.Close ();
         tracePterm = trace;
+        if (m_conn != NULL)
+        {
+            m_conn->SetCapture (false);
+        }
     }
     else
     {
-        // Turning trace on
-        tracePterm = trace;
-        traceF.Open (ptermApp->traceFn);
-        if (m_mtutorBoot)
-        {
-            tracex("Trace on, locally booted");
-        }
-        else if (m_conn->Ascii ())
+        // Turning trace on
+        tracePterm = trace;
+        traceF.Open (ptermApp->traceFn);
+        if (m_mtutorBoot)
+        {
+            tracex("Trace on, locally booted");
+        }
+        else if (m_conn->Ascii ())
+        {
+            tracex ("Trace on, ASCII terminal");
+        }
+        else
+        {
+            tracex ("Trace on, Classic terminal");
+        }
+        if (m_conn != NULL)
+        {
+            m_conn->SetCapture (true);
+        }
+    }
+
+    ptermShowTrace ();
+}
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Start or stop profiling the z80
+**
+**  Parameters:     Name        Description.
+**                  on          true to start, false to stop
+**
+**  Returns:        nothing
+**
+**  Stopping writes the flat profile to ptermApp->profileFn and the
+**  collapsed stacks (for flame graphs) to ptermApp->foldedFn.  The z80
+**  is halted while the profile is set up or written, then carries on.
+**
+**------------------------------------------------------------------------*/
+void PtermFrame::ptermSetProfile (bool on)
+{
+    const bool run = m_microRun;
+    wxString msg;
+
+    if (run)
+    {
+        MicroHalt ();
+    }
+    if (on)
+    {
+        Z80ProfileStart ();
+        msg = _("Z80 profile on");
+    }
+    else if (Z80Profiling ())
+    {
+        if (Z80ProfileWrite (ptermApp->profileFn, ptermApp->foldedFn))
         {
-            tracex ("Trace on, ASCII terminal");
+            msg.Printf (_("Z80 profile written to %s, %s"),
+                        ptermApp->profileFn, ptermApp->foldedFn);
         }
         else
         {
-            tracex ("Trace on, Classic terminal");
+            msg = _("Error writing z80 profile");
         }
+        Z80ProfileStop ();
+    }
+    if (run)
+    {
+        MicroStart (m_z80Colors);
+    }
+    if (m_statusBar != NULL)
+    {
+        m_statusBar->SetStatusText (msg, STATUS_TIP);
     }
-
-    ptermShowTrace ();
 }
 
 /*
@@ -6062,6 +7197,8 @@ void PtermFrame::mode2 (u32 d)
             // load data
             trace ("character memdata %06o to char word %04o", d & 0xffff, chaddr);
             plato_m23[chaddr] = d & 0xffff;
+            // The cached expansions of this character are now stale
+            m_glyphValid[2 + (chaddr >> 9)][(chaddr >> 3) & 077] = 0;
             ++chaddr;
         }
     }
@@ -6140,8 +7277,7 @@ void PtermFrame::mode4 (u32 d)
 **------------------------------------------------------------------------*/
 void PtermFrame::mode5 (u32 d)
 {
-    if (m_MReturnz80.IsRunning())
-        m_MReturnz80.Stop();
+    Mz80Cancel ();
 
     trace ("mode5 %06o", d);
 
@@ -6166,7 +7302,7 @@ void PtermFrame::mode5 (u32 d)
     // Set the start PC for the requested mode
     state->pc = ReadRAMW(M5ORIGIN);
 
-    MicroEmulate;
+    MicroStart (host);
 }
 
 /*--------------------------------------------------------------------------
@@ -6185,8 +7321,7 @@ void PtermFrame::mode5 (u32 d)
 **------------------------------------------------------------------------*/
 void PtermFrame::mode6 (u32 d)
 {
-    if (m_MReturnz80.IsRunning())
-        m_MReturnz80.Stop();
+    Mz80Cancel ();
 
     trace ("mode6 %06o", d);
                         // Load C/D/E with data word
@@ -6204,7 +7339,7 @@ void PtermFrame::mode6 (u32 d)
 
     // Set the start PC for the requested mode
     state->pc = ReadRAMW(M6ORIGIN);
-    MicroEmulate;
+    MicroStart (host);
 }
 
 /*--------------------------------------------------------------------------
@@ -6249,7 +7384,7 @@ void PtermFrame::progmode (u32 d, int origin)
 
     // Set the start PC for the requested mode
     state->pc = ReadRAMW (origin);
-    MicroEmulate;
+    MicroStart (host);
 }
 
 /*--------------------------------------------------------------------------
@@ -6281,10 +7416,611 @@ void PtermFrame::ptermSendKey (u32 keys)
 }
 
 
-// give resident RESIDENTMSEC ms before resuming 8080 exec
-void PtermFrame::Mz80Waiter(int msec)
+// give resident RESIDENTMSEC ms before resuming 8080 exec
+void PtermFrame::Mz80Waiter(int msec)
+{
+    if (DecodeThread ())
+    {
+        guiCall (GuiZ80Wait, msec);
+        return;
+    }
+    Z80YieldStart ();
+    m_MReturnz80.StartOnce(msec);
+}
+
+// Cancel the wait started by Mz80Waiter, if any.
+void PtermFrame::Mz80Cancel(void)
+{
+    if (DecodeThread ())
+    {
+        guiCall (GuiZ80Cancel);
+        return;
+    }
+    if (m_MReturnz80.IsRunning())
+    {
+        m_MReturnz80.Stop();
+    }
+}
+
+// Start the ppt clocks, if they aren't going yet.
+void PtermFrame::ptermStartClocks (void)
+{
+    if (!m_Mclock.IsRunning())
+    {
+        m_Mclock.Start(17);
+    }
+    if (!m_Dclock.IsRunning())
+    {
+        m_Dclock.Start(1000);
+    }
+}
+
+// Start the z80 running on its thread, from the current state, unless
+// it is running already.  "colors" says whose colors (host or micro)
+// resident calls draw with during this run.
+void PtermFrame::MicroStart (u8 colors)
+{
+    if (m_microRun)
+    {
+        return;
+    }
+    if (!m_z80Started)
+    {
+        if (dtCreateThread (s_z80Thread, this, &m_z80Thread) != 0)
+        {
+            fprintf (stderr, "Failure creating z80 thread\n");
+            return;
+        }
+        m_z80Started = true;
+    }
+    m_z80Colors = colors;
+    m_microRun = true;
+
+    wxMutexLocker lock (m_z80Lock);
+    m_z80Busy = true;
+    m_z80Go = true;
+    m_z80Wake.Signal ();
+}
+
+// Do the resident calls the z80 thread asks for.  This keeps at it for
+// about half a frame interval, so a burst of drawing calls is done in
+// one go, or until the z80 stops if "wait" is true.  Returns true if
+// the z80 is still running.
+bool PtermFrame::MicroService (bool wait)
+{
+    const long start = m_presentWatch.Time ();
+    const long budget = (m_frameMs > 2) ? m_frameMs / 2 : 1;
+    bool busy, drawn = false;
+    long left;
+    int result;
+    
+    if (!m_microRun)
+    {
+        return false;
+    }
+
+    m_z80Lock.Lock ();
+    m_z80Waiting = true;
+    for (;;)
+    {
+        if (m_z80Call)
+        {
+            // The z80 thread waits until we answer, so the emulator
+            // state is ours until then.
+            m_z80Lock.Unlock ();
+            UseColors (m_z80Colors);
+            result = residentCall ();
+            drawn = true;
+            m_z80Lock.Lock ();
+            m_z80Result = result;
+            m_z80Call = false;
+            m_z80Wake.Signal ();
+            continue;
+        }
+        if (!m_z80Busy)
+        {
+            break;
+        }
+        if (wait)
+        {
+            m_z80Done.Wait ();
+            continue;
+        }
+        if (m_decodeHold > 0 && DecodeThread ())
+        {
+            // The GUI thread wants the terminal back
+            break;
+        }
+        left = budget - (m_presentWatch.Time () - start);
+        if (left <= 0)
+        {
+            break;
+        }
+        m_z80Done.WaitTimeout (left);
+    }
+    m_z80Waiting = false;
+    busy = m_z80Busy;
+    m_z80Lock.Unlock ();
+
+    if (drawn)
+    {
+        ptermReleaseRaster ();
+    }
+    if (!busy)
+    {
+        m_microRun = false;
+        if (in_r_exec)
+        {
+            // Stopped at r.exec; give the resident some time before
+            // going on.
+            Mz80Waiter (RESIDENTMSEC);
+        }
+    }
+    return busy;
+}
+
+// Stop the z80 if it is running, and wait for it.
+void PtermFrame::MicroHalt (void)
+{
+    if (!m_microRun)
+    {
+        return;
+    }
+    m_z80Lock.Lock ();
+    m_giveupz80 = true;
+    m_z80Wake.Signal ();
+    m_z80Lock.Unlock ();
+    MicroService (true);
+    m_giveupz80 = false;
+    m_MReturnz80.Stop ();
+}
+
+// Stop the z80 thread, for good.
+void PtermFrame::MicroStop (void)
+{
+    if (!m_z80Started)
+    {
+        return;
+    }
+    m_z80Lock.Lock ();
+    m_z80Quit = true;
+    m_giveupz80 = true;
+    m_z80Wake.Signal ();
+    m_z80Lock.Unlock ();
+    pthread_join (m_z80Thread, NULL);
+    m_z80Started = false;
+    m_microRun = false;
+}
+
+// Make the current colors those of "target" (host or micro), saving
+// the ones in use.  Colors are only switched when the other side draws
+// next, not around every z80 run.
+void PtermFrame::UseColors (u8 target)
+{
+    if (m_colorsFor == target)
+    {
+        return;
+    }
+    SaveRestoreColors (save, m_colorsFor);
+    SaveRestoreColors (restore, target);
+    m_colorsFor = target;
+}
+
+// Queue a key for mtutor/ppt.  If it isn't keeping up, further keys
+// are dropped.
+void PtermFrame::mtKeyPut (int key)
+{
+    wxMutexLocker lock (m_z80Lock);
+    int next = (m_mtKeyIn + 1) % MtKeyQueue;
+
+    if (next != m_mtKeyOut)
+    {
+        m_mtKeys[m_mtKeyIn] = key;
+        m_mtKeyIn = next;
+    }
+}
+
+// Take the next key for mtutor/ppt, or -1 if there is none.
+int PtermFrame::mtKeyGet (void)
+{
+    wxMutexLocker lock (m_z80Lock);
+    int key = -1;
+
+    if (m_mtKeyOut != m_mtKeyIn)
+    {
+        key = m_mtKeys[m_mtKeyOut];
+        m_mtKeyOut = (m_mtKeyOut + 1) % MtKeyQueue;
+    }
+    return key;
+}
+
+void PtermFrame::mtKeyClear (void)
+{
+    wxMutexLocker lock (m_z80Lock);
+
+    m_mtKeyIn = m_mtKeyOut = 0;
+}
+
+dtThreadFun (PtermFrame::s_z80Thread, arg)
+{
+    PtermFrame *self = (PtermFrame *) arg;
+
+    self->z80Thread ();
+    ThreadReturn;
+}
+
+// The z80 thread.  It runs the z80 whenever MicroStart asks for it,
+// until it stops: at r.exec, at the end of a mode 5/6/7 handler, or
+// when the cycle limit is reached.
+void PtermFrame::z80Thread (void)
+{
+    m_z80Lock.Lock ();
+    for (;;)
+    {
+        while (!m_z80Go && !m_z80Quit)
+        {
+            m_z80Wake.Wait ();
+        }
+        if (m_z80Quit)
+        {
+            break;
+        }
+        m_z80Go = false;
+        m_z80Lock.Unlock ();
+        MicroEmulate;
+        m_z80Lock.Lock ();
+        m_z80Busy = false;
+        m_z80Done.Signal ();
+        if (!m_z80Waiting)
+        {
+            wxWakeUpIdle ();
+        }
+    }
+    m_z80Lock.Unlock ();
+}
+
+// Pass the resident call at the current PC to the thread that has the
+// terminal (see residentCall), and wait for it to be done.  Called on
+// the z80 thread.
+int PtermFrame::z80Call (void)
+{
+    wxMutexLocker lock (m_z80Lock);
+
+    m_z80Call = true;
+    m_z80Done.Signal ();
+    if (!m_z80Waiting)
+    {
+        wxWakeUpIdle ();
+    }
+    while (m_z80Call && !m_z80Quit)
+    {
+        m_z80Wake.Wait ();
+    }
+    return (m_z80Quit) ? 2 : m_z80Result;
+}
+
+// Wait on the z80 thread, for the resident wait calls.  The wait ends
+// early if the z80 is being stopped.
+void PtermFrame::z80Sleep (int ms)
+{
+    wxMutexLocker lock (m_z80Lock);
+
+    if (!m_z80Quit && !m_giveupz80)
+    {
+        m_z80Wake.WaitTimeout (ms);
+    }
+}
+
+// Handle an event for the window.  The decode thread is stopped first,
+// so the handler has the terminal to itself; idle events (which start
+// it) and UI updates (which only look) are let through as they are.
+bool PtermFrame::ProcessEvent (wxEvent &event)
+{
+    const wxEventType type = event.GetEventType ();
+    bool done;
+    
+    if (type == wxEVT_IDLE || type == wxEVT_UPDATE_UI)
+    {
+        return wxFrame::ProcessEvent (event);
+    }
+    DecodeHold ();
+    done = wxFrame::ProcessEvent (event);
+    DecodeRelease ();
+    return done;
+}
+
+// Take the terminal back from the decode thread, for an event handler
+// or anything else on the GUI thread that uses the terminal state.  The
+// current run of the decode thread is cut short, and none is started
+// until the matching DecodeRelease.  Holds nest.
+void PtermFrame::DecodeHold (void)
+{
+    m_decodeHold++;
+    if (!m_decodeRun || m_guiServing)
+    {
+        // Not running, or waiting for us (in guiCall) until we return
+        return;
+    }
+
+    // Wake the decode thread if it is waiting for the z80
+    m_z80Lock.Lock ();
+    m_z80Done.Signal ();
+    m_z80Lock.Unlock ();
+    DecodeService (true);
+}
+
+// Done with the terminal; see DecodeHold.  If the last run was cut
+// short, start the next one.
+void PtermFrame::DecodeRelease (void)
+{
+    if (--m_decodeHold == 0 && m_decodeYield)
+    {
+        wxWakeUpIdle ();
+    }
+}
+
+// Start a run of the decode thread, unless one is in progress.
+void PtermFrame::DecodeStart (void)
+{
+    if (m_decodeRun)
+    {
+        return;
+    }
+    if (!m_decodeStarted)
+    {
+        if (dtCreateThread (s_decodeThread, this, &m_decodeThread) != 0)
+        {
+            // Do without; decode right here, as the thread would.
+            fprintf (stderr, "Failure creating decode thread\n");
+            procDataLoop ();
+            DecodeFinish ();
+            if (m_decodeYield)
+            {
+                wxWakeUpIdle ();
+            }
+            return;
+        }
+        m_decodeStarted = true;
+    }
+    m_decodeRun = true;
+
+    wxMutexLocker lock (m_decodeLock);
+    m_decodeBusy = true;
+    m_decodeGo = true;
+    m_decodeWake.Signal ();
+}
+
+// Do the GUI work the decode thread asks for.  This keeps at it for
+// about half a frame interval if it has anything to do, or until the
+// run is over if "wait" is true.  When the run is over, its results are
+// taken care of (see DecodeFinish).  Returns true if the run is still
+// in progress.
+bool PtermFrame::DecodeService (bool wait)
+{
+    const long start = m_presentWatch.Time ();
+    const long budget = (m_frameMs > 2) ? m_frameMs / 2 : 1;
+    bool busy, served = false;
+    long left;
+    int req;
+    
+    if (!m_decodeRun)
+    {
+        return false;
+    }
+
+    m_decodeLock.Lock ();
+    m_decodeWaiting = true;
+    for (;;)
+    {
+        req = m_guiReq;
+        if (req != GuiNone)
+        {
+            // The decode thread waits until we're done, so the
+            // terminal is ours until then.
+            m_decodeLock.Unlock ();
+            m_guiServing = true;
+            guiService (req);
+            m_guiServing = false;
+            served = true;
+            m_decodeLock.Lock ();
+            m_guiReq = GuiNone;
+            m_decodeWake.Signal ();
+            continue;
+        }
+        if (!m_decodeBusy)
+        {
+            break;
+        }
+        if (wait)
+        {
+            m_decodeDone.Wait ();
+            continue;
+        }
+        left = budget - (m_presentWatch.Time () - start);
+        if (!served || left <= 0)
+        {
+            break;
+        }
+        m_decodeDone.WaitTimeout (left);
+    }
+    m_decodeWaiting = false;
+    busy = m_decodeBusy;
+    m_decodeLock.Unlock ();
+
+    if (!busy)
+    {
+        m_decodeRun = false;
+        DecodeFinish ();
+    }
+    return busy;
+}
+
+// Finish up after a run of the decode thread: show what it drew, and
+// do what it left for the GUI thread.
+void PtermFrame::DecodeFinish (void)
+{
+    int word;
+    
+    ptermRefresh ();
+    if (m_delayMs != 0)
+    {
+        m_timer.Start (m_delayMs);
+        m_delayMs = 0;
+    }
+    if (m_MReturnz80.IsRunning())
+    {
+        m_MReturnz80.Stop();
+        MicroStart (micro);
+    }
+    if (m_decodeEnd != C_NODATA)
+    {
+        // This runs a dialog, whose event loop must not start another
+        // run.
+        word = m_decodeEnd;
+        m_decodeEnd = C_NODATA;
+        m_decodeHold++;
+        ptermConnFailed (word);
+        DecodeRelease ();
+    }
+}
+
+// Stop the decode thread, for good.  What it was doing is abandoned.
+void PtermFrame::DecodeStop (void)
+{
+    if (!m_decodeStarted)
+    {
+        return;
+    }
+    m_decodeHold++;
+    m_z80Lock.Lock ();
+    m_z80Done.Signal ();
+    m_z80Lock.Unlock ();
+    m_decodeLock.Lock ();
+    m_decodeQuit = true;
+    m_decodeWake.Signal ();
+    m_decodeLock.Unlock ();
+    pthread_join (m_decodeThread, NULL);
+    m_decodeStarted = false;
+    m_decodeRun = false;
+}
+
+dtThreadFun (PtermFrame::s_decodeThread, arg)
+{
+    PtermFrame *self = (PtermFrame *) arg;
+
+    self->decodeThread ();
+    ThreadReturn;
+}
+
+// The decode thread.  It does a run of procDataLoop whenever
+// DecodeStart asks for it.
+void PtermFrame::decodeThread (void)
+{
+    bool work;
+    
+    m_decodeLock.Lock ();
+    m_decodeId = wxThread::GetCurrentId ();
+    for (;;)
+    {
+        while (!m_decodeGo && !m_decodeQuit)
+        {
+            m_decodeWake.Wait ();
+        }
+        if (m_decodeQuit)
+        {
+            break;
+        }
+        m_decodeGo = false;
+        m_decodeLock.Unlock ();
+        work = procDataLoop ();
+        m_decodeLock.Lock ();
+        m_decodeBusy = false;
+        m_decodeDone.Signal ();
+
+        // If there was nothing to do, the GUI thread finds out when it
+        // next goes idle, which is soon enough.  Waking it up now would
+        // just start another run with nothing to do.
+        if (work && !m_decodeWaiting)
+        {
+            wxWakeUpIdle ();
+        }
+    }
+    m_decodeLock.Unlock ();
+}
+
+// Pass GUI work to the GUI thread, and wait for it to be done.  Called
+// on the decode thread.  If the thread is being stopped, the work is
+// not done.
+void PtermFrame::guiCall (int req, int arg0, int arg1, int arg2)
+{
+    wxMutexLocker lock (m_decodeLock);
+
+    m_guiArg[0] = arg0;
+    m_guiArg[1] = arg1;
+    m_guiArg[2] = arg2;
+    m_guiReq = req;
+    m_decodeDone.Signal ();
+    if (!m_decodeWaiting)
+    {
+        wxWakeUpIdle ();
+    }
+    while (m_guiReq != GuiNone && !m_decodeQuit)
+    {
+        m_decodeWake.Wait ();
+    }
+}
+
+// Do GUI work for the decode thread, see guiCall.
+void PtermFrame::guiService (int req)
 {
-    m_MReturnz80.StartOnce(msec);
+    switch (req)
+    {
+    case GuiRelease:
+        ptermReleaseRaster ();
+        break;
+    case GuiFontChar:
+        drawFontChar (m_guiArg[0], m_guiArg[1], m_guiArg[2]);
+        break;
+    case GuiFontActive:
+        SetFontActive ();
+        break;
+    case GuiSaveWindow:
+        ptermSaveWindow (m_guiArg[0]);
+        break;
+    case GuiRestoreWindow:
+        ptermRestoreWindow (m_guiArg[0]);
+        break;
+    case GuiClearRegion:
+        ClearRegion ();
+        break;
+    case GuiTitle:
+        ptermUpdateTitle ();
+        break;
+    case GuiStatus:
+        ptermSetStatus (m_guiText);
+        break;
+    case GuiConnected:
+        ptermSetConnected ();
+        break;
+    case GuiShowTrace:
+        ptermShowTrace ();
+        break;
+    case GuiBell:
+        ptermBell (m_guiArg[0] != 0);
+        break;
+    case GuiTouch:
+        ptermSetTouch (m_guiArg[0] != 0);
+        break;
+    case GuiClocks:
+        ptermStartClocks ();
+        break;
+    case GuiZ80Wait:
+        Mz80Waiter (m_guiArg[0]);
+        break;
+    case GuiZ80Cancel:
+        Mz80Cancel ();
+        break;
+    }
 }
 
 /*--------------------------------------------------------------------------
@@ -6302,13 +8038,16 @@ void PtermFrame::ptermSendKey1 (int key)
     int len;
     bool isStop1 = (key == 0x3a);
 
-    if (!m_Mclock.IsRunning())
+    // Timers belong to the GUI thread.  The connection thread also
+    // sends (flow control) keys through here, but those don't matter
+    // to the clocks.
+    if (DecodeThread ())
     {
-        m_Mclock.Start(17);
+        guiCall (GuiClocks);
     }
-    if (!m_Dclock.IsRunning())
+    else if (wxThread::IsMain ())
     {
-        m_Dclock.Start(1000);
+        ptermStartClocks ();
     }
     if (IgnoreKeys())
     {
@@ -6410,7 +8149,7 @@ void PtermFrame::ptermSendKey1 (int key)
                     return;     // de-bounce stop1
                 }
                 m_lastKey = key;
-                mt_key = key;
+                mtKeyPut (key);
                 if (isStop1)
                 {
                     len = 1;
@@ -6451,10 +8190,10 @@ void PtermFrame::ptermSendKey1 (int key)
             if (!m_mtutorBoot)
                 m_conn->SendData(data, len);
             else if (key > 0x0ff)
-                mt_key = key;  // touch/ext?
+                mtKeyPut (key);  // touch/ext?
         }
         else if ((key2mtutor) && key > 0x0ff)
-            mt_key = key;  // touch/ext?
+            mtKeyPut (key);  // touch/ext?
     }
     else
     {
@@ -6470,7 +8209,7 @@ void PtermFrame::ptermSendKey1 (int key)
             {
                 tracex("key to mtutor 0x%02x", key);
             }
-            mt_key = key;
+            mtKeyPut (key);
         }
     }
 }
@@ -6568,12 +8307,23 @@ void PtermFrame::ptermSetConnected ()
     // This routine is called when connection is initially made, or
     // when the statusbar is rebuilt.  See ProcessPlatoMetaData for
     // the dynamic code.
-    wxString l_str;
+    wxString l_str, addr;
 
+    if (DecodeThread ())
+    {
+        guiCall (GuiConnected);
+        return;
+    }
     SetCursor (wxNullCursor);
 
     if (m_conn->ConnType () == HOST)
-        l_str.Printf ("%s ", m_profile->m_host);
+    {
+        addr = m_conn->HostAddr ();
+        if (addr.IsEmpty () || addr == m_profile->m_host)
+            l_str.Printf ("%s ", m_profile->m_host);
+        else
+            l_str.Printf ("%s (%s) ", m_profile->m_host, addr);
+    }
     if (HasConnection ())
     {
         if (m_conn->Ascii ())
@@ -6590,11 +8340,16 @@ void PtermFrame::ptermSetConnected ()
 
 void PtermFrame::ptermShowTrace ()
 {
+    if (DecodeThread ())
+    {
+        guiCall (GuiShowTrace);
+        return;
+    }
     if (m_statusBar != NULL)
     {
         if (tracePterm)
         {
-            m_statusBar->SetStatusText (m_MTFiles[0].rwflag 
+            m_statusBar->SetStatusText (wxString (m_MTFiles[0].rwflag)
                 + m_MTFiles[1].rwflag
                 + _(" Trace | ")
                 + m_profile->m_profileName, STATUS_TRC);
@@ -6602,21 +8357,21 @@ void PtermFrame::ptermShowTrace ()
         else if (m_conn != NULL && m_conn->GswActive ())
         {
             // Display a musical note.
-            m_statusBar->SetStatusText (m_MTFiles[0].rwflag 
+            m_statusBar->SetStatusText (wxString (m_MTFiles[0].rwflag)
                 + m_MTFiles[1].rwflag
                 + wxT ("\u266C | ")
                 + m_profile->m_profileName, STATUS_TRC);
         }
         else if (m_platoKb)
         {
-            m_statusBar->SetStatusText (m_MTFiles[0].rwflag 
+            m_statusBar->SetStatusText (wxString (m_MTFiles[0].rwflag)
                 + m_MTFiles[1].rwflag
                 + _(" PLATO keyboard | ")
                 + m_profile->m_profileName, STATUS_TRC);
         }
         else
         {
-            m_statusBar->SetStatusText (m_MTFiles[0].rwflag 
+            m_statusBar->SetStatusText (wxString (m_MTFiles[0].rwflag)
                 + m_MTFiles[1].rwflag
                 + wxT (" ") +
                 m_profile->m_profileName, STATUS_TRC);
@@ -6624,6 +8379,33 @@ void PtermFrame::ptermShowTrace ()
     }
 }
 
+// Sound the bell.  If "attention" is set, also flag the window if it
+// isn't the active one.
+void PtermFrame::ptermBell (bool attention)
+{
+    if (DecodeThread ())
+    {
+        guiCall (GuiBell, attention);
+        return;
+    }
+    wxBell ();
+    if (attention && !IsActive ())
+    {
+        RequestUserAttention (wxUSER_ATTENTION_INFO);
+    }
+}
+
+// Turn the touch panel on or off.
+void PtermFrame::ptermSetTouch (bool enable)
+{
+    if (DecodeThread ())
+    {
+        guiCall (GuiTouch, enable);
+        return;
+    }
+    m_canvas->ptermTouchPanel (enable);
+}
+
 // Save a character into the character map used for text copy.
 // Returns True if this character is an auto-backspaced accent.
 bool PtermFrame::SaveChar (int x, int y, wxChar c, bool large_p)
@@ -6716,7 +8498,7 @@ bool PtermFrame::SaveChar (int x, int y, wxChar c, bool large_p)
 
     // It if seemed autobackspaced but there is no "primary" character
     // yet, then it isn't actually.
-    if (textmap[y * 64 + x][0] == '\0')
+    if (textcell (x, y)[0] == '\0')
     {
         autobs = false;
     }
@@ -6728,25 +8510,25 @@ bool PtermFrame::SaveChar (int x, int y, wxChar c, bool large_p)
         // if the previous one is grave and this is acute, replace the
         // existing accent by hacek, because that's how hacek is sent 
         // on classic terminals.
-        if (textmap[y * 64 + x][1] == '\0')
+        if (textcell (x, y)[1] == '\0')
         {
-            textmap[y * 64 + x][1] = c;
+            textcell (x, y)[1] = c;
         }
-        else if (c == L'\u0301' && textmap[y * 64 + x][1] == L'\u0300')
+        else if (c == L'\u0301' && textcell (x, y)[1] == L'\u0300')
         {
-            textmap[y * 64 + x][1] = L'\u030c';
+            textcell (x, y)[1] = L'\u030c';
         }
         else
         {
-            textmap[y * 64 + x][2] = c;
+            textcell (x, y)[2] = c;
         }
     }
     else
     {
-        textmap[y * 64 + x][0] = c;
-        textmap[y * 64 + x][1] = '\0';
-        textmap[y * 64 + x][2] = '\0';
-        textmap[y * 64 + x][3] = '\0';
+        textcell (x, y)[0] = c;
+        textcell (x, y)[1] = '\0';
+        textcell (x, y)[2] = '\0';
+        textcell (x, y)[3] = '\0';
 
         // Also save the current x/y as previous
         prevx = savex;
@@ -6756,20 +8538,20 @@ bool PtermFrame::SaveChar (int x, int y, wxChar c, bool large_p)
     if (large_p)
     {
         x = (x + 1) & 077;
-        textmap[y * 64 + x][0] = '\0';
-        textmap[y * 64 + x][1] = '\0';
-        textmap[y * 64 + x][2] = '\0';
-        textmap[y * 64 + x][3] = '\0';
+        textcell (x, y)[0] = '\0';
+        textcell (x, y)[1] = '\0';
+        textcell (x, y)[2] = '\0';
+        textcell (x, y)[3] = '\0';
         y = (y + 1) & 037;
-        textmap[y * 64 + x][0] = '\0';
-        textmap[y * 64 + x][1] = '\0';
-        textmap[y * 64 + x][2] = '\0';
-        textmap[y * 64 + x][3] = '\0';
+        textcell (x, y)[0] = '\0';
+        textcell (x, y)[1] = '\0';
+        textcell (x, y)[2] = '\0';
+        textcell (x, y)[3] = '\0';
         x = (x - 1) & 077;
-        textmap[y * 64 + x][0] = '\0';
-        textmap[y * 64 + x][1] = '\0';
-        textmap[y * 64 + x][2] = '\0';
-        textmap[y * 64 + x][3] = '\0';
+        textcell (x, y)[0] = '\0';
+        textcell (x, y)[1] = '\0';
+        textcell (x, y)[2] = '\0';
+        textcell (x, y)[3] = '\0';
     }
 
     return autobs;
@@ -6803,7 +8585,7 @@ wxString PtermFrame::GetRegionText (bool url) const
         
         for (j = m_regionX; j < m_regionX + m_regionWidth; j++)
         {
-            c = textmap[i * 64 + j];
+            c = textcell (j, i);
             // Each textmap entry can be up to 3 characters, for example
             // for accent marks (stored as combining accent), or for
             // various overstruck special characters like universal delimiter.
@@ -6882,6 +8664,14 @@ void PtermFrame::ClearRegion (void)
     // Cancel any region selection
     if (m_regionHeight != 0 || m_regionWidth != 0)
     {
+        if (DecodeThread ())
+        {
+            guiCall (GuiClearRegion);
+            return;
+        }
+        ptermDamage (m_regionX * 8, m_regionY * 16,
+                     (m_regionX + m_regionWidth) * 8 - 1,
+                     (m_regionY + m_regionHeight) * 16 - 1);
         m_regionHeight = 0;
         m_regionWidth = 0;
         menuBar->Enable (Pterm_Copy, false);
@@ -6896,7 +8686,7 @@ void PtermFrame::ClearRegion (void)
         {
             m_statusBar->SetStatusText (wxT (""), STATUS_TIP);
         }
-        m_canvas->Refresh (false);
+        ptermRefresh ();
     }
 }
 
@@ -6936,6 +8726,13 @@ void PtermFrame::UpdateRegion (int x, int y, int mouseX, int mouseY)
         x2 = BOUND (x2);
         y1 = BOUND (y1);
         y2 = BOUND (y2);
+        // Repaint both the old and the new selection area
+        if (m_regionWidth != 0 || m_regionHeight != 0)
+        {
+            ptermDamage (m_regionX * 8, m_regionY * 16,
+                         (m_regionX + m_regionWidth) * 8 - 1,
+                         (m_regionY + m_regionHeight) * 16 - 1);
+        }
         m_regionX = x1 / 8;
         m_regionY = y1 / 16;
         m_regionWidth = (x2 + 1 - (m_regionX * 8)) / 8;
@@ -6954,7 +8751,10 @@ void PtermFrame::UpdateRegion (int x, int y, int mouseX, int mouseY)
                            m_regionWidth > 0 && !m_SearchURL.IsEmpty ()); 
         debug ("region %d %d size %d %d", m_regionX, m_regionY,
                m_regionWidth, m_regionHeight);
-        m_canvas->Refresh (false);
+        ptermDamage (m_regionX * 8, m_regionY * 16,
+                     (m_regionX + m_regionWidth) * 8 - 1,
+                     (m_regionY + m_regionHeight) * 16 - 1);
+        ptermRefresh ();
         return;
     }
     if (m_regionWidth == 0 && m_regionHeight == 0)
@@ -6981,6 +8781,12 @@ void PtermFrame::UpdateRegion (int x, int y, int mouseX, int mouseY)
     }
 }
 
+// Names of the resident entry points for the z80 profile.
+const char *PtermFrame::Z80CallName (unsigned short pc)
+{
+    return (pc < WORKRAM) ? resCallName (pc) : NULL;
+}
+
 const char* PtermFrame::resCallName(u16 pc)
 {
     switch (pc)
@@ -7092,7 +8898,10 @@ const char* PtermFrame::resCallName(u16 pc)
     }
 }
 
-// This emulates the "ROM resident".  Return values:
+// This emulates the "ROM resident".  It is called on the z80 thread.
+// Resident calls that only use emulator state are done here; the rest
+// are passed to the thread that has the terminal, see residentCall.
+// Return values:
 // 0: PC is not special (not in resident), proceed normally.
 // 1: PC is ROM function entry point, it has been emulated,
 //    do a RET now.
@@ -7101,30 +8910,149 @@ const char* PtermFrame::resCallName(u16 pc)
 
 int PtermFrame::check_pcZ80(void)
 {
-    int x, y, cp, c, x2, y2;
+    int key;
     
-    if (state->pc < WORKRAM && m_MtTrace)
+    if (state->pc >= WORKRAM)
+    {
+        // Plain old RAM PC -- keep executing
+        return 0;
+    }
+
+    if (m_MtTrace)
     {
         tracex("Resident call %04x %s DE=%04x HL=%04x",
             state->pc, resCallName(state->pc), state->registers.word[Z80_DE], state->registers.word[Z80_HL]);
     }
     
+    switch (state->pc)
+    {
+    case R_INPX:
+        state->registers.word[Z80_HL] = currentX;
+        return 1;
+
+    case R_INPY:
+        state->registers.word[Z80_HL] = currentY;
+        return 1;
+        
+    case R_OUTX:
+        currentX = state->registers.word[Z80_HL] & 0x01ff;
+        return 1;
+        
+    case R_OUTY:
+        currentY = state->registers.word[Z80_HL] & 0x01ff;
+        return 1;
+        
+    case R_STEPX:
+        currentX = (currentX + ((RAM[M_DIR] & 2) ? -1 : 1)) & 0777;
+        return 1;
+        
+    case R_STEPY:
+        currentY = (currentY + ((RAM[M_DIR] & 1) ? -1 : 1)) & 0777;
+        return 1;
+        
+    case R_DIR:
+        RAM[M_DIR] = state->registers.byte[Z80_L] & 3;
+        return 1;
+        
+    case R_INPUT:
+        key = mtKeyGet ();
+        if (tracePterm)
+        {
+            tracex("R_INPUT: %04x", key & 0xffff);
+        }
+        state->registers.word[Z80_HL] = key & 0xffff;
+
+        return 1;
+        
+    case R_CCR:
+        RAM[M_CCR] = state->registers.byte[Z80_L];
+        return 1;
+        
+    case R_EXTOUT:
+        // r.extout
+
+        //printf("r.extout data=%04x\n", HL.pair);
+
+        return 1;
+        
+    case R_EXEC:
+        // r.exec -- stop here to let the resident process host data;
+        // MicroService starts the Mz80Waiter timer to resume.
+        trace ("R.EXEC");
+        m_giveupz80 = true;
+        return 1;
+        
+    case R_GJOB:
+        // r.gjob
+        return 1;
+        
+    case R_XJOB:
+        // r.xjob
+        return 1;
+
+    case R_RETURN: //obsolete
+        return 1;
+
+    case R_WAIT16:  // 0x0097
+        // for use with mtutor timed -pause-
+        z80Sleep (15);
+
+        return 1;
+
+    case R_WAIT16 + 1:
+        // standard interface with HL
+        z80Sleep (state->registers.word[Z80_HL]);
+
+        return 1;
+
+    case R_WAIT16 + 2:
+        // interface with DE for use with mtutor -ccode-
+        z80Sleep (ReadRAMW(state->registers.word[Z80_DE]));
+
+        return 1;
+
+    case R_DUMMY2:
+
+        return 1;
+
+    case R_DUMMY3:
+
+        return 1;
+
+    default:
+        return z80Call ();
+    }
+}
+
+// The part of the "ROM resident" that needs the display or the
+// connection.  This is called for the z80 thread, while it waits, on
+// whichever thread has the terminal: the decode thread during a run of
+// it, otherwise the GUI thread.  Return values are as for check_pcZ80.
+
+int PtermFrame::residentCall(void)
+{
+    int x, y, cp, c, x2, y2;
+    
     switch (state->pc)
     {
     case R_MAIN:
         // "r.main" -- fake return address value used as the return
         // address for invocations of the mode 5/6/7 handler code
 
-        m_canvas->Refresh(false);
+        ptermRefresh ();
 
         return 2;
 
     case R_INIT:
         // r.init -- TBD
 
-        m_canvas->Refresh(false);
+        ptermRefresh ();
+
+        {
+            wxString msg (_(" Program ended"));
 
-        m_statusBar->SetStatusText (_(" Program ended"), STATUS_CONN);
+            ptermSetStatus (msg);
+        }
 
         return 2;
         
@@ -7136,7 +9064,7 @@ int PtermFrame::check_pcZ80(void)
         ptermDrawPoint (x, y);
         currentX = x;
         currentY = y;
-        m_canvas->Refresh (false);
+        ptermRefresh ();
         return 1;
         
     case R_LINE:
@@ -7145,7 +9073,7 @@ int PtermFrame::check_pcZ80(void)
         ptermDrawLine (currentX, currentY, x, y);
         currentX = x;
         currentY = y;
-        m_canvas->Refresh (false); 
+        ptermRefresh ();
         return 1;
 
     case R_CHARS:
@@ -7178,7 +9106,7 @@ int PtermFrame::check_pcZ80(void)
 
             c = RAM[cp++];
         }
-        m_canvas->Refresh (false);
+        ptermRefresh ();
         return 1;
         
     case R_BLOCK:
@@ -7189,23 +9117,7 @@ int PtermFrame::check_pcZ80(void)
         x2 = ReadRAMW (cp + 4) & 0x1ff;
         y2 = ReadRAMW (cp + 6) & 0x1ff;
         ptermBlockErase (x, y, x2, y2);
-        m_canvas->Refresh (false);
-        return 1;
-        
-    case R_INPX:
-        state->registers.word[Z80_HL] = currentX;
-        return 1;
-
-    case R_INPY:
-        state->registers.word[Z80_HL] = currentY;
-        return 1;
-        
-    case R_OUTX:
-        currentX = state->registers.word[Z80_HL] & 0x01ff;
-        return 1;
-        
-    case R_OUTY:
-        currentY = state->registers.word[Z80_HL] & 0x01ff;
+        ptermRefresh ();
         return 1;
         
     case R_XMIT:
@@ -7233,44 +9145,9 @@ int PtermFrame::check_pcZ80(void)
         mode = (L >> 1) & 037;
         return 1;
         
-    case R_STEPX:
-        currentX = (currentX + ((RAM[M_DIR] & 2) ? -1 : 1)) & 0777;
-        return 1;
-        
-    case R_STEPY:
-        currentY = (currentY + ((RAM[M_DIR] & 1) ? -1 : 1)) & 0777;
-        return 1;
-        
     case R_WE:
         ptermDrawPoint (currentX, currentY);
-        m_canvas->Refresh (false);
-        return 1;
-        
-    case R_DIR:
-        L = state->registers.byte[Z80_L];
-        RAM[M_DIR] = L & 3;
-        return 1;
-        
-    case R_INPUT:
-#if 0   // disable with level 2 patch of execerr getkey loop
-        if (m_mtutorBoot)  // this is very bad for performance, 
-                           // intolerable on-line, even crashes
-        {
-            int ms = 1;
-            m_canvas->Refresh(false);
-            Mz80Waiter(ms);
-            m_giveupz80 = true;
-        }
-#endif
-
-        if (tracePterm)
-        {
-            tracex("R_INPUT: %04x", mt_key);
-            //printf("\nR.INPUT %04x\n", mt_key);   // temp
-        }
-        state->registers.word[Z80_HL] = mt_key & 0xffff;
-        mt_key = -1;
-
+        ptermRefresh ();
         return 1;
         
     case R_SSF:
@@ -7342,44 +9219,13 @@ int PtermFrame::check_pcZ80(void)
             if (device == 1 && writ == 0)
             {
                 trace("R_SSF %04x", n);
-                m_canvas->ptermTouchPanel((data & 0x20) != 0);
+                ptermSetTouch ((data & 0x20) != 0);
             }
             break;
         }
     }
         return 1;
         
-    case R_CCR:
-        RAM[M_CCR] = state->registers.byte[Z80_L];
-        return 1;
-        
-    case R_EXTOUT:
-        // r.extout
-
-        //printf("r.extout data=%04x\n", HL.pair);
-
-        return 1;
-        
-    case R_EXEC:
-        // r.exec
-        trace ("R.EXEC");
-        Mz80Waiter(RESIDENTMSEC);
-        m_giveupz80 = true;
-        //SaveRestoreColors (save, micro);
-        //SaveRestoreColors (restore, host);
-        return 1;
-        
-    case R_GJOB:
-        // r.gjob
-        return 1;
-        
-    case R_XJOB:
-        // r.xjob
-        return 1;
-
-    case R_RETURN: //obsolete
-        return 1;
-
     case R_CHRCV:
         {
             u16 src = state->registers.word[Z80_DE];
@@ -7395,7 +9241,7 @@ int PtermFrame::check_pcZ80(void)
         return 1;
 
     case R_ALARM:
-        wxBell();
+        ptermBell (false);
         return 1;
 
     case R_FCOLOR:      // for standard use with h, l, d
@@ -7462,13 +9308,13 @@ int PtermFrame::check_pcZ80(void)
 
     case R_PAINT:       // standard
         ptermPaint(state->registers.word[Z80_HL]);
-        m_canvas->Refresh (false);
+        ptermRefresh ();
         return 1;
 
     case R_PAINT + 1:   // mtutor ccode
         ptermPaint(RAM[state->registers.word[Z80_DE]] |
             (RAM[state->registers.word[Z80_DE] + 1] << 8));
-        m_canvas->Refresh (false);
+        ptermRefresh ();
         return 1;
 
     case R_PAINT + 2:   // mtutor ccode - usefull for debugging
@@ -7476,51 +9322,18 @@ int PtermFrame::check_pcZ80(void)
             (RAM[state->registers.word[Z80_DE] + 1]));
         return 1;
 
-    case R_WAIT16:  // 0x0097
-        // for use with mtutor timed -pause-
-        wxMilliSleep(15);
-
-        return 1;
-
-    case R_WAIT16 + 1:
-        // standard interface with HL
-        wxMilliSleep (state->registers.word[Z80_HL]);
-
-        return 1;
-
-    case R_WAIT16 + 2:
-        // interface with DE for use with mtutor -ccode-
-        wxMilliSleep (ReadRAMW(state->registers.word[Z80_DE]));
-
-        return 1;
-
-    case R_DUMMY2:
-
-        return 1;
-
-    case R_DUMMY3:
-
-        return 1;
 
     default:
-        if (state->pc < WORKRAM)
-        {
-            // Wild jump into ROM resident, quit
-            fprintf (stderr, "Wild jump to %04x\n", state->pc);
-            printf("Wild jump/call/ret to %04x\n", state->pc);
-            trace("Wild jump/call/ret to %04x\n", state->pc);
+        // Wild jump into ROM resident, quit
+        fprintf (stderr, "Wild jump to %04x\n", state->pc);
+        printf("Wild jump/call/ret to %04x\n", state->pc);
+        trace("Wild jump/call/ret to %04x\n", state->pc);
 
-            // no longer send keys to mtutor; it's dead
-            mt_ksw &= 0xfe;
-            m_mtutorBoot = false;
+        // no longer send keys to mtutor; it's dead
+        mt_ksw &= 0xfe;
+        m_mtutorBoot = false;
 
-            return 2;
-        }
-        else
-        {
-            // Plain old RAM PC -- keep executing
-            return 0;
-        }
+        return 2;
     }
 }
 
@@ -7569,6 +9382,10 @@ void PtermFrame::SaveRestoreColors (u8 action, u8 target)
 
 void PtermFrame::BootMtutor()
 {
+    // The z80 may be running the previous boot; stop it first.
+    MicroHalt ();
+    mtKeyClear ();
+
     if (m_floppy0 && m_floppy0File.Length() > 0)
         m_MTFiles[0].Open(m_floppy0File);
     else
@@ -7629,6 +9446,7 @@ void PtermFrame::BootMtutor()
         m_MTFiles[0].ReadByte();        // omit check bytes
         m_MTFiles[0].ReadByte();
     }
+    Z80BlockFlush ();
 
     state->pc = 0x5306;    // f.inix - boot entry point
 
@@ -7638,9 +9456,11 @@ void PtermFrame::BootMtutor()
     {
         tracex("boot to mtutor");
     }
+    // The z80 starts out with the colors the host had.
     SaveRestoreColors (save, host);
+    m_colorsFor = micro;
 
-    MicroEmulate;
+    MicroStart (micro);
 }
 
 /*******************************************************************************
@@ -38,7 +38,9 @@ public:
     bool reportError(const char *fn);
     void SetHelpContext (u8 context);
 
-    wxString rwflag;
+    // Status bar read/write flag.  Set by the z80 thread as it does
+    // disk I/O, so it is just a pointer to a constant string.
+    const wxChar * volatile rwflag;
 
 private:
     bool _RamBased;
@@ -94,6 +94,9 @@ bool PtermApp::OnInit (void)
     
     // File name to use for tracing, if we enable tracing
     sprintf (traceFn, "pterm%d.trc", pid);
+    sprintf (captureFn, "pterm%d.ptc", pid);
+    sprintf (profileFn, "pterm%d.prof", pid);
+    sprintf (foldedFn, "pterm%d.folded", pid);
 
     srand (time (NULL)); 
     m_locale.Init (wxLANGUAGE_DEFAULT);
@@ -277,6 +280,63 @@ void PtermApp::MacOpenFiles (const wxArrayString &s)
                 frame->m_dumbTty = false;
             }
         }
+        else if (wxfilename.IsOk () &&
+                 wxfilename.GetExt ().CmpNoCase (wxT ("ptc")) == 0)
+        {
+            // Session capture, optionally followed by the playback
+            // speed (0 for as fast as possible) and the number of
+            // seconds into the capture to start at.
+            double speed = 1., start = 0.;
+
+            if (i + 1 < files.GetCount () && files[i + 1].ToDouble (&speed))
+            {
+                i++;
+                if (i + 1 < files.GetCount () &&
+                    files[i + 1].ToDouble (&start))
+                {
+                    i++;
+                }
+            }
+            
+            testdata = fopen (filename, "rb");
+            if (testdata == NULL)
+            {
+                wxString msg ("Error opening capture file ");
+
+                msg.Append (filename);
+                msg.Append (":\n");
+                msg.Append (wxSysErrorMsg ());
+                
+                wxMessageBox (msg, "Error", wxICON_ERROR | wxOK | wxCENTRE);
+                continue;
+            }
+
+            PtermReplayConnection *rconn =
+                new PtermReplayConnection (testdata, speed);
+            if (!rconn->IsOk ())
+            {
+                wxString msg ("Not a Pterm capture file: ");
+
+                msg.Append (filename);
+                wxMessageBox (msg, "Error", wxICON_ERROR | wxOK | wxCENTRE);
+                delete rconn;
+                continue;
+            }
+            if (start > 0.)
+            {
+                rconn->Seek ((u64) (start * 1000000.));
+            }
+            
+            PtermProfile *tprof = new PtermProfile ();
+            wxString title ("Replay: ");
+            title.Append (filename);
+
+            frame = new PtermFrame (title, tprof, rconn);
+            if (frame != NULL)
+            {
+                frame->m_dumbTty = false;
+            }
+        }
         else
         {
             wxString host;
@@ -285,7 +345,9 @@ void PtermApp::MacOpenFiles (const wxArrayString &s)
             if (i != 0 || files.GetCount () < 1)
             {
                 wxMessageBox ("usage: pterm [ hostname [ portnum [ termtype ]]]\n"
-                              "   or: pterm [ filename.ppf ]\n", "Usage",
+                              "   or: pterm [ filename.ppf ]\n"
+                              "   or: pterm filename.ptc [ speed [ seconds ]]\n",
+                              "Usage",
                               wxICON_ERROR | wxOK | wxCENTRE);
                 break;
             }
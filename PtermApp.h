@@ -76,6 +76,9 @@ public:
     PtermFrame *m_CurFrame;
 
     char        traceFn[20];
+    char        captureFn[20];
+    char        profileFn[20];
+    char        foldedFn[20];
 
     PtermConnDialog *m_connDialog;
 
@@ -10,6 +10,9 @@ class PtermCanvas : public wxScrolledCanvas
 public:
     PtermCanvas(PtermFrame *parent);
 
+    // Events are handled with the decode thread stopped, as for the frame
+    virtual bool ProcessEvent(wxEvent& event);
+
     void ptermTouchPanel(bool enable);
 
     void OnDraw(wxDC &dc);
@@ -26,6 +29,7 @@ public:
 #endif
 
     void Unadjust(int x, int y, int *xx, int *yy) const;
+    wxRect UpdateBitmapRect(void) const;
 
     int m_mouseX;
     int m_mouseY;
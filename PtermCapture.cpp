@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////
+// Name:        PtermCapture.cpp
+// Purpose:     Implementation of class for binary session capture
+// Authors:     Paul Koning, Joe Stanton, Bill Galcher, Steve Zoppi, Dale Sinder
+// Created:     10/17/2026
+// Copyright:   (c) Paul Koning, Joe Stanton, Dale Sinder
+// Licence:     see pterm-license.txt
+/////////////////////////////////////////////////////////////////////////////
+
+#include "PtermCapture.h"
+
+PtermCapture::PtermCapture ()
+    : m_ready (m_lock),
+      m_room (m_lock),
+      m_buf (NULL),
+      m_spare (NULL),
+      m_len (0),
+      m_active (false),
+      m_stop (false),
+      m_file (NULL)
+{
+}
+
+PtermCapture::~PtermCapture ()
+{
+    Close ();
+}
+
+// Start capturing to the named file.  Returns false if it can't be
+// opened.
+bool PtermCapture::Open (const char *fn)
+{
+    CaptureHeader hdr;
+
+    Close ();
+    m_file = fopen (fn, "wb");
+    if (m_file == NULL)
+    {
+        fprintf (stderr, "Failure opening capture file %s\n", fn);
+        return false;
+    }
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, CaptureMagic, sizeof (hdr.magic));
+    hdr.version = CaptureVersion;
+    hdr.order = CaptureOrder;
+    fwrite (&hdr, sizeof (hdr), 1, m_file);
+
+    m_buf = new char[CaptureBufSize];
+    m_spare = new char[CaptureBufSize];
+    m_len = 0;
+    m_stop = false;
+    if (dtCreateThread (s_writer, this, &m_thread) != 0)
+    {
+        fclose (m_file);
+        m_file = NULL;
+        delete [] m_buf;
+        delete [] m_spare;
+        m_buf = m_spare = NULL;
+        return false;
+    }
+    m_clock.Start ();
+    m_active = true;
+    return true;
+}
+
+// Stop capturing.  Whatever was captured so far is written out first.
+void PtermCapture::Close (void)
+{
+    if (m_file == NULL)
+    {
+        return;
+    }
+    {
+        wxMutexLocker lock (m_lock);
+        m_active = false;
+        m_stop = true;
+        m_ready.Signal ();
+    }
+    pthread_join (m_thread, NULL);
+    fclose (m_file);
+    m_file = NULL;
+    delete [] m_buf;
+    delete [] m_spare;
+    m_buf = m_spare = NULL;
+}
+
+// Record words received from the host.
+void PtermCapture::Words (const u32 *buf, int n)
+{
+    int chunk;
+
+    while (n > 0)
+    {
+        chunk = (n > 0xffff) ? 0xffff : n;
+        Put (CapWords, chunk, buf, chunk * sizeof (u32));
+        buf += chunk;
+        n -= chunk;
+    }
+}
+
+// Record data sent to the host.
+void PtermCapture::Keys (const void *data, int len)
+{
+    const char *p = (const char *) data;
+    int chunk;
+
+    while (len > 0)
+    {
+        chunk = (len > 0xffff) ? 0xffff : len;
+        Put (CapKeys, chunk, p, chunk);
+        p += chunk;
+        len -= chunk;
+    }
+}
+
+// Record a change in connection mode.
+void PtermCapture::Mode (int mode)
+{
+    Put (CapMode, mode, NULL, 0);
+}
+
+// Add a record to the buffer.  The time is taken here, under the
+// lock, so the records in the file are in time order even if they
+// come from different threads.
+void PtermCapture::Put (int type, int count, const void *data, int len)
+{
+    CaptureRec rec;
+    int size;
+
+    wxMutexLocker lock (m_lock);
+
+    size = sizeof (rec) + ((len + 3) & ~3);
+    while (m_active && m_len + size > CaptureBufSize)
+    {
+        m_ready.Signal ();
+        m_room.Wait ();
+    }
+    if (!m_active)
+    {
+        return;
+    }
+
+    rec.time = m_clock.Usec ();
+    rec.type = type;
+    rec.count = count;
+    memcpy (m_buf + m_len, &rec, sizeof (rec));
+    memcpy (m_buf + m_len + sizeof (rec), data, len);
+    memset (m_buf + m_len + sizeof (rec) + len, 0, size - sizeof (rec) - len);
+    m_len += size;
+
+    // Don't wake the writer for every little record; it looks
+    // on its own now and then anyway.
+    if (m_len >= CaptureBufSize / 2)
+    {
+        m_ready.Signal ();
+    }
+}
+
+dtThreadFun (PtermCapture::s_writer, arg)
+{
+    PtermCapture *self = (PtermCapture *) arg;
+
+    self->Writer ();
+    ThreadReturn;
+}
+
+// The writer thread.  It takes the records gathered so far every
+// quarter second, or sooner if the buffer is filling up, and writes
+// them out.  The file is only touched by this thread until Close.
+void PtermCapture::Writer (void)
+{
+    char *p;
+    int len;
+    bool stop;
+
+    for (;;)
+    {
+        {
+            wxMutexLocker lock (m_lock);
+
+            if (m_len < CaptureBufSize / 2 && !m_stop)
+            {
+                m_ready.WaitTimeout (250);
+            }
+            p = m_buf;
+            len = m_len;
+            m_buf = m_spare;
+            m_spare = p;
+            m_len = 0;
+            stop = m_stop;
+            m_room.Broadcast ();
+        }
+        if (len > 0)
+        {
+            fwrite (p, 1, len, m_file);
+        }
+        if (stop)
+        {
+            break;
+        }
+    }
+    fflush (m_file);
+}
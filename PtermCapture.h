@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////////
+// Name:        PtermCapture.h
+// Purpose:     Declaration of class for binary session capture
+// Authors:     Paul Koning, Joe Stanton, Bill Galcher, Steve Zoppi, Dale Sinder
+// Created:     10/17/2026
+// Copyright:   (c) Paul Koning, Joe Stanton, Dale Sinder
+// Licence:     see pterm-license.txt
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef __PtermCapture_H__
+#define __PtermCapture_H__ 1
+
+#include "CommonHeader.h"
+#include <chrono>
+
+// A capture file (.ptc) starts with a CaptureHeader, followed by
+// records.  Each record is a CaptureRec followed by its data, padded
+// to a multiple of 4 bytes:
+//
+//  CapWords    "count" words from the host, as u32 each
+//  CapKeys     "count" bytes sent to the host
+//  CapMode     no data; "count" is the new connection mode
+//
+// The time is microseconds since the capture was started, from a
+// monotonic clock.  Everything is in host byte order; the header has
+// a byte order check.
+#define CaptureMagic    "PtermCap"
+#define CaptureVersion  1
+#define CaptureOrder    0x01020304
+
+enum CaptureType_e
+{
+    CapWords = 1,
+    CapKeys,
+    CapMode
+};
+
+struct CaptureHeader
+{
+    char    magic[8];
+    u32     version;
+    u32     order;
+};
+
+struct CaptureRec
+{
+    u64     time;
+    u16     type;
+    u16     count;
+};
+
+#define CaptureRecSize(rec) \
+    (sizeof (CaptureRec) + \
+     (((rec).type == CapWords) ? (rec).count * sizeof (u32) : \
+      ((rec).type == CapKeys) ? ((rec).count + 3) & ~3 : 0))
+
+// Microseconds since Start, from a monotonic clock, so capture times
+// and replay pacing don't jump if the time of day is changed.
+// (wxStopWatch uses the time of day on some systems.)
+class PtermClock
+{
+public:
+    PtermClock ()
+    {
+        Start ();
+    }
+    void Start (void)
+    {
+        m_start = std::chrono::steady_clock::now ();
+    }
+    u64 Usec (void) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::steady_clock::now () - m_start).count ();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Session capture writer.  Records can come from several threads;
+// they are gathered in memory and written out by a thread of its own,
+// so the network and GUI threads never wait for the disk.
+class PtermCapture
+{
+public:
+    PtermCapture ();
+    ~PtermCapture ();
+    bool Open (const char *fn);
+    void Close (void);
+    bool Active (void) const
+    {
+        return m_active;
+    }
+
+    void Words (const u32 *buf, int n);
+    void Keys (const void *data, int len);
+    void Mode (int mode);
+
+private:
+    void Put (int type, int count, const void *data, int len);
+    static dtThreadFun (s_writer, arg);
+    void Writer (void);
+
+    // Records go into m_buf; the writer thread swaps it with m_spare
+    // and writes that out.  If the writer falls behind, Put waits.
+#define CaptureBufSize  65536
+    wxMutex     m_lock;
+    wxCondition m_ready;
+    wxCondition m_room;
+    char        *m_buf;
+    char        *m_spare;
+    int         m_len;
+    volatile bool m_active;
+    bool        m_stop;
+    FILE        *m_file;
+    pthread_t   m_thread;
+    PtermClock  m_clock;
+};
+
+#endif  // __PtermCapture_H__
@@ -11,6 +11,9 @@
 #include "PtermConnDialog.h"
 #include "PtermFrame.h"
 #include "DebugPterm.h"
+#if !defined (_WIN32)
+#include <sys/mman.h>
+#endif
 
 // ----------------------------------------------------------------------------
 // PtermConnection
@@ -31,11 +34,50 @@ void PtermConnection::SendData (const void *, int)
 {
 }
 
+bool PtermConnection::FlushData (void)
+{
+    return false;
+}
+
+// Get up to "max" words into buf, stopping at the first C_NODATA (which
+// is not stored).  Returns the number of words stored.  Connections
+// that have nothing better to offer just call NextWord repeatedly.
+int PtermConnection::NextWords (int *buf, int max)
+{
+    int n;
+
+    for (n = 0; n < max; n++)
+    {
+        buf[n] = NextWord ();
+        if (buf[n] == C_NODATA)
+        {
+            break;
+        }
+    }
+
+    return n;
+}
+
+// Words taken by NextWords can be thrown away by the connection before
+// they are processed (abort output, or a connection status code).
+// Given the index of the next word of the last batch and the batch
+// size, returns the index of the next word that is still good, which
+// is "count" if none are.
+int PtermConnection::LiveWord (int index, int)
+{
+    return index;
+}
+
 int PtermConnection::RingCount (void) const
 {
     return 0;
 }
 
+wxString PtermConnection::HostAddr (void)
+{
+    return wxString ();
+}
+
 void PtermConnection::StoreWord (int)
 {
 }
@@ -45,6 +87,18 @@ void PtermConnection::Connect (void)
     m_owner->ptermSetConnected ();
 }
 
+void PtermConnection::SetCapture (bool)
+{
+}
+
+// Move through a recorded session; see the test and replay
+// connections.  Returns true if playback starts over from the
+// beginning.
+bool PtermConnection::Step (int)
+{
+    return false;
+}
+
 // ----------------------------------------------------------------------------
 // PtermLocalConnection
 // ----------------------------------------------------------------------------
@@ -58,67 +112,364 @@ int PtermLocalConnection::NextWord (void)
 // PtermTestConnection
 // ----------------------------------------------------------------------------
 
+// Trace files bigger than this are parsed in pieces, one thread per
+// processor.
+#define TraceChunkMin   (1024 * 1024)
+#define TraceChunkMax   64
+
+// What a trace parsing thread works on: the text from "start" to "end",
+// which begins at the start of a line and ends with a complete line.
+struct TraceChunk
+{
+    const char  *start;
+    const char  *end;
+    TraceEntry  *entries;
+    u32         count;
+    u32         size;
+    pthread_t   thread;
+    bool        threaded;
+    bool        failed;         // out of memory
+};
+
+// Parse an octal number the way sscanf "%o" does: optional leading
+// white space and sign, then at least one octal digit.
+static bool traceOctal (const char *&p, u32 &val)
+{
+    bool neg = false;
+    u32 v = 0;
+    
+    while (isspace (*p))
+    {
+        p++;
+    }
+    if (*p == '+' || *p == '-')
+    {
+        neg = (*p++ == '-');
+    }
+    if (*p < '0' || *p > '7')
+    {
+        return false;
+    }
+    while (*p >= '0' && *p <= '7')
+    {
+        v = (v << 3) + (*p++ - '0');
+    }
+    val = (neg) ? -v : v;
+    return true;
+}
+
+// Match a literal the way sscanf does, where a space in the format
+// matches any amount of white space (including none).
+static bool traceMatch (const char *&p, const char *lit)
+{
+    for ( ; *lit != '\0'; lit++)
+    {
+        if (*lit == ' ')
+        {
+            while (isspace (*p))
+            {
+                p++;
+            }
+        }
+        else if (*p++ != *lit)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add an entry to the chunk.  Returns false (and marks the chunk as
+// failed) if there is no memory for it.
+static bool traceAdd (TraceChunk *c, u32 word, u32 seq, int kind)
+{
+    TraceEntry *entries;
+    
+    if (c->count == c->size)
+    {
+        entries = (TraceEntry *) realloc (c->entries, (c->size * 2 + 1024) *
+                                          sizeof (TraceEntry));
+        if (entries == NULL)
+        {
+            c->failed = true;
+            return false;
+        }
+        c->entries = entries;
+        c->size = c->size * 2 + 1024;
+    }
+    c->entries[c->count].word = word;
+    c->entries[c->count].seq = seq;
+    c->entries[c->count].kind = kind;
+    c->count++;
+    return true;
+}
+
+// Parse a piece of a trace file.  This is what the old line at a time
+// reader did with fgets and sscanf, including reading long lines as
+// several pieces of up to 198 characters.  Words without a sequence
+// number get TraceNoSeq; duplicates are removed later, in order.
+#define TraceNoSeq  0xffffffff
+static dtThreadFun (traceParse, arg)
+{
+    TraceChunk *c = (TraceChunk *) arg;
+    const char *line = c->start;
+    const char *next, *p;
+    char tline[200];
+    bool ascii = false;
+    int len;
+    u32 w, seq;
+    
+    while (line < c->end && !c->failed)
+    {
+        len = c->end - line;
+        if (len > 198)
+        {
+            len = 198;
+        }
+        next = (const char *) memchr (line, '\n', len);
+        next = (next != NULL) ? next + 1 : line + len;
+        len = next - line;
+        memcpy (tline, line, len);
+        tline[len] = '\0';
+        line = next;
+        
+        // Only the first mention of ASCII can matter, so one per
+        // chunk is plenty.
+        if (!ascii && (strstr (tline, "ascii") != NULL ||
+                       strstr (tline, "ASCII") != NULL))
+        {
+            traceAdd (c, 0, 0, TraceAscii);
+            ascii = true;
+        }
+
+        p = tline;
+        if (len > 14 && p[2] == ':')
+        {
+            // Timestamp at start of line, skip it
+            p += 14;
+        }
+        if (strncmp (p, "key", 3) == 0)
+        {
+            // Key stroke in the trace, so this is a pause point.
+            if (traceMatch (p, "key to plato ") && traceOctal (p, w))
+            {
+                traceAdd (c, w, 0, TraceKey);
+            }
+            continue;
+        }
+        if (!traceOctal (p, w))
+        {
+            continue;
+        }
+        seq = TraceNoSeq;
+        if (traceMatch (p, " seq "))
+        {
+            if (*p == '+' || *p == '-' || isdigit (*p))
+            {
+                seq = strtol (p, NULL, 10);
+            }
+        }
+        traceAdd (c, w, seq, TraceWord);
+    }
+    
+    ThreadReturn;
+}
+
 PtermTestConnection::PtermTestConnection (FILE *testdata)
-    : m_testdata (testdata),
-      m_pseq (~(0U))
+    : m_entries (NULL),
+      m_count (0),
+      m_index (0),
+      m_limit (0),
+      m_keys (NULL),
+      m_keyCount (0)
 {
+    Load (testdata);
+    fclose (testdata);
+    m_limit = m_count;
 }
 
 PtermTestConnection::~PtermTestConnection ()
 {
-    fclose (m_testdata);
+    free (m_entries);
+    delete [] m_keys;
 }
 
-int PtermTestConnection::NextWord (void)
+// Read the whole trace file and turn it into m_entries.  The file is
+// mapped rather than read where we can, and split into pieces that
+// are parsed at the same time, so even a trace of an overnight session
+// is ready to play in a few seconds.
+void PtermTestConnection::Load (FILE *testdata)
 {
-    char *fret, *p;
-    char tline[200];
-    u32 w, key, seq;
+    TraceChunk chunks[TraceChunkMax];
+    const char *text, *p;
+    long size;
+    int nchunks, i;
+    u32 j, pseq, seq;
+    bool failed;
+    
+    fseek (testdata, 0, SEEK_END);
+    size = ftell (testdata);
+    fseek (testdata, 0, SEEK_SET);
+    if (size <= 0)
+    {
+        return;
+    }
+#if defined (_WIN32)
+    char *buf = new char[size];
+    size = fread (buf, 1, size, testdata);
+    text = buf;
+#else
+    void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE,
+                      fileno (testdata), 0);
+    if (map == MAP_FAILED)
+    {
+        return;
+    }
+    madvise (map, size, MADV_SEQUENTIAL);
+    text = (const char *) map;
+#endif
 
-    for (;;)
+    // Split the text at line boundaries, then parse the pieces.
+    nchunks = size / TraceChunkMin;
+    if (nchunks > wxThread::GetCPUCount ())
     {
-        fret = fgets (tline, 199, m_testdata);
-        if (fret == NULL)
+        nchunks = wxThread::GetCPUCount ();
+    }
+    if (nchunks > TraceChunkMax)
+    {
+        nchunks = TraceChunkMax;
+    }
+    if (nchunks < 1)
+    {
+        nchunks = 1;
+    }
+    p = text;
+    for (i = 0; i < nchunks; i++)
+    {
+        chunks[i].start = p;
+        if (i == nchunks - 1)
         {
-            return C_NODATA;
+            p = text + size;
         }
-        if (m_connMode == both)
+        else
         {
-            // See if we can figure out the connection mode
-            if (strstr (tline, "ascii") != NULL ||
-                strstr (tline, "ASCII") != NULL)
+            p = text + size / nchunks * (i + 1);
+            if (p < chunks[i].start)
             {
-                m_connMode = ascii;
+                p = chunks[i].start;
             }
+            while (p < text + size && *p++ != '\n') ;
         }
-                
-        p = tline;
-        seq = m_pseq ^ 1;
-        if (p[2] == ':')
+        chunks[i].end = p;
+        chunks[i].entries = NULL;
+        chunks[i].count = chunks[i].size = 0;
+        chunks[i].failed = false;
+    }
+    for (i = 1; i < nchunks; i++)
+    {
+        chunks[i].threaded =
+            (dtCreateThread (traceParse, &chunks[i], &chunks[i].thread) == 0);
+        if (!chunks[i].threaded)
         {
-            // Timestamp at start of line, skip it
-            p += 14;
+            // No thread, do it here instead.
+            traceParse (&chunks[i]);
         }
-        if (sscanf (p, "key to plato %o", &key))// != 0 && key < 0200)
+    }
+    traceParse (&chunks[0]);
+    for (i = 1; i < nchunks; i++)
+    {
+        if (chunks[i].threaded)
         {
-            // Key stroke in the trace, so this is a pause point.  But
-            // simply pausing isn't correct because that doesn't
-            // update the screen.  Need a better answer.
+            pthread_join (chunks[i].thread, NULL);
         }
-        else if (sscanf (p, "%o seq %d", &w, &seq) != 0 ||
-                 sscanf (p, "%o  wc", &w) != 0)
+    }
+#if defined (_WIN32)
+    delete [] buf;
+#else
+    munmap (map, size);
+#endif
+
+    // Put the pieces together, dropping words seen before (same
+    // sequence number as the one before; words without a sequence
+    // number are always new), and make the index of keys.
+    failed = false;
+    for (i = 0; i < nchunks; i++)
+    {
+        m_count += chunks[i].count;
+        failed |= chunks[i].failed;
+    }
+    if (!failed)
+    {
+        m_entries = (TraceEntry *) malloc (m_count * sizeof (TraceEntry) + 1);
+    }
+    m_count = 0;
+    if (m_entries == NULL)
+    {
+        // Too big.  Leave the connection empty.
+        for (i = 0; i < nchunks; i++)
         {
-            // Successful conversion, process the word, provided it is
-            // new (different sequence number than before), or it's a
-            // trace without sequence numbers.
-            if (seq == m_pseq)
-                continue;
-            
-            m_pseq = seq;
+            free (chunks[i].entries);
+        }
+        wxMessageBox (_("Not enough memory to load the test data file"),
+                      _("Error"), wxICON_ERROR | wxOK | wxCENTRE);
+        return;
+    }
+    pseq = ~(0U);
+    for (i = 0; i < nchunks; i++)
+    {
+        for (j = 0; j < chunks[i].count; j++)
+        {
+            TraceEntry &e = chunks[i].entries[j];
+
+            if (e.kind == TraceWord)
+            {
+                seq = (e.seq == TraceNoSeq) ? pseq ^ 1 : e.seq;
+                if (seq == pseq)
+                {
+                    continue;
+                }
+                pseq = e.seq = seq;
+            }
+            else if (e.kind == TraceKey)
+            {
+                m_keyCount++;
+            }
+            m_entries[m_count++] = e;
+        }
+        free (chunks[i].entries);
+    }
+    m_keys = new u32[m_keyCount + 1];
+    m_keyCount = 0;
+    for (j = 0; j < m_count; j++)
+    {
+        if (m_entries[j].kind == TraceKey)
+        {
+            m_keys[m_keyCount++] = j;
+        }
+    }
+}
+
+int PtermTestConnection::NextWords (int *buf, int max)
+{
+    int n = 0;
+    u32 w;
+
+    while (n < max && m_index < m_limit)
+    {
+        const TraceEntry &e = m_entries[m_index];
+
+        if (e.kind == TraceWord)
+        {
+            w = e.word;
             if (m_connMode == both && w > 2)
             {
                 // See if the value of the word gives a clue about
-                // the protocol used
+                // the protocol used.  The words so far go with the
+                // old mode.
+                if (n > 0)
+                {
+                    break;
+                }
                 if (w <= 0377 || (w >> 8) == 033)
                 {
                     m_connMode = ascii;
@@ -128,38 +479,318 @@ int PtermTestConnection::NextWord (void)
                     m_connMode = niu;
                 }
             }
-            return w;
+            buf[n++] = w;
+        }
+        else if (e.kind == TraceAscii && m_connMode == both)
+        {
+            if (n > 0)
+            {
+                break;
+            }
+            m_connMode = ascii;
+        }
+        m_index++;
+    }
+
+    return n;
+}
+
+int PtermTestConnection::NextWord (void)
+{
+    int w;
+
+    if (NextWords (&w, 1) == 0)
+    {
+        return C_NODATA;
+    }
+    return w;
+}
+
+// Play up to the next key in the trace (dir > 0) or back to the one
+// before (dir < 0).  Going back means playing again from the start,
+// so it returns true to say the screen should be cleared first.
+bool PtermTestConnection::Step (int dir)
+{
+    u32 lo = 0, hi = m_keyCount, mid;
+
+    // Find the first key at or after the current position.
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (m_keys[mid] < m_index)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (dir > 0)
+    {
+        if (lo < m_keyCount && m_keys[lo] == m_index)
+        {
+            // Stopped at a key now; go to the one after it.
+            lo++;
+        }
+        m_limit = (lo < m_keyCount) ? m_keys[lo] : m_count;
+        wxWakeUpIdle ();
+        return false;
+    }
+    
+    m_limit = (lo > 0) ? m_keys[lo - 1] : 0;
+    m_index = 0;
+    m_connMode = both;
+    wxWakeUpIdle ();
+    return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// PtermReplayConnection
+// ----------------------------------------------------------------------------
+
+// The whole capture is read into memory; records are then taken from
+// it in place.  If the file isn't a capture, IsOk returns false.
+PtermReplayConnection::PtermReplayConnection (FILE *capture, double speed)
+    : m_data (NULL),
+      m_size (0),
+      m_pos (sizeof (CaptureHeader)),
+      m_recWords (NULL),
+      m_recLeft (0),
+      m_speed (speed),
+      m_base (0),
+      m_now (0),
+      m_seekTo (0),
+      m_seeking (false)
+{
+    CaptureHeader hdr;
+    long size;
+
+    fseek (capture, 0, SEEK_END);
+    size = ftell (capture);
+    fseek (capture, 0, SEEK_SET);
+    if (size >= (long) sizeof (hdr))
+    {
+        m_data = new u8[size];
+        if (fread (m_data, 1, size, capture) != (size_t) size)
+        {
+            delete [] m_data;
+            m_data = NULL;
+        }
+    }
+    fclose (capture);
+    if (m_data == NULL)
+    {
+        return;
+    }
+    
+    memcpy (&hdr, m_data, sizeof (hdr));
+    if (memcmp (hdr.magic, CaptureMagic, sizeof (hdr.magic)) != 0 ||
+        hdr.version != CaptureVersion || hdr.order != CaptureOrder)
+    {
+        delete [] m_data;
+        m_data = NULL;
+        return;
+    }
+    m_size = size;
+}
+
+PtermReplayConnection::~PtermReplayConnection ()
+{
+    m_timer.Stop ();
+    delete [] m_data;
+}
+
+void PtermReplayConnection::Connect (void)
+{
+    PtermConnection::Connect ();
+    m_clock.Start ();
+}
+
+// Play from the given point in the capture (microseconds from its
+// start).  The words before that point are still delivered, but
+// without pacing, so the screen shows what it did at that time.
+// Going backwards means starting over from the beginning, in which
+// case it returns true.
+bool PtermReplayConnection::Seek (u64 usec)
+{
+    bool restart = false;
+    
+    if (m_data == NULL)
+    {
+        return false;
+    }
+    if (usec < m_now)
+    {
+        m_pos = sizeof (CaptureHeader);
+        m_recLeft = 0;
+        m_now = 0;
+        m_connMode = both;
+        restart = true;
+    }
+    m_seekTo = usec;
+    m_seeking = true;
+    wxWakeUpIdle ();
+    return restart;
+}
+
+// Skip ahead or back ten seconds.
+bool PtermReplayConnection::Step (int dir)
+{
+    u64 step = 10000000;
+
+    if (dir > 0)
+    {
+        return Seek (m_now + step);
+    }
+    return Seek ((m_now > step) ? m_now - step : 0);
+}
+
+// Check if a record with the given time may be played now.  If not,
+// arrange for an idle event when it may.
+bool PtermReplayConnection::Due (u64 time)
+{
+    u64 now, due;
+    
+    if (m_speed <= 0.)
+    {
+        return true;
+    }
+    if (m_seeking)
+    {
+        if (time <= m_seekTo)
+        {
+            return true;
+        }
+
+        // Done skipping ahead, resume pacing from here.
+        m_seeking = false;
+        m_base = m_seekTo;
+        m_clock.Start ();
+    }
+    
+    now = m_clock.Usec ();
+    due = (u64) ((time - m_base) / m_speed);
+    if (due <= now)
+    {
+        return true;
+    }
+    if (!m_timer.IsRunning ())
+    {
+        m_timer.Start ((due - now) / 1000 + 1, wxTIMER_ONE_SHOT);
+    }
+    return false;
+}
+
+int PtermReplayConnection::NextWords (int *buf, int max)
+{
+    CaptureRec rec;
+    int n = 0, chunk;
+
+    if (m_data == NULL)
+    {
+        return 0;
+    }
+    
+    while (n < max)
+    {
+        if (m_recLeft > 0)
+        {
+            chunk = (m_recLeft < max - n) ? m_recLeft : max - n;
+            memcpy (buf + n, m_recWords, chunk * sizeof (u32));
+            m_recWords += chunk;
+            m_recLeft -= chunk;
+            n += chunk;
+            continue;
+        }
+
+        if (m_pos + sizeof (rec) > m_size)
+        {
+            // End of the capture
+            break;
+        }
+        memcpy (&rec, m_data + m_pos, sizeof (rec));
+        if (m_pos + CaptureRecSize (rec) > m_size || !Due (rec.time))
+        {
+            break;
+        }
+        if (rec.type == CapMode)
+        {
+            // The words so far go with the old mode.
+            if (n > 0)
+            {
+                break;
+            }
+            m_connMode = (connMode) rec.count;
         }
+        else if (rec.type == CapWords)
+        {
+            m_recWords = (const u32 *) (m_data + m_pos + sizeof (rec));
+            m_recLeft = rec.count;
+        }
+        m_pos += CaptureRecSize (rec);
+        m_now = rec.time;
     }
+
+    return n;
 }
 
+int PtermReplayConnection::NextWord (void)
+{
+    int w;
 
+    if (NextWords (&w, 1) == 0)
+    {
+        return C_NODATA;
+    }
+    return w;
+}
 
 
 // ----------------------------------------------------------------------------
 // PtermHostConnection
 // ----------------------------------------------------------------------------
+// Number of words from "out" up to (not including) "in" in the ring
+static int ringDistance (int out, int in)
+{
+    return (in >= out) ? in - out : RINGSIZE + in - out;
+}
+
 
 PtermHostConnection::PtermHostConnection (const wxString &host, int port)
     : m_fet (NULL),
+      m_fetReady (m_fetLock),
       m_displayIn (0),
+      m_displayFlush (-1),
+      m_lastCount (0),
       m_displayOut (0),
+      m_batchStart (-1),
+      m_spaceWait (false),
+      m_closing (false),
       m_gswIn (0),
       m_gswOut (0),
       m_port (port),
       m_gswStarted (false),
       m_savedGswMode (0),
       m_gswWord2 (0),
-      m_pending (0)
+      m_pending (0),
+      m_connStarted (false),
+      m_connectCancel (0),
+      m_niuSyncErrors (0),
+      m_sendLen (0)
 {
     m_hostName = host;
+    m_hostAddr[0] = '\0';
 
     m_portset.callBack = NULL;
     m_portset.dataCallBack = s_dataCallback;
     m_portset.callArg = m_portset.dataCallArg = this;
     m_portset.portNum = 0;      // No listening
     m_portset.maxPorts = 1;
-    m_portset.ringSize = BufSiz;
+    m_portset.ringSize = NetRingSize;
+    m_portset.mirrorRing = true;
     m_portset.sendRingSize = 1000;
     dtInitPortset (&m_portset);    
 }
@@ -171,214 +802,460 @@ PtermHostConnection::~PtermHostConnection ()
         ptermCloseGsw ();
         m_owner->m_gswFile = wxString ();
     }
+    // Stop the connect thread, if it is still at work.  It checks
+    // for cancel often while connecting, but a name lookup in progress
+    // has to run its course.
+    if (m_connStarted)
+    {
+        m_connectCancel = 1;
+        pthread_join (m_connThread, NULL);
+    }
+    // Release the network thread if it is waiting for ring space.
+    m_closing.store (true);
+    m_spaceSem.Post ();
     dtClose (m_fet, TRUE);
     m_fet = NULL;
 }
 
 void PtermHostConnection::Connect (void)
 {
-    struct hostent *hp;
-    in_addr_t hostaddr;
-    int i, addrcount, r, conntries;
-    in_addr_t *addresses = NULL;
+    if (dtCreateThread (s_connectThread, this, &m_connThread) != 0)
+    {
+        StoreWord (C_CONNFAIL2);
+        wxWakeUpIdle ();
+        return;
+    }
+    m_connStarted = true;
+}
+
+dtThreadFun (PtermHostConnection::s_connectThread, arg)
+{
+    PtermHostConnection *self = (PtermHostConnection *) arg;
+
+    self->connectThread ();
+    ThreadReturn;
+}
+
+// Look up the host and connect to it.  This runs in its own thread.
+// All the addresses for the name are tried, IPv6 and IPv4 alike, with
+// the attempts overlapped (see dtConnectRace) so the first one to
+// answer is used.
+void PtermHostConnection::connectThread (void)
+{
+    DtAddr addrs[DtMaxAddrs];
+    int addrcount, which;
+    NetFet *fet;
 
-    hp = gethostbyname (m_hostName.mb_str ());
-    if (hp == NULL || hp->h_length == 0)
+    addrcount = dtResolve (m_hostName.mb_str (), m_port, addrs, DtMaxAddrs);
+    if (addrcount == 0)
     {
         StoreWord (C_CONNFAIL1);
         wxWakeUpIdle ();
         return;
     }
 
-    for (addrcount = 0; hp->h_addr_list[addrcount] != NULL; addrcount++) ;
-    addresses = new in_addr_t[addrcount];
-    for (i = 0; i < addrcount; i++)
+    StoreWord (C_CONNECTING);
+    wxWakeUpIdle ();
+    fet = dtConnectRace (&m_portset, addrs, addrcount, &m_connectCancel,
+                         &which);
+    if (fet != NULL)
     {
-        memcpy (&addresses[i], hp->h_addr_list[i], sizeof (int));
+        // Hand the FET to the network thread, which may already
+        // be waiting for it.
+        wxMutexLocker lock (m_fetLock);
+        dtAddrString (&addrs[which], m_hostAddr, sizeof (m_hostAddr));
+        m_fet = fet;
+        m_fetReady.Broadcast ();
     }
-    for (conntries = 0; conntries < addrcount; conntries++)
+    else if (!m_connectCancel)
     {
-        while (addresses[(r = (rand () >> 10) % addrcount)] == 0) ;
-        hostaddr = addresses[r];
-        m_hostAddr = ntohl (hostaddr);
-        addresses[r] = 0;
-        StoreWord (C_CONNECTING);
+        // We ran out of addresses
+        StoreWord (C_CONNFAIL2);
         wxWakeUpIdle ();
-        m_fet = dtConnect (&m_portset, hostaddr, m_port);
-        if (m_fet != NULL)
+    }
+}
+
+void PtermHostConnection::s_dataCallback (NetFet *, int, void *arg)
+{
+    PtermHostConnection *self = (PtermHostConnection *) arg;
+    
+    tracex ("Data callback on %p", self);
+    self->dataCallback ();
+}
+
+// Wait until the display ring has room for another word.  Returns
+// false if the connection is being closed instead.
+//
+// With the reactor this runs on the one thread that serves every
+// connection, so it must not sleep.  Instead it stops reading from the
+// connection and returns false; NextRingWords wakes the reactor when it
+// makes room, and the reactor then calls dataCallback again.
+bool PtermHostConnection::WaitForSpace (void)
+{
+#if defined(DT_REACTOR)
+    m_spaceWait.store (true);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (!IsFull ())
+    {
+        m_spaceWait.store (false);
+        return true;
+    }
+    dtReadHold (m_fet);
+    wxWakeUpIdle ();
+    return false;
+#else
+    for (;;)
+    {
+        // Set the flag before looking, so a word taken in between
+        // still posts the semaphore.  The fence keeps the flag store
+        // ahead of the ring index load; NextRingWords does the same
+        // in the other direction.
+        m_spaceWait.store (true);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        if (!IsFull ())
         {
             break;
         }
+        if (m_closing.load ())
+        {
+            return false;
+        }
+        // Make sure the main thread starts the decode thread on it.
+        wxWakeUpIdle ();
+        m_spaceSem.Wait ();
     }
-    if (conntries == addrcount)
+    m_spaceWait.store (false);
+    return true;
+#endif
+}
+
+void PtermHostConnection::endGsw (void)
+{
+    // Turn GSW off
+    m_savedGswMode = m_gswWord2 = 0;
+    if (m_gswActive)
     {
-        // We ran out of addresses
-        StoreWord (C_CONNFAIL2);
+        m_gswActive = m_gswStarted = false;
+        ptermCloseGsw ();
+        m_owner->m_gswFile = wxString ();
+    }
+}
+
+void PtermHostConnection::dataCallback (void)
+{
+    u32 platowd = 0;
+    int n, max;
+    bool abort;
+
+    for (;;)
+    {
+        //printf ("ringcount: %d\n", RingCount ());
+        /*
+        **  Assemble words from the network buffer, all the
+        **  while looking for "abort output" codes (word == 2).
+        */
+
+        // Possible race condition: a connection may become alive and
+        // data appear on it before m_fet is set from the return value
+        // of the dtConnect call.  Connect signals when it has set it.
+        if (m_fet == NULL)
+        {
+            wxMutexLocker lock (m_fetLock);
+            while (m_fet == NULL)
+            {
+                m_fetReady.Wait ();
+            }
+        }
+
+        if (m_connMode != both)
+        {
+            // Take no more words from the network buffer than the
+            // ring has room for, so StoreWords doesn't have to wait.
+            if (!WaitForSpace ())
+            {
+                break;
+            }
+            max = DataRoom ();
+            if (max > NetBatch)
+            {
+                max = NetBatch;
+            }
+            if (m_connMode == niu)
+            {
+                n = AssembleNiuWords (m_netWords, max, abort);
+            }
+            else
+            {
+                n = AssembleAsciiWords (m_netWords, max);
+                abort = false;
+            }
+            if (n == C_DISCONNECT)
+            {
+                endGsw ();
+                StoreWord (C_DISCONNECT);
+                break;
+            }
+            if (abort)
+            {
+                endGsw ();
+                
+                // erase abort marker -- reset the ring to be empty
+                m_displayFlush.store (m_displayIn.load (std::memory_order_relaxed),
+                                      std::memory_order_release);
+            }
+            if (n == 0 || !StoreWords (m_netWords, n))
+            {
+                break;
+            }
+            debug ("Stored %d words, ring count is %d", n, RingCount ());
+            continue;
+        }
+        
+        // Don't take anything more from the network buffer until
+        // there is room to store it.
+        if (!WaitForSpace ())
+        {
+            break;
+        }
+            
+        platowd = AssembleAutoWord ();
+        if (platowd == C_NODATA)
+        {
+            if (m_connMode != both)
+            {
+                // We just found out what kind of connection this is.
+                continue;
+            }
+            
+            // No more data right now
+            break;
+        }
+        else if (platowd == C_DISCONNECT ||
+                 platowd == C_CONNFAIL1 || platowd == C_CONNFAIL2)
+        {
+            endGsw ();
+            StoreWord (platowd);
+            break;
+        }
+        
+        StoreWord (platowd);
+        debug ("Stored %07o, ring count is %d", platowd, RingCount ());
+        CheckRingLevel ();
     }
-    if (addresses != NULL)
+    if (!IsEmpty ())
     {
-        delete [] addresses;
+        // Send a do-nothing event to the frame; that will wake up
+        // the main thread and cause it to have the decode thread
+        // process the words we buffered.
+        wxWakeUpIdle ();
     }
 }
 
-void PtermHostConnection::s_dataCallback (NetFet *, int, void *arg)
+// Act on the display ring fill level after storing words: start the
+// GSW once it has some data queued, and send XOFF when the count goes
+// up past each threshold.  The decode thread may be emptying the ring at
+// the same time, and words may be stored in bulk, so the count can
+// move by more than one between calls.
+void PtermHostConnection::CheckRingLevel (void)
 {
-    PtermHostConnection *self = (PtermHostConnection *) arg;
-    
-    tracex ("Data callback on %p", self);
-    self->dataCallback ();
-}
+    int i;
 
-void PtermHostConnection::endGsw (void)
-{
-    // Turn GSW off
-    m_savedGswMode = m_gswWord2 = 0;
-    if (m_gswActive)
+    i = RingCount ();
+    if (m_gswActive && !m_gswStarted && i >= GSWRINGSIZE / 2)
     {
-        m_gswActive = m_gswStarted = false;
-        ptermCloseGsw ();
-        m_owner->m_gswFile = wxString ();
+        ptermStartGsw ();
+        m_gswStarted = true;
+    }
+            
+    if (m_lastCount < RINGXOFF1 && i >= RINGXOFF1)
+    {
+        m_owner->ptermSendKey1 (xofkey);
+    }
+    if (m_lastCount < RINGXOFF2 && i >= RINGXOFF2)
+    {
+        m_owner->ptermSendKey1 (xofkey);
     }
+    m_lastCount = i;
 }
 
-void PtermHostConnection::dataCallback (void)
+// Decode classic (NIU) frames from a span of bytes.  A frame is three
+// bytes tagged 0xxxxxxx 10xxxxxx 11xxxxxx, and carries a 19-bit word.
+// Words go into buf starting at index *np, up to max.  An abort output
+// word (2) discards the words before it, which the ring reset would
+// throw away anyway, and sets abort.  Bytes that don't fit the framing
+// are skipped and counted in *errs; a tag error in the second or third
+// byte resyncs on that byte if it could start a frame, the way the
+// NIU does.  Returns the number of bytes used, which is short of len
+// only by an incomplete frame at the end.
+static int niuDecode (const u8 *p, int len, u32 *buf, int *np, int max,
+                      u32 *errs, bool &abort)
 {
-    u32 platowd = 0;
+    // Tag bit masks and values for eight frames (24 bytes), so the
+    // framing of a whole run can be checked with three 64-bit compares.
+    static const u8 tagMask[24] = 
+        { 0200, 0300, 0300, 0200, 0300, 0300, 0200, 0300,
+          0300, 0200, 0300, 0300, 0200, 0300, 0300, 0200,
+          0300, 0300, 0200, 0300, 0300, 0200, 0300, 0300 };
+    static const u8 tagBits[24] = 
+        { 0000, 0200, 0300, 0000, 0200, 0300, 0000, 0200,
+          0300, 0000, 0200, 0300, 0000, 0200, 0300, 0000,
+          0200, 0300, 0000, 0200, 0300, 0000, 0200, 0300 };
+    u64 m[3], t[3], x[3];
+    int pos = 0, n = *np;
     int i;
+    u32 w;
 
-    for (;;)
+    memcpy (m, tagMask, sizeof (m));
+    memcpy (t, tagBits, sizeof (t));
+    while (n < max && len - pos >= 3)
     {
-        //printf ("ringcount: %d\n", RingCount ());
-        /*
-        **  Assemble words from the network buffer, all the
-        **  while looking for "abort output" codes (word == 2).
-        */
-        if (IsFull ())
+        if (len - pos >= 24 && max - n >= 8)
         {
-            printf ("ring is full\n");
+            memcpy (x, p + pos, sizeof (x));
+            if (((x[0] & m[0]) ^ t[0]) == 0 &&
+                ((x[1] & m[1]) ^ t[1]) == 0 &&
+                ((x[2] & m[2]) ^ t[2]) == 0)
+            {
+                for (i = 0; i < 8; i++)
+                {
+                    w = (p[pos] << 12) | ((p[pos + 1] & 077) << 6) |
+                        (p[pos + 2] & 077);
+                    pos += 3;
+                    if (w == 2)
+                    {
+                        n = 0;
+                        abort = true;
+                    }
+                    buf[n++] = w;
+                }
+                continue;
+            }
         }
 
-        // Possible race condition: a connection may become alive and
-        // data appear on it before m_fet is set from the return value
-        // of the dtConnect call.
-        if (m_fet == NULL)
+        // Not a clean run, go a frame at a time.
+        if (p[pos] & 0200)
         {
-#if defined (_WIN32)
-            Sleep (1000);
-#else
-            sleep (1);
-#endif
+            (*errs)++;
+            pos++;
             continue;
         }
-            
-        switch (m_connMode)
-        {
-        case niu:
-            platowd = AssembleNiuWord ();
-            break;
-        case ascii:
-            platowd = AssembleAsciiWord ();
-            break;
-        case both:
-            platowd = AssembleAutoWord ();
-            break;
-        }
-            
-        if (platowd == C_NODATA)
+        if ((p[pos + 1] & 0300) != 0200)
         {
-            // No more data right now
-            break;
+            (*errs)++;
+            pos += (p[pos + 1] & 0200) ? 2 : 1;
+            continue;
         }
-        else if (m_connMode == niu && platowd == 2)
+        if ((p[pos + 2] & 0300) != 0300)
         {
-            endGsw ();
-                
-            // erase abort marker -- reset the ring to be empty
-            wxCriticalSectionLocker lock (m_pointerLock);
-
-            m_displayOut = m_displayIn;
+            (*errs)++;
+            pos += (p[pos + 2] & 0200) ? 3 : 2;
+            continue;
         }
-        else if (platowd == C_DISCONNECT ||
-                 platowd == C_CONNFAIL1 || platowd == C_CONNFAIL2)
+        w = (p[pos] << 12) | ((p[pos + 1] & 077) << 6) | (p[pos + 2] & 077);
+        pos += 3;
+        if (w == 2)
         {
-            endGsw ();
-            StoreWord (platowd);
-            break;
+            n = 0;
+            abort = true;
         }
-        
-        StoreWord (platowd);
-        i = RingCount ();
-        debug ("Stored %07o, ring count is %d", platowd, i);
+        buf[n++] = w;
+    }
+
+    *np = n;
+    return pos;
+}
 
+// Assemble up to "max" words from the network buffer, decoding the
+// data in place.  Returns the number of words, or C_DISCONNECT if the
+// connection has gone away.  "abort" is set if an abort output word
+// was seen; it is then the first word in buf.
+int PtermHostConnection::AssembleNiuWords (u32 *buf, int max, bool &abort)
+{
+    const u8 *p;
+    u8 frame[3];
+    int span, used, n = 0;
+    u32 errs = 0;
 
-        if (m_gswActive && !m_gswStarted && i >= GSWRINGSIZE / 2)
+    abort = false;
+    while (n < max)
+    {
+        span = dtReadSpan (m_fet, &p);
+        if (span < 3)
         {
-            ptermStartGsw ();
-            m_gswStarted = true;
-        }
+            if (dtFetData (m_fet) < 3)
+            {
+                break;
+            }
             
-        if (i == RINGXOFF1 || i == RINGXOFF2)
-        {
-            m_owner->ptermSendKey1 (xofkey);
+            // The next frame wraps around the end of the ring.
+            dtPeekw (m_fet, frame, 3);
+            p = frame;
+            span = 3;
         }
+        used = niuDecode (p, span, buf, &n, max, &errs, abort);
+        dtReadSkip (m_fet, used);
     }
-    if (!IsEmpty ())
+    
+    if (errs != 0)
     {
-        // Send a do-nothing event to the frame; that will wake up
-        // the main thread and cause it to process the words we 
-        // buffered.
-        wxWakeUpIdle ();
+        m_niuSyncErrors += errs;
+        tracex ("Plato output out of sync, %d bytes skipped (%d total)",
+                errs, m_niuSyncErrors);
+    }
+    if (n == 0 && !dtConnected (m_fet))
+    {
+        m_connActive = false;
+        dtClose (m_fet, TRUE);
+        m_fet = NULL;
+        return C_DISCONNECT;
     }
+    
+    return n;
 }
 
-int PtermHostConnection::AssembleNiuWord (void)
+// Store a batch of words in the display ring, waiting for room as
+// needed.  Returns false if the connection is closed while waiting.
+// (With the reactor it can't wait, so the caller must not pass more
+// than DataRoom words.)
+bool PtermHostConnection::StoreWords (const u32 *buf, int n)
 {
-    int i, j, k;
-    
-    for (;;)
+    int in, room, chunk;
+
+    if (m_capture.Active ())
+    {
+        m_capture.Words (buf, n);
+    }
+    while (n > 0)
     {
-        if (dtFetData (m_fet) < 3)
+        if (!WaitForSpace ())
         {
-            if (dtConnected (m_fet))
-            {
-                return C_NODATA;
-            }
-            m_connActive = false;
-            dtClose (m_fet, TRUE);
-            m_fet = NULL;
-            return C_DISCONNECT;
+            return false;
         }
-        i = dtReado (m_fet);
-        if (i & 0200)
+        in = m_displayIn.load (std::memory_order_relaxed);
+        room = RINGSIZE - 2 -
+            ringDistance (m_displayOut.load (std::memory_order_acquire), in);
+        chunk = RINGSIZE - in;
+        if (chunk > room)
         {
-            printf ("Plato output out of sync byte 0: %03o\n", i);
-            continue;
+            chunk = room;
         }
-newj:
-        j = dtReado (m_fet);
-        if ((j & 0300) != 0200)
+        if (chunk > n)
         {
-            printf ("Plato output out of sync byte 1: %03o\n", j);
-            if ((j & 0200) == 0)
-            {
-                i = j;
-                goto newj;
-            }
-            continue;
+            chunk = n;
         }
-        k = dtReado (m_fet);
-        if ((k & 0300) != 0300)
+        memcpy (&m_displayRing[in], buf, chunk * sizeof (u32));
+        in += chunk;
+        if (in == RINGSIZE)
         {
-            printf ("Plato output out of sync byte 2: %03o\n", k);
-            if ((k & 0200) == 0)
-            {
-                i = k;
-                goto newj;
-            }
-            continue;
+            in = 0;
         }
-        return (i << 12) | ((j & 077) << 6) | (k & 077);
+        m_displayIn.store (in, std::memory_order_release);
+        buf += chunk;
+        n -= chunk;
+        CheckRingLevel ();
     }
+
+    return true;
 }
 
 int PtermHostConnection::AssembleAutoWord (void)
@@ -410,108 +1287,289 @@ int PtermHostConnection::AssembleAutoWord (void)
     {
         m_connMode = niu;
         m_owner->menuFile->Enable (Pterm_SaveAudio, true);
-        return AssembleNiuWord ();
+        if (m_capture.Active ())
+        {
+            m_capture.Mode (m_connMode);
+        }
+
+        // The data callback takes it from here, in bulk.
+        return C_NODATA;
     }
     else
     {
         m_connMode = ascii;
-        return AssembleAsciiWord ();
+        if (m_capture.Active ())
+        {
+            m_capture.Mode (m_connMode);
+        }
+
+        // The data callback takes it from here, in bulk.
+        return C_NODATA;
     }
 }
 
-int PtermHostConnection::AssembleAsciiWord (void)
+// Byte classes for the ASCII protocol tokenizer.  Only the last four
+// need anything other than stripping the parity bit.
+enum { AscPlain, AscEsc, AscIac, AscNul };
+
+static u8 ascClass[256];
+
+static void initAscClass (void)
 {
     int i;
-    
-    for (;;)
+
+    for (i = 0; i < 256; i++)
     {
-        i = dtReado (m_fet);
-        if (i == -1)
+        switch (i & 0177)
         {
-            if (dtConnected (m_fet))
-            {
-                return C_NODATA;
-            }
-            m_connActive = false;
-            dtClose (m_fet, TRUE);
-            m_fet = NULL;
-            return C_DISCONNECT;
-        }
-        else if (m_pending == 0 && i == 0377)
-        {
-            // 0377 is used by Telnet to introduce commands (IAC).
-            // We recognize only IAC IAC for now.
-            // Note that the check has to be made before the sign
-            // bit is stripped off.
-            m_pending = 0377;
-            continue;
+        case 033:
+            ascClass[i] = AscEsc;
+            break;
+        case 0:
+            ascClass[i] = AscNul;
+            break;
+        default:
+            ascClass[i] = AscPlain;
         }
+    }
+    ascClass[0377] = AscIac;
+}
 
-        i &= 0177;
-        if (i == 033)
-        {
-            m_pending = 033;
-            continue;
-        }
-        if (m_pending == 033)
+// Assemble up to "max" words from the network buffer for an ASCII
+// connection, decoding the data in place.  Returns the number of
+// words, or C_DISCONNECT if the connection has gone away.
+//
+// The bytes become words as follows: ESC x is a word (033 << 8) + x,
+// NUL is a -delay- word, and everything else is the byte with the
+// parity bit stripped.  0377 is used by Telnet to introduce commands
+// (IAC); we recognize only IAC IAC for now, and treat IAC x as x (so
+// the check has to be made before the parity bit is stripped).  The
+// pending ESC or IAC is kept in m_pending, since it may be the last
+// byte received so far.
+int PtermHostConnection::AssembleAsciiWords (u32 *buf, int max)
+{
+    const u8 *p;
+    int span, pos, n = 0;
+    int c;
+
+    if (ascClass[033] != AscEsc)
+    {
+        initAscClass ();
+    }
+    
+    while (n < max)
+    {
+        span = dtReadSpan (m_fet, &p);
+        if (span == 0)
         {
-            m_pending = 0;
-            return (033 << 8) + i;
+            break;
         }
-        else
+        pos = 0;
+        while (pos < span && n < max)
         {
-            m_pending = 0;
-            if (i == 0)
+            c = p[pos++];
+            if (m_pending == 0)
+            {
+                // Common case: copy a run of ordinary characters.
+                while (ascClass[c] == AscPlain)
+                {
+                    buf[n++] = c & 0177;
+                    if (pos == span || n == max)
+                    {
+                        break;
+                    }
+                    c = p[pos++];
+                }
+                if (ascClass[c] == AscPlain)
+                {
+                    break;
+                }
+                
+                switch (ascClass[c])
+                {
+                case AscEsc:
+                    m_pending = 033;
+                    break;
+                case AscIac:
+                    m_pending = 0377;
+                    break;
+                case AscNul:
+                    buf[n++] = 1 << 19;
+                    break;
+                }
+            }
+            else if (ascClass[c] == AscEsc)
+            {
+                // ESC ESC is the same as just one; after IAC it
+                // starts an escape sequence.
+                m_pending = 033;
+            }
+            else if (m_pending == 033)
             {
-                // NUL is for -delay-
-                i = 1 << 19;
+                m_pending = 0;
+                buf[n++] = (033 << 8) + (c & 0177);
+            }
+            else
+            {
+                m_pending = 0;
+                c &= 0177;
+                buf[n++] = (c == 0) ? 1 << 19 : c;
             }
-            return i;
         }
+        dtReadSkip (m_fet, pos);
+    }
+    
+    if (n == 0 && !dtConnected (m_fet))
+    {
+        m_connActive = false;
+        dtClose (m_fet, TRUE);
+        m_fet = NULL;
+        return C_DISCONNECT;
     }
+    
+    return n;
 }
 
-
 int PtermHostConnection::NextRingWord (void)
 {
-    int word, next, i;
+    int word;
 
+    if (NextRingWords (&word, 1, false) == 0)
     {
-        wxCriticalSectionLocker lock (m_pointerLock);
-        
-        if (m_displayIn == m_displayOut)
+        return C_NODATA;
+    }
+    return word;
+}
+
+// Take up to "max" words from the display ring, in one step.  If
+// "extout" is set, stop after any -extout- word, because that may turn
+// on the GSW emulation, and then the rest of the data has to go through
+// the GSW ring instead.  Returns the number of words taken; if "first"
+// is given, the ring index of the first one is stored there.
+int PtermHostConnection::NextRingWords (int *buf, int max, bool extout,
+                                        int *first)
+{
+    int in, out, start, flush, before, after, n, i;
+
+    out = start = m_displayOut.load (std::memory_order_relaxed);
+    flush = m_displayFlush.load (std::memory_order_acquire);
+    in = m_displayIn.load (std::memory_order_acquire);
+
+    if (flush != -1)
+    {
+        // Skip to the reset point, unless we're already past it (we
+        // may have taken words stored after it before seeing it).
+        if (ringDistance (out, flush) <= ringDistance (out, in))
         {
-            return C_NODATA;
+            out = flush;
         }
+        m_displayFlush.compare_exchange_strong (flush, -1);
+    }
+    if (first != NULL)
+    {
+        *first = out;
+    }
     
-        i = RingCount ();
-        word = m_displayRing[m_displayOut];
-        next = m_displayOut + 1;
-        if (next == RINGSIZE)
+    before = ringDistance (out, in);
+    n = (before < max) ? before : max;
+    for (i = 0; i < n; i++)
+    {
+        buf[i] = m_displayRing[out];
+        if (++out == RINGSIZE)
         {
-            next = 0;
+            out = 0;
+        }
+        if (extout && (buf[i] >> 16) == 3)
+        {
+            n = i + 1;
+            break;
         }
-        m_displayOut = next;
     }
-    debug ("consumed word %07o, ring count now %d", word, i);
-    if (i < RINGXOFF1 && m_owner->m_pendingEcho != -1)
+    m_displayOut.store (out, std::memory_order_release);
+    after = before - n;
+
+    // Wake the network thread if it was waiting for ring space.
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (out != start && m_spaceWait.exchange (false))
+    {
+#if defined(DT_REACTOR)
+        dtReactorWake ();
+#else
+        m_spaceSem.Post ();
+#endif
+    }
+    
+    debug ("consumed %d words, ring count now %d", n, after);
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (after < RINGXOFF1 && m_owner->m_pendingEcho != -1)
     {
         m_owner->ptermSendKey1 (m_owner->m_pendingEcho);
         m_owner->m_pendingEcho = -1;
     }
-    if (i == RINGXON1 || i == RINGXON2)
+
+    // Send XON when the count goes down past each threshold.
+    if (before >= RINGXON1 && after < RINGXON1)
+    {
+        m_owner->ptermSendKey1 (xonkey);
+    }
+    if (before >= RINGXON2 && after < RINGXON2)
     {
         m_owner->ptermSendKey1 (xonkey);
     }
 
-    return word;
+    return n;
+}
+
+// Get up to "max" words for the display.  Without GSW emulation, this
+// takes a batch of words from the display ring at once.
+int PtermHostConnection::NextWords (int *buf, int max)
+{
+    int n, i;
+    
+    if (m_gswActive)
+    {
+        m_batchStart = -1;
+        return PtermConnection::NextWords (buf, max);
+    }
+    
+    n = NextRingWords (buf, max,
+                       !Ascii () && m_owner->m_profile->m_gswEnable,
+                       &m_batchStart);
+    for (i = 0; i < n; i++)
+    {
+        buf[i] = CookWord (buf[i]);
+    }
+
+    return n;
+}
+
+// A reset of the ring asked for after the last batch was taken means
+// the words of the batch before the reset point are thrown away.  The
+// reset point can't be ahead of the batch start: NextRingWords would
+// have skipped to it.
+int PtermHostConnection::LiveWord (int index, int count)
+{
+    const int flush = m_displayFlush.load (std::memory_order_acquire);
+    int live;
+
+    if (flush == -1 || m_batchStart == -1)
+    {
+        return index;
+    }
+    live = ringDistance (m_batchStart, flush);
+    if (live > count)
+    {
+        live = count;
+    }
+    return (live > index) ? live : index;
 }
 
 int PtermHostConnection::NextWord (void)
 {
     int next, word;
-    int delay = 0;
-    wxString msg;
 
     if (m_gswActive)
     {
@@ -546,7 +1604,16 @@ int PtermHostConnection::NextWord (void)
     }
 
     // Take data from the main input ring
-    word = NextRingWord ();
+    return CookWord (NextRingWord ());
+}
+
+// Finish processing a word taken from the display ring: check for
+// -extout- words that start the GSW emulation, add the delay flag, and
+// handle connection status codes.
+int PtermHostConnection::CookWord (int word)
+{
+    int delay = 0;
+    wxString msg;
 
     if (!Ascii () && 
         (word >> 16) == 3 &&
@@ -608,11 +1675,7 @@ int PtermHostConnection::NextWord (void)
     // GUI actions belong in the GUI (main) thread.
     if (word == C_CONNECTING)
     {
-        msg.Printf (_("Connecting to %d.%d.%d.%d"), 
-                    (m_hostAddr >> 24) & 0xff,
-                    (m_hostAddr >> 16) & 0xff,
-                    (m_hostAddr >>  8) & 0xff,
-                    m_hostAddr & 0xff);
+        msg.Printf (_("Connecting to %s"), m_hostName.c_str ());
         m_owner->ptermSetStatus (msg);
     }
     else if (word == C_CONNECTED)
@@ -685,44 +1748,148 @@ int ptermNextGswWord (void *connection, int idle)
     return ((PtermHostConnection *) connection)->NextGswWord (idle != 0);
 }
 
+// Number of words in the ring.  A pending reset counts as having
+// emptied it up to the reset point.
+// The address we are connected to, once the connect thread has found
+// one that answers.
+wxString PtermHostConnection::HostAddr (void)
+{
+    wxMutexLocker lock (m_fetLock);
+    
+    return wxString::FromAscii (m_hostAddr);
+}
+
 int PtermHostConnection::RingCount (void) const
 {
-    if (m_displayIn >= m_displayOut)
-    {
-        return m_displayIn - m_displayOut;
-    }
-    else
+    const int flush = m_displayFlush.load (std::memory_order_acquire);
+    const int in = m_displayIn.load (std::memory_order_acquire);
+    int out = m_displayOut.load (std::memory_order_acquire);
+
+    if (flush != -1 && ringDistance (out, flush) <= ringDistance (out, in))
     {
-        return RINGSIZE + m_displayIn - m_displayOut;
+        out = flush;
     }
+    return ringDistance (out, in);
 }
 
+// Add a word to the ring; this is only done by the network thread.
+// Connection status codes (negative values) discard any words not yet
+// taken.  They can use the slot that is kept free of data, so they are
+// stored even if the ring is full of data.
 void PtermHostConnection::StoreWord (int word)
 {
-    int next;
+    int in, next;
     
+    in = m_displayIn.load (std::memory_order_relaxed);
     if (word < 0)
     {
-        m_displayOut = m_displayIn;
+        m_displayFlush.store (in, std::memory_order_release);
     }
-    next = m_displayIn + 1;
+    else if (IsFull ())
+    {
+        return;
+    }
+    next = in + 1;
     if (next == RINGSIZE)
     {
         next = 0;
     }
-    if (next == m_displayOut)
+    if (next == m_displayOut.load (std::memory_order_acquire))
     {
         return;
     }
-    m_displayRing[m_displayIn] = word;
-    m_displayIn = next;
+    if (word >= 0 && m_capture.Active ())
+    {
+        u32 w = word;
+
+        m_capture.Words (&w, 1);
+    }
+    m_displayRing[in] = word;
+    m_displayIn.store (next, std::memory_order_release);
     
     debug ("data from plato %07o", word);
 }
 
+// Queue data to send to the host.  Keys are gathered up while events
+// are being handled, and sent in one piece when the frame goes idle
+// (see PtermFrame::OnIdle).  For interactive typing that is right after
+// the key event, but a paste burst or a macro goes out as one send
+// rather than one per key.  Echoes and replies from the decode thread
+// are queued the same way, so they stay in order with the keys.  XON
+// and XOFF sent from the network thread go out directly.
 void PtermHostConnection::SendData (const void *data, int len)
 {
-    dtSend (m_fet, data, len);
+    if (m_capture.Active ())
+    {
+        m_capture.Keys (data, len);
+    }
+    if (!wxThread::IsMain () && !m_owner->DecodeThread ())
+    {
+        dtSend (m_fet, data, len);
+        return;
+    }
+    
+    if (m_sendLen + len > SendBatch)
+    {
+        FlushData ();
+        if (m_sendLen + len > SendBatch)
+        {
+            // Transmit ring is full as well; drop it, as dtSend would.
+            return;
+        }
+    }
+    if (m_sendLen == 0)
+    {
+        // Make sure there will be an idle event to send this.
+        wxWakeUpIdle ();
+    }
+    memcpy (m_sendBuf + m_sendLen, data, len);
+    m_sendLen += len;
+}
+
+// Start or stop the binary capture of this session.  It goes to a
+// file named like the trace file, with a .ptc extension; see
+// PtermReplayConnection for playing it back.
+void PtermHostConnection::SetCapture (bool on)
+{
+    if (!on)
+    {
+        m_capture.Close ();
+    }
+    else if (m_capture.Open (ptermApp->captureFn) && m_connMode != both)
+    {
+        m_capture.Mode (m_connMode);
+    }
+}
+
+// Send the data queued by SendData, as much of it as the transmit ring
+// has room for.  Returns true if some is left to send.
+bool PtermHostConnection::FlushData (void)
+{
+    int len;
+    
+    if (m_sendLen == 0)
+    {
+        return false;
+    }
+    if (!dtConnected (m_fet))
+    {
+        m_sendLen = 0;
+        return false;
+    }
+    
+    len = dtSendFree (m_fet);
+    if (len > m_sendLen)
+    {
+        len = m_sendLen;
+    }
+    if (len > 0 && dtSend (m_fet, m_sendBuf, len) <= 0)
+    {
+        m_sendLen -= len;
+        memmove (m_sendBuf, m_sendBuf + len, m_sendLen);
+    }
+
+    return (m_sendLen != 0);
 }
 
 
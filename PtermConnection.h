@@ -11,6 +11,8 @@
 #define __PTermConnection_H__ 1
 
 #include "CommonHeader.h"
+#include "PtermCapture.h"
+#include <atomic>
 
 class PtermFrame;
 
@@ -31,10 +33,14 @@ public:
 
     virtual ConnType_e ConnType (void) const = 0;
     virtual int NextWord (void) = 0;
+    virtual int NextWords (int *buf, int max);
+    virtual int LiveWord (int index, int count);
     virtual void SendData (const void *data, int len);
+    virtual bool FlushData (void);
 
     void SetOwner (PtermFrame *owner) { m_owner = owner; }
     virtual int RingCount (void) const;
+    virtual wxString HostAddr (void);
     bool Ascii (void) const
     {
         return (m_connMode == ascii);
@@ -49,6 +55,8 @@ public:
     }
     virtual void StoreWord (int word);
     virtual void Connect (void);
+    virtual void SetCapture (bool on);
+    virtual bool Step (int dir);
 
     bool        m_connActive;
 
@@ -64,6 +72,20 @@ class PtermLocalConnection : public PtermConnection
     int NextWord (void);
 };
 
+// One line of interest in a trace file, see PtermTestConnection.
+struct TraceEntry
+{
+    u32     word;           // word from the host, or key code
+    u32     seq;            // sequence number
+    u8      kind;           // TraceWord, TraceKey or TraceAscii
+};
+
+enum { TraceWord, TraceKey, TraceAscii };
+
+// Playback of a trace (.trc) file.  The file is parsed once, when it
+// is opened, into an array of TraceEntry; after that any point in it
+// can be reached directly.  Step moves between the keys typed in the
+// traced session.
 class PtermTestConnection : public PtermConnection
 {
 public:
@@ -71,9 +93,63 @@ public:
     ~PtermTestConnection ();
     ConnType_e ConnType (void) const { return TEST; }
     
-    FILE *m_testdata;
-    u32 m_pseq;
     int NextWord (void);
+    int NextWords (int *buf, int max);
+    bool Step (int dir);
+
+private:
+    void Load (FILE *testdata);
+
+    TraceEntry  *m_entries;
+    u32         m_count;
+    u32         m_index;        // next entry to play
+    u32         m_limit;        // stop here (m_count if not stepping)
+    u32         *m_keys;        // indices of the TraceKey entries
+    u32         m_keyCount;
+};
+
+// Playback of a session capture (see PtermCapture).  The words from
+// the host are delivered at the pace they were captured, scaled by
+// the speed factor; speed 0 means as fast as they can be taken.
+class PtermReplayConnection : public PtermConnection
+{
+public:
+    PtermReplayConnection (FILE *capture, double speed);
+    ~PtermReplayConnection ();
+    ConnType_e ConnType (void) const { return TEST; }
+    bool IsOk (void) const
+    {
+        return (m_data != NULL);
+    }
+    
+    int NextWord (void);
+    int NextWords (int *buf, int max);
+    void Connect (void);
+    bool Seek (u64 usec);
+    bool Step (int dir);
+
+private:
+    bool Due (u64 time);
+
+    // Wakes up the frame when the next record is due.
+    class ReplayTimer : public wxTimer
+    {
+    public:
+        void Notify (void) { wxWakeUpIdle (); }
+    };
+
+    u8          *m_data;
+    u32         m_size;
+    u32         m_pos;
+    const u32   *m_recWords;
+    int         m_recLeft;
+    double      m_speed;
+    u64         m_base;
+    u64         m_now;          // time of the last record played
+    u64         m_seekTo;
+    bool        m_seeking;
+    PtermClock  m_clock;
+    ReplayTimer m_timer;
 };
 
 class PtermHostConnection : public PtermConnection
@@ -84,54 +160,138 @@ public:
     ConnType_e ConnType (void) const { return HOST; }
     
     int NextWord (void);
+    int NextWords (int *buf, int max);
+    int LiveWord (int index, int count);
     
     void SendData (const void *data, int len);
+    bool FlushData (void);
     void StoreWord (int word);
     void Connect (void);
+    void SetCapture (bool on);
     int RingCount (void) const;
+    wxString HostAddr (void);
 
     int NextGswWord (bool idle);
     
 private:
     NetPortSet  m_portset;
     NetFet      *m_fet;
+
+    // The network thread can be called with data before Connect has
+    // stored the dtConnect return value in m_fet; it waits on
+    // m_fetReady for that.
+    wxMutex     m_fetLock;
+    wxCondition m_fetReady;
+
+    // The display ring is filled by the network thread and emptied by
+    // the decode thread (or the GSW sound thread while GSW emulation is
+    // active, never both at once), so it needs no lock.  Each side owns
+    // one index, which it publishes with a release store; the other
+    // side reads it with an acquire load.  The two are on separate
+    // cache lines so the threads don't fight over one line.  A reset
+    // of the ring (abort output, or a connection status code) is asked
+    // for by the producer setting m_displayFlush to its m_displayIn;
+    // the consumer then skips up to that point.  m_lastCount is the
+    // ring count as of the producer's previous store, used to spot
+    // XOFF threshold crossings.
+    //
+    // The last free slot is kept for a connection status code, so one
+    // can always be stored (see IsFull).  m_batchStart is the ring index
+    // of the first word of the last batch taken by NextWords, or -1 if
+    // it didn't come from the ring; see LiveWord.
+    //
+    // If the ring fills up, the producer sets m_spaceWait and sleeps on
+    // m_spaceSem rather than dropping words; the consumer posts it when
+    // it takes words out.  (With the reactor the producer puts the
+    // connection on hold instead, and the consumer wakes the reactor.)
+    // Meanwhile the network data stays in the socket receive buffer,
+    // so the host sees TCP flow control.
     u32         m_displayRing[RINGSIZE];
-    volatile int m_displayIn, m_displayOut;
+    char        m_pad0[64];
+    std::atomic<int> m_displayIn;
+    std::atomic<int> m_displayFlush;
+    int         m_lastCount;
+    char        m_pad1[64];
+    std::atomic<int> m_displayOut;
+    int         m_batchStart;
+    char        m_pad2[64];
+    std::atomic<bool> m_spaceWait;
+    std::atomic<bool> m_closing;
+    wxSemaphore m_spaceSem;
+
     u32         m_gswRing[GSWRINGSIZE];
     volatile int m_gswIn, m_gswOut;
     wxString    m_hostName;
     int         m_port;
-    wxCriticalSection m_pointerLock;
     bool        m_gswStarted;
     int         m_savedGswMode;
     int         m_gswWord2;
     int         m_pending;
-    in_addr_t   m_hostAddr;
+
+    // Connect hands the name lookup and connection setup to a thread
+    // of its own, so a slow resolver or a dead address doesn't stall
+    // the GUI.  m_hostAddr is the address that answered, for the status
+    // line; it is set under m_fetLock, see HostAddr.  m_connectCancel
+    // tells the thread to give up.
+    char        m_hostAddr[64];
+    pthread_t   m_connThread;
+    bool        m_connStarted;
+    volatile int m_connectCancel;
+
+    // Network data is decoded a batch of words at a time.  Classic
+    // (NIU) bytes that don't fit the framing are skipped and counted
+    // in m_niuSyncErrors.
+#define NetBatch    256
+    u32         m_netWords[NetBatch];
+    u32         m_niuSyncErrors;
+
+    // Data to send, gathered up by SendData until FlushData.
+#define SendBatch   512
+    char        m_sendBuf[SendBatch];
+    int         m_sendLen;
+
+    // Binary capture of the session, if enabled (see SetCapture).
+    PtermCapture m_capture;
     
+    static dtThreadFun (s_connectThread, arg);
+    void connectThread (void);
+
     // Callback handler
     static void s_dataCallback (NetFet *np, int bytes, void *arg);
     void dataCallback (void);
     void endGsw (void);
+    bool WaitForSpace (void);
+    bool StoreWords (const u32 *buf, int n);
+    void CheckRingLevel (void);
     
-    int AssembleNiuWord (void);
-    int AssembleAsciiWord (void);
+    int AssembleNiuWords (u32 *buf, int max, bool &abort);
+    int AssembleAsciiWords (u32 *buf, int max);
     int AssembleAutoWord (void);
     int NextRingWord (void);
+    int NextRingWords (int *buf, int max, bool extout, int *first = NULL);
+    int CookWord (int word);
 
     bool IsEmpty (void) const
     {
-        return (m_displayIn == m_displayOut);
+        return (m_displayIn.load (std::memory_order_acquire) ==
+                m_displayOut.load (std::memory_order_acquire));
     }
-    bool IsFull (void) const
+    // Room for data words; one slot is kept free for a status code.
+    int DataRoom (void) const
     {
-        volatile int next;
+        int n;
     
-        next = m_displayIn + 1;
-        if (next == RINGSIZE)
+        n = m_displayIn.load (std::memory_order_relaxed) -
+            m_displayOut.load (std::memory_order_acquire);
+        if (n < 0)
         {
-            next = 0;
+            n += RINGSIZE;
         }
-        return (next == m_displayOut);
+        return RINGSIZE - 2 - n;
+    }
+    bool IsFull (void) const
+    {
+        return (DataRoom () <= 0);
     }
 };
 
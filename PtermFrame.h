@@ -121,6 +121,9 @@ public:
                PtermConnection *conn, bool helpframe = false);
     ~PtermFrame();
 
+    // Events are handled with the decode thread stopped; see DecodeHold.
+    virtual bool ProcessEvent(wxEvent& event);
+
     // event handlers (these functions should _not_ be virtual)
     void OnIdle(wxIdleEvent& event);
     void OnClose(wxCloseEvent& event);
@@ -129,6 +132,7 @@ public:
     void OnDclock(wxTimerEvent& event);
     void OnMz80(wxTimerEvent& event);
     void OnPasteTimer(wxTimerEvent& event);
+    void OnPresentTimer(wxTimerEvent& event);
     void OnShellTimer(wxTimerEvent& event);
     void OnConnectAgain(wxCommandEvent& event);
     void OnQuit(wxCommandEvent& event);
@@ -179,6 +183,7 @@ public:
 #endif
 
     void Mz80Waiter(int msec);
+    void Mz80Cancel(void);
     void BootMtutor(void);
     void BuildMenuBar(void);
     void BuildFileMenu(void);
@@ -195,6 +200,8 @@ public:
     void ptermSendTouch(int x, int y);
     void ptermSendExt(int key);
     void ptermSetTrace(bool trace);
+    void ptermSetProfile(bool on);
+    void ptermStep(int dir);
     void ProcessPlatoMetaData(void);
     void WriteTraceMessage(wxString);
 #if 0
@@ -223,6 +230,9 @@ public:
     }
     void ptermSetStatus(wxString &str);
     void ptermShowTrace();
+    void ptermSetTouch(bool enable);
+    void ptermBell(bool attention);
+    void ptermStartClocks(void);
     void trace(const wxString &) const;
     void trace(const char *, ...) const;
 
@@ -285,6 +295,8 @@ public:
 
 
     bool procPlatoWord(u32 d, bool ascii);
+    void procAsciiText(const int *words, int n);
+    void drawAsciiChar(u32 d, int deltax);
     PtermCanvas *m_canvas;
     wxBitmap    *m_bitmap;
     void        ptermSetConnected(void);
@@ -339,7 +351,6 @@ private:
     u32         m_maxalpha;
     u32         m_selpixf;
     u32         m_selpixb;
-    wxBitmap    *m_selmap;
     wxBitmap    *m_bitmap2;
     u32         m_red;
     u32         m_green;
@@ -407,7 +418,12 @@ private:
 
 #define key2mtutor ((mt_ksw & 1) == 1)      // direct keys to mtutor/ppt
 
-    i16         mt_key;
+    // Keys for mtutor/ppt, taken by r.input on the z80 thread.
+    // Protected by m_z80Lock.
+#define MtKeyQueue  64
+    int         m_mtKeys[MtKeyQueue];
+    int         m_mtKeyIn;
+    int         m_mtKeyOut;
 
     bool        modexor;
     // 0: inverse
@@ -527,27 +543,50 @@ private:
 
     // PLATO drawing primitives
     void ptermDrawChar(int x, int y, int snum, int cnum, bool autobs = false);
-    void ptermDrawCharInto(int x, int y, const u16 *charp,
+    void ptermDrawCharInto(int x, int y, const u32 *glyph,
                            u32 fpix, u32 bpix, int cmode,
-                           bool xor_p, PixelData &pixmap);
+                           bool xor_p, u32 **rows);
+    void ptermDrawCharSel(int x, int y, const u32 *glyph, bool rewrite);
+    const u32 *ptermGlyph(int snum, int cnum);
     void ptermDrawPoint(int x, int y);
 #ifdef __WXMSW__
     void fixAlpha(void);
 #endif
     inline void ptermUpdatePoint(int x, int y, u32 pixval, bool xor_p,
-        PixelData & pixmap);
+        u32 **rows);
     void ptermDrawLine(int x1, int y1, int x2, int y2);
     void ptermFullErase(void);
     void ptermBlockErase(int x1, int y1, int x2, int y2);
     void ptermSetName(wxString &winName);
     void ptermPaint(int pat);
-    void ptermPaintWalker(int x, int y, PixelData & pixmap,
-                          int pat, int pass);
+    void ptermPaintFill(int x, int y, u32 **rows, const u16 *cp);
     void ptermSaveWindow(int d);
     void ptermRestoreWindow(int d);
+    void ptermSetRows(void);
+    void ptermReleaseRaster(void);
+    void ptermReadBack(const wxRect &r);
+    void ptermScrollUp(void);
+    void ptermUnscroll(void);
+    u32 **ptermScreenRows(void)
+    {
+        if (m_fontDC)
+        {
+            ptermReleaseRaster ();
+        }
+        return m_rows;
+    }
+    wxBitmap ptermSelectionBitmap(const wxRect &r);
+    wxRect ptermUpdateScaled(const wxRect &ur);
+    void ptermFreeScaled(void);
+    void ptermUpdateZoomed(const wxRect &ur, int zoom);
+    void ptermDamage(int x1, int y1, int x2, int y2);
+    void ptermDamageAll(void);
+    void ptermRefresh(void);
+    void ptermPresent(void);
 
     void drawFontChar(int x, int y, int c);
-    void procDataLoop(void);
+    bool procDataLoop(void);
+    void ptermConnFailed(int word);
     void plotChar(int c);
     void mode0(u32 d);
     void mode1(u32 d);
@@ -584,34 +623,243 @@ private:
     wxString GetRegionText(bool url = false) const;
 
     cmentry textmap[32 * 64];
+
+    // Text map entry for coarse grid column x, row y (0 = bottom line).
+    // The index wraps, and allows for the lines scrolled in dumb
+    // terminal mode.
+    cmentry &textcell(int x, int y)
+    {
+        return textmap[((y << 6) + x - (m_scrollRows << 2)) & 03777];
+    }
+    const cmentry &textcell(int x, int y) const
+    {
+        return textmap[((y << 6) + x - (m_scrollRows << 2)) & 03777];
+    }
     int m_regionX;
     int m_regionY;
     int m_regionHeight;
     int m_regionWidth;
     bool m_autobs;
 
+    // Damage tracking: the parts of the screen bitmap that have changed
+    // since the last ptermRefresh, in bitmap (not PLATO) coordinates.
+#define MaxDamage   16
+    wxRect      m_damage[MaxDamage];
+    int         m_damageCount;
+    int         m_lastDamage;
+
+    // Display update pacing: damage is passed on to the canvas at most
+    // once per frame interval (m_frameMs).  m_presentWatch times the
+    // interval since the last update, and m_presentTimer runs when an
+    // update is being held back until the interval is up.
+    wxTimer     m_presentTimer;
+    wxStopWatch m_presentWatch;
+    long        m_lastPresent;
+    int         m_frameMs;
+
+    // Set by procDataLoop when it stopped with data still pending
+    bool        m_decodeYield;
+
+    // Left by procDataLoop for the GUI thread (see DecodeFinish): the
+    // interval for the delay timer if it stopped for a delay, and the
+    // connection status code if the connection went away.
+    int         m_delayMs;
+    int         m_decodeEnd;
+
+    // Words taken from the connection but not yet processed
+#define WordBatch   128
+    int         m_words[WordBatch];
+    int         m_wordIndex;
+    int         m_wordCount;
+
+    // Back buffer: the drawing primitives work on this copy of the
+    // screen, not on the bitmap, so they can run on the decode thread.
+    // Its rows are laid out like those of the bitmap.  The row table
+    // is indexed by bitmap (not PLATO) Y coordinate.  m_backStale has a
+    // bit per 32 pixels of each row (indexed by back buffer row) that
+    // has changed since it was last copied to the bitmap, which
+    // ptermReleaseRaster does on the GUI thread.
+    u32         m_back[512][512];
+    u32         *m_rows[512];
+    u16         m_backStale[512];
+    bool        m_backDirty;
+
+    // The screen bitmap stays selected into m_memDC for a run of
+    // characters drawn with a font (see drawFontChar) while this is
+    // set; ptermReleaseRaster deselects it, and copies the rows the
+    // run touched (m_fontArea) back into the back buffer.  The back
+    // buffer is not drawn into while the DC is held.
+    bool        m_fontDC;
+    wxRect      m_fontArea;
+
+    // Dumb terminal mode scrolling is done by moving the row origin
+    // rather than the pixels: bitmap row y (and back buffer and
+    // selection image row y) is stored in row (y + m_scrollRows) & 0777,
+    // and the text map is offset to match.  ptermUnscroll puts things
+    // back in order for code that works on the bitmap as a whole.
+    int         m_scrollRows;
+
+    // Selection image: one bit per pixel, set for foreground, indexed
+    // by bitmap Y coordinate and then by X.  It only ever holds two
+    // colors, so it is kept in this form and expanded to m_selpixf and
+    // m_selpixb pixels for the selected region when that is drawn.
+    u32         m_selplane[512][512 / 32];
+    u32 *ptermSelRow(int y)
+    {
+        return m_selplane[(y + m_scrollRows) & 0777];
+    }
+
+    // Scaled copy of the screen for bilinear scaling, kept for the
+    // current window scale and rescaled a 32x32 pixel tile at a time.
+    // m_scaleStale has a bit per tile (indexed by bitmap coordinates)
+    // that has changed since it was last scaled.
+    wxBitmap    *m_scaled;
+    double      m_scaledX;
+    double      m_scaledY;
+    int         *m_scaleXTab;
+    int         *m_scaleYTab;
+    u16         m_scaleStale[512 / 32];
+
+    // Enlargement of m_bitmap2 (integer content scale), and its stale
+    // tiles, which are tracked the same way as for m_scaled.
+    int         m_zoom;
+    u16         m_zoomStale[512 / 32];
+
+    // Character glyph cache: sets M0 to M3, each character expanded into
+    // pixel row masks for each of the four size/orientation combinations
+    // (normal, large, vertical, large vertical).  m_glyphValid has a bit
+    // per orientation saying whether that expansion is current.
+    u32         m_glyphs[4][64][4][32];
+    u8          m_glyphValid[4][64];
+    u32         m_glyphScratch[32];
+
     // z80 emulation support
     u8 inputZ80(u8 data);
     void outputZ80(u8 data, u8 acc);
     int check_pcZ80(void);
+    int residentCall(void);
 
     const char* resCallName(u16 pc);
+    const char *Z80CallName(unsigned short pc);
+
+    // The z80 runs on a thread of its own.  MicroStart sets it going;
+    // resident calls that need the display are handed to the thread
+    // that has the terminal (m_z80Call), the GUI thread or the decode
+    // thread during a run of it, and carried out by MicroService,
+    // while the z80 thread waits for the answer.  Resident calls that
+    // only use emulator state are done on the z80 thread.  Host data
+    // is not processed while the z80 runs, so the emulator state is
+    // never touched by both.
+    void MicroStart (u8 colors);
+    bool MicroService (bool wait = false);
+    void MicroHalt (void);
+    void MicroStop (void);
+    void UseColors (u8 target);
+    void mtKeyPut (int key);
+    int mtKeyGet (void);
+    void mtKeyClear (void);
+    static dtThreadFun (s_z80Thread, arg);
+    void z80Thread (void);
+    int z80Call (void);
+    void z80Sleep (int ms);
+
+    wxMutex     m_z80Lock;
+    wxCondition m_z80Wake;      // z80 thread waits for this
+    wxCondition m_z80Done;      // MicroService waits for this
+    pthread_t   m_z80Thread;
+    bool        m_z80Started;
+    bool        m_z80Quit;
+    bool        m_z80Go;        // start a run
+    bool        m_z80Busy;      // run started and not yet finished
+    bool        m_z80Call;      // resident call waiting for MicroService
+    bool        m_z80Waiting;   // someone is in MicroService
+    int         m_z80Result;
+    bool        m_microRun;     // MicroService hasn't yet seen the run end
+    u8          m_z80Colors;    // whose colors resident calls use
+    u8          m_colorsFor;    // whose colors are current
+
+public:
+    // PLATO data is decoded and drawn (into the back buffer) on a
+    // thread of each window's own.  The GUI thread sets it going with
+    // DecodeStart for a run of at most half a frame interval, which is
+    // what procDataLoop did on the GUI thread before; when the run is
+    // over, DecodeFinish passes its damage on to the canvas, starts
+    // the delay timer, and so on.  While a run is in progress the
+    // terminal state is the decode thread's: events for the window are
+    // held off by DecodeHold, which asks it to stop early, until it has
+    // stopped.  So keys, echoes and metadata replies still go out in
+    // the order they did.  Work that can only be done on the GUI thread
+    // (font drawing, status line, timers, ...) is handed to it with
+    // guiCall and carried out by DecodeService, while the decode thread
+    // waits for it.
+    void DecodeHold (void);
+    void DecodeRelease (void);
+    bool DecodeThread (void) const
+    {
+        return wxThread::GetCurrentId () == m_decodeId;
+    }
+
+private:
+    void DecodeStart (void);
+    bool DecodeService (bool wait = false);
+    void DecodeFinish (void);
+    void DecodeStop (void);
+    static dtThreadFun (s_decodeThread, arg);
+    void decodeThread (void);
+    void guiCall (int req, int arg0 = 0, int arg1 = 0, int arg2 = 0);
+    void guiService (int req);
+
+    // GUI thread work requests, see guiService
+    enum
+    {
+        GuiNone,
+        GuiRelease,
+        GuiFontChar,
+        GuiFontActive,
+        GuiSaveWindow,
+        GuiRestoreWindow,
+        GuiClearRegion,
+        GuiTitle,
+        GuiStatus,
+        GuiConnected,
+        GuiShowTrace,
+        GuiBell,
+        GuiTouch,
+        GuiClocks,
+        GuiZ80Wait,
+        GuiZ80Cancel
+    };
+
+    wxMutex     m_decodeLock;
+    wxCondition m_decodeWake;       // decode thread waits for this
+    wxCondition m_decodeDone;       // GUI thread waits for this
+    pthread_t   m_decodeThread;
+    wxThreadIdType m_decodeId;
+    bool        m_decodeStarted;
+    bool        m_decodeQuit;
+    bool        m_decodeGo;         // start a run
+    bool        m_decodeBusy;       // run started and not yet finished
+    bool        m_decodeWaiting;    // GUI thread is in DecodeService
+    bool        m_decodeRun;        // GUI thread hasn't yet seen the run end
+    std::atomic<int> m_decodeHold;  // events being handled, see DecodeHold
+    int         m_guiReq;           // GUI work the decode thread waits for
+    int         m_guiArg[3];
+    wxString    m_guiText;
+    bool        m_guiServing;       // DecodeService is doing m_guiReq
 
     // any class wishing to process wxWindows events must use this macro
     DECLARE_EVENT_TABLE()
 };
 
 void PtermFrame::ptermUpdatePoint (int x, int y, u32 pixval, bool xor_p,
-                                   PixelData &pixmap)
+                                   u32 **rows)
 {
-    PixelData::Iterator p (pixmap);
     u32 *pmap;
     
     x = XMADJUST (x & 0777);
     y = YMADJUST (y & 0777);
     
-    p.MoveTo (pixmap, x, y);
-    pmap = (u32 *)(p.m_ptr);
+    pmap = rows[y] + x;
 
     if (xor_p)
     {
@@ -71,7 +71,10 @@ void PtermPrintout::DrawPage (wxDC *dc)
     dc->SetDeviceOrigin ((long) posX, (long) posY);
 
     // Re-color the image
+    m_owner->DecodeHold ();
+    m_owner->ptermUnscroll ();
     wxImage screenImage = m_owner->m_bitmap->ConvertToImage ();
+    m_owner->DecodeRelease ();
 
     unsigned char *data = screenImage.GetData ();
     
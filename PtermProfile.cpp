@@ -96,6 +96,7 @@ void PtermProfile::init (void)
     //tab4
     m_FancyScaling = false;
     m_scale = 1.0;
+    m_frameRate = 0;
     m_showStatusBar = true;
 #if !defined (__WXMAC__)
     m_showMenuBar = true;
@@ -213,6 +214,10 @@ bool PtermProfile::LoadProfile (void)
             {
                 value.ToCDouble (&m_scale);
             }
+            else if (token.Cmp (wxT (PREF_FRAMERATE)) == 0)
+            {
+                value.ToCLong (&m_frameRate);
+            }
             else if (token.Cmp (wxT (PREF_STATUSBAR)) == 0)
                 m_showStatusBar = (value.Cmp (wxT ("1")) == 0);
 #if !defined (__WXMAC__)
@@ -357,6 +362,8 @@ bool PtermProfile::SaveProfile (void)
     file.AddLine (buffer);
     buffer.Printf (wxT (PREF_SCALE) wxT ("=%f"), m_scale);
     file.AddLine (buffer);
+    buffer.Printf (wxT (PREF_FRAMERATE) wxT ("=%ld"), m_frameRate);
+    file.AddLine (buffer);
     buffer.Printf (wxT (PREF_STATUSBAR) wxT ("=%d"), (m_showStatusBar) ? 1 : 0);
     file.AddLine (buffer);
 #if !defined (__WXMAC__)
@@ -58,6 +58,7 @@ public:
     double      m_scale;    // Window scale factor or special value
 #define SCALE_ASPECT  0.    // Scale to window, square aspect ratio
 #define SCALE_FREE   -1.    // Scale to window, free form
+    long        m_frameRate;    // Display updates per second, 0 for monitor rate
     bool        m_showStatusBar;
 #if !defined (__WXMAC__)
     bool        m_showMenuBar;
@@ -18,6 +18,9 @@ Trace::Trace ()
 void Trace::Open (const char *fn)
 {
     Close ();
+
+    wxMutexLocker lock (mutex);
+
     if (fn == NULL || fn[0] == '\0')
     {
         fd = stdout;
@@ -43,6 +46,8 @@ void Trace::Open (const char *fn)
 
 void Trace::Close (void)
 {
+    wxMutexLocker lock (mutex);
+
     if (fd != NULL)
     {
         delete tp;
@@ -93,7 +98,14 @@ void Trace::Log (const wxString &s)
 #endif
         hdr.Append (s);
         hdr.Append ("\n");
-        tp->Output (hdr);
+
+        wxMutexLocker lock (mutex);
+
+        // Check again, it may have been closed meanwhile.
+        if (tp != NULL)
+        {
+            tp->Output (hdr);
+        }
     }
 }
 
@@ -32,6 +32,9 @@ public:
     }
     
 private:
+    // Trace calls come from the z80 and network threads as well as
+    // the GUI thread, so the output and Open/Close are serialized.
+    wxMutex mutex;
     wxMessageOutputStderr *tp;
     FILE *fd;
 };
@@ -41,6 +41,10 @@
 #define RAM m_context.memory
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
 #include "Z80.h"
 #include "z80instructions.h"
@@ -171,11 +175,24 @@ Z80::Z80 ()
 
     ppt_running = false;
 
+    // No traps until the owner asks for them
+    Z80Trap (0, 0xffff, false);
+    m_prof = NULL;
+
+#ifdef Z80_BLOCK_CACHE
+    m_blockCache = true;
+    m_blocks = new Z80Block[Z80Blocks];
+#endif
+
     Z80Reset ();
 }
 
 Z80::~Z80 ()
 {
+    delete m_prof;
+#ifdef Z80_BLOCK_CACHE
+    delete [] m_blocks;
+#endif
 }
 
 void Z80::Z80Reset ()
@@ -188,6 +205,9 @@ void Z80::Z80Reset ()
     state->i = state->pc = state->iff1 = state->iff2 = 0;
     state->im = Z80_INTERRUPT_MODE_0;
 
+    // Whatever is loaded next is new code
+    Z80BlockFlush ();
+
     /* Build register decoding tables for both 3-bit encoded 8-bit
     * registers and 2-bit encoded 16-bit registers. When an opcode is
     * prefixed by 0xdd, HL is replaced by IX. When 0xfd prefixed, HL is
@@ -367,7 +387,18 @@ int Z80::Z80Emulate (int number_cycles)
 
     ppt_running = true;
 
-    return emulate (opcode, elapsed_cycles, number_cycles);
+    if (m_prof == NULL)
+    {
+        return emulate (opcode, elapsed_cycles, number_cycles);
+    }
+
+    // Profiling: time the run, less the time taken by calls.
+    const unsigned long long start = Z80Clock ();
+    const unsigned long long calls = m_prof->callTotal;
+
+    elapsed_cycles = emulate (opcode, elapsed_cycles, number_cycles);
+    m_prof->emulateTime += Z80Clock () - start - (m_prof->callTotal - calls);
+    return elapsed_cycles;
 }
 
 bool Z80::Z80BreakPoint (int pc, bool step)
@@ -418,6 +449,190 @@ bool Z80::Z80BreakPoint (int pc, bool step)
     return step;    // <<<<<< set break point here for break point
 }
 
+// Set or clear the trap bits for addresses first through last.
+void Z80::Z80Trap (int first, int last, bool on)
+{
+    int a;
+
+    for (a = first; a <= last; a++)
+    {
+        if (on)
+        {
+            m_trap[(a & 0xffff) >> 3] |= 1 << (a & 7);
+        }
+        else
+        {
+            m_trap[(a & 0xffff) >> 3] &= ~(1 << (a & 7));
+        }
+    }
+}
+
+#ifdef Z80_BLOCK_CACHE
+
+// The block that starts at pc, with at least its first instruction
+// decoded.  If the slot for pc holds another block, it is replaced.
+Z80Block *Z80::Z80BlockFind (int pc)
+{
+    Z80Block *b = &m_blocks[pc & (Z80Blocks - 1)];
+
+    if (b->count > 0 && b->pc == pc)
+    {
+        return b;
+    }
+    b->pc = pc;
+    b->count = 0;
+    Z80Decode (b, pc);
+    return b;
+}
+
+// Decode the instruction at pc, the same way emulate() does, and add it
+// to the end of the block.  The 0xdd, 0xfd and 0xed prefixes are
+// taken here; the 0xcb prefix, operands and displacements are left to
+// emulate(), which reads them from memory as it always does, so the
+// next instruction is added when emulate() gets to it.  The prefix and
+// opcode bytes are marked in m_code so a write to them empties the
+// cache.
+void Z80::Z80Decode (Z80Block *block, int pc)
+{
+    ZEXTEST *context = &m_context;
+    Z80Op *op = &block->op[block->count++];
+    int opcode, instruction, a;
+
+    op->pc = pc;
+    op->registers = state->register_table;
+    op->m1 = 0;
+    for (;;)
+    {
+        Z80_FETCH_BYTE (pc + op->m1, opcode);
+        op->m1++;
+        instruction = INSTRUCTION_TABLE[opcode];
+
+        // A long run of prefixes is left to emulate() after the
+        // first few.
+        if ((instruction == DD_PREFIX || instruction == FD_PREFIX) &&
+            op->m1 < 4)
+        {
+            op->registers = (instruction == DD_PREFIX) ?
+                state->dd_register_table : state->fd_register_table;
+            continue;
+        }
+        if (instruction == ED_PREFIX)
+        {
+            op->registers = state->register_table;
+            Z80_FETCH_BYTE (pc + op->m1, opcode);
+            op->m1++;
+            instruction = ED_INSTRUCTION_TABLE[opcode];
+        }
+        break;
+    }
+    op->opcode = opcode;
+    op->instruction = instruction;
+
+    for (a = pc; a < pc + op->m1; a++)
+    {
+        m_code[(a & 0xffff) >> 3] |= 1 << (a & 7);
+    }
+
+    // Nothing follows an instruction that can go elsewhere, or one
+    // that calls out of the emulator (which may give up there).
+    switch (instruction)
+    {
+    case JP_NN:
+    case JP_CC_NN:
+    case JR_E:
+    case JR_DD_E:
+    case JP_HL:
+    case DJNZ_E:
+    case CALL_NN:
+    case CALL_CC_NN:
+    case RET:
+    case RET_CC:
+    case RETI_RETN:
+    case RST_P:
+    case HALT:
+    case DI:
+    case EI:
+    case LDIR_LDDR:
+    case CPIR_CPDR:
+    case IN_A_N:
+    case IN_R_C:
+    case INI_IND:
+    case INIR_INDR:
+    case OUT_N_A:
+    case OUT_C_R:
+    case OUTI_OUTD:
+    case OTIR_OTDR:
+    case DD_PREFIX:
+    case FD_PREFIX:
+    case ED_UNDEFINED:
+        block->open = false;
+        break;
+    default:
+        block->open = block->count < Z80BlockOps;
+        break;
+    }
+}
+
+#endif
+
+// Empty the decoded block cache.  Anything that changes code in RAM
+// other than through the emulated CPU, WriteRAM, WriteRAMW or Poke has
+// to call this.
+void Z80::Z80BlockFlush (void)
+{
+#ifdef Z80_BLOCK_CACHE
+    int i;
+
+    for (i = 0; i < Z80Blocks; i++)
+    {
+        m_blocks[i].count = 0;
+        m_blocks[i].open = false;
+    }
+    memset (m_code, 0, sizeof (m_code));
+#endif
+}
+
+/* With the block cache and GCC's labels as values, an instruction that
+* is followed by another in the same block jumps straight to it (threaded
+* code), rather than going back through the top of the loop and the
+* switch.  The cycle count is still checked after every instruction.
+* Without them, Z80_NEXT is the plain break.
+*/
+
+#if defined (Z80_BLOCK_CACHE) && defined (__GNUC__)
+
+#define Z80_THREADED
+
+#define Z80_LABEL(instruction)  L_ ## instruction:
+
+#define Z80_NEXT                                                        \
+{                                                                       \
+    if (elapsed_cycles >= number_cycles)                                \
+    {                                                                   \
+        in_r_exec = false;                                              \
+        goto stop_emulation;                                            \
+    }                                                                   \
+    if (bop != bend && prof == NULL)                                    \
+    {                                                                   \
+        opcode = bop->opcode;                                           \
+        instruction = bop->instruction;                                 \
+        registers = bop->registers;                                     \
+        elapsed_cycles += bop->m1 * 4;                                  \
+        r += bop->m1;                                                   \
+        pc += bop->m1;                                                  \
+        bop++;                                                          \
+        goto *labels[instruction];                                      \
+    }                                                                   \
+    break;                                                              \
+}
+
+#else
+
+#define Z80_LABEL(instruction)
+#define Z80_NEXT                break;
+
+#endif
+
 /* Actual emulation function. opcode is the first opcode to emulate, this is
 * needed by Z80Interrupt() for interrupt mode 0.
 */
@@ -434,8 +649,73 @@ int Z80::emulate (
 
     int	pc, r;
 
+    /* The profile can't be started or stopped while this runs. */
+
+    Z80Profile  *const prof = m_prof;
+
+#ifdef Z80_BLOCK_CACHE
+
+    /* Block being run, and the next and end of its decoded
+    * instructions.  The first instruction, which the caller has
+    * fetched, isn't in a block.
+    */
+
+    const bool  cache = m_blockCache;
+    Z80Block    *block = NULL;
+    Z80Op       *bop = NULL, *bend = NULL;
+
+#ifdef Z80_THREADED
+
+    /* The instructions' code, in the order of z80instructions.h. */
+
+    static void *const labels[] = {
+
+        &&L_LD_R_R, &&L_LD_R_N, &&L_LD_R_INDIRECT_HL, &&L_LD_INDIRECT_HL_R,
+        &&L_LD_INDIRECT_HL_N, &&L_LD_A_INDIRECT_BC, &&L_LD_A_INDIRECT_DE,
+        &&L_LD_A_INDIRECT_NN, &&L_LD_INDIRECT_BC_A, &&L_LD_INDIRECT_DE_A,
+        &&L_LD_INDIRECT_NN_A, &&L_LD_A_I_LD_A_R, &&L_LD_I_A_LD_R_A,
+        &&L_LD_RR_NN, &&L_LD_HL_INDIRECT_NN, &&L_LD_RR_INDIRECT_NN,
+        &&L_LD_INDIRECT_NN_HL, &&L_LD_INDIRECT_NN_RR, &&L_LD_SP_HL,
+        &&L_PUSH_SS, &&L_POP_SS, &&L_EX_DE_HL, &&L_EX_AF_AF_PRIME, &&L_EXX,
+        &&L_EX_INDIRECT_SP_HL, &&L_LDI_LDD, &&L_LDIR_LDDR, &&L_CPI_CPD,
+        &&L_CPIR_CPDR, &&L_ADD_R, &&L_ADD_N, &&L_ADD_INDIRECT_HL, &&L_ADC_R,
+        &&L_ADC_N, &&L_ADC_INDIRECT_HL, &&L_SUB_R, &&L_SUB_N,
+        &&L_SUB_INDIRECT_HL, &&L_SBC_R, &&L_SBC_N, &&L_SBC_INDIRECT_HL,
+        &&L_AND_R, &&L_AND_N, &&L_AND_INDIRECT_HL, &&L_XOR_R, &&L_XOR_N,
+        &&L_XOR_INDIRECT_HL, &&L_OR_R, &&L_OR_N, &&L_OR_INDIRECT_HL,
+        &&L_CP_R, &&L_CP_N, &&L_CP_INDIRECT_HL, &&L_INC_R,
+        &&L_INC_INDIRECT_HL, &&L_DEC_R, &&L_DEC_INDIRECT_HL, &&L_ADD_HL_RR,
+        &&L_ADC_HL_RR, &&L_SBC_HL_RR, &&L_INC_RR, &&L_DEC_RR, &&L_DAA,
+        &&L_CPL, &&L_NEG, &&L_CCF, &&L_SCF, &&L_NOP, &&L_HALT, &&L_DI,
+        &&L_EI, &&L_IM_N, &&L_RLCA, &&L_RLA, &&L_RRCA, &&L_RRA, &&L_RLC_R,
+        &&L_RLC_INDIRECT_HL, &&L_RL_R, &&L_RL_INDIRECT_HL, &&L_RRC_R,
+        &&L_RRC_INDIRECT_HL, &&L_RR_R, &&L_RR_INDIRECT_HL, &&L_SLA_R,
+        &&L_SLA_INDIRECT_HL, &&L_SLL_R, &&L_SLL_INDIRECT_HL, &&L_SRA_R,
+        &&L_SRA_INDIRECT_HL, &&L_SRL_R, &&L_SRL_INDIRECT_HL, &&L_RLD_RRD,
+        &&L_BIT_B_R, &&L_BIT_B_INDIRECT_HL, &&L_SET_B_R,
+        &&L_SET_B_INDIRECT_HL, &&L_RES_B_R, &&L_RES_B_INDIRECT_HL,
+        &&L_JP_NN, &&L_JP_CC_NN, &&L_JR_E, &&L_JR_DD_E, &&L_JP_HL,
+        &&L_DJNZ_E, &&L_CALL_NN, &&L_CALL_CC_NN, &&L_RET, &&L_RET_CC,
+        &&L_RETI_RETN, &&L_RST_P, &&L_IN_A_N, &&L_IN_R_C, &&L_INI_IND,
+        &&L_INIR_INDR, &&L_OUT_N_A, &&L_OUT_C_R, &&L_OUTI_OUTD,
+        &&L_OTIR_OTDR, &&L_CB_PREFIX, &&L_DD_PREFIX, &&L_FD_PREFIX,
+        &&L_ED_PREFIX, &&L_ED_UNDEFINED
+
+    };
+
+#endif
+
+#endif
+
     pc = state->pc;
     r = state->r & 0x7f;
+
+    // The first opcode has been fetched already.
+    if (prof != NULL)
+    {
+        m_prof->lastElapsed = elapsed_cycles;
+        Z80Count (pc - 1, elapsed_cycles);
+    }
     goto start_emulation;
 
     for (; ; ) {
@@ -443,6 +723,63 @@ int Z80::emulate (
         void    **registers;
         int     instruction;
 
+        if (prof != NULL)
+        {
+            Z80Count (pc, elapsed_cycles);
+        }
+
+#ifdef Z80_BLOCK_CACHE
+
+        /* Take the next instruction from the block.  At the end of
+        * it, check for giving up, then go on with the block if more
+        * can be added to it, or else find the block for this address.
+        */
+
+        if (cache) {
+
+            if (bop == bend) {
+
+                if (m_giveupz80) {
+
+                    in_r_exec = true;
+                    m_giveupz80 = false;
+                    if (prof != NULL)
+                    {
+                        prof->count[prof->last]--;
+                    }
+                    goto stop_emulation;
+
+                }
+                pc &= 0xffff;
+                if (block != NULL && block->open) {
+
+                    bop = bend;
+                    Z80Decode (block, pc);
+
+                }
+                else {
+
+                    block = Z80BlockFind (pc);
+                    bop = block->op;
+
+                }
+                bend = block->op + block->count;
+
+            }
+
+            opcode = bop->opcode;
+            instruction = bop->instruction;
+            registers = bop->registers;
+            elapsed_cycles += bop->m1 * 4;
+            r += bop->m1;
+            pc += bop->m1;
+            bop++;
+            goto emulate_decoded;
+
+        }
+
+#endif
+
         Z80_FETCH_BYTE (pc, opcode);
         pc++;
 
@@ -457,6 +794,11 @@ int Z80::emulate (
             in_r_exec = true;
             m_giveupz80 = false;
             pc--;
+            // This instruction is counted again when it is resumed.
+            if (prof != NULL)
+            {
+                prof->count[prof->last]--;
+            }
             // give the resident time to process keys and update display
             goto stop_emulation;
         }
@@ -468,6 +810,12 @@ int Z80::emulate (
         elapsed_cycles += 4;
         r++;
 
+#ifdef Z80_BLOCK_CACHE
+
+    emulate_decoded:
+
+#endif
+
 #ifdef DEBUG_Z80_PRINT
 
         if (pc > 0x60b8 && pc < 0x60df)
@@ -530,21 +878,21 @@ int Z80::emulate (
 
             /* 8-bit load group. */
 
-        case LD_R_R: {
+        case LD_R_R: Z80_LABEL (LD_R_R) {
 
             R (Y (opcode)) = R (Z (opcode));
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_R_N: {
+        case LD_R_N: Z80_LABEL (LD_R_N) {
 
             READ_N (R (Y (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_R_INDIRECT_HL: {
+        case LD_R_INDIRECT_HL: Z80_LABEL (LD_R_INDIRECT_HL) {
 
             if (registers == state->register_table) {
 
@@ -562,11 +910,11 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_HL_R: {
+        case LD_INDIRECT_HL_R: Z80_LABEL (LD_INDIRECT_HL_R) {
 
             if (registers == state->register_table) {
 
@@ -584,11 +932,11 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_HL_N: {
+        case LD_INDIRECT_HL_N: Z80_LABEL (LD_INDIRECT_HL_N) {
 
             int     n;
 
@@ -611,59 +959,59 @@ int Z80::emulate (
 
             }
 
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_A_INDIRECT_BC: {
+        case LD_A_INDIRECT_BC: Z80_LABEL (LD_A_INDIRECT_BC) {
 
             READ_BYTE (BC, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_A_INDIRECT_DE: {
+        case LD_A_INDIRECT_DE: Z80_LABEL (LD_A_INDIRECT_DE) {
 
             READ_BYTE (DE, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_A_INDIRECT_NN: {
+        case LD_A_INDIRECT_NN: Z80_LABEL (LD_A_INDIRECT_NN) {
 
             int     nn;
 
             READ_NN (nn);
             READ_BYTE (nn, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_BC_A: {
+        case LD_INDIRECT_BC_A: Z80_LABEL (LD_INDIRECT_BC_A) {
 
             WRITE_BYTE (BC, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_DE_A: {
+        case LD_INDIRECT_DE_A: Z80_LABEL (LD_INDIRECT_DE_A) {
 
             WRITE_BYTE (DE, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_NN_A: {
+        case LD_INDIRECT_NN_A: Z80_LABEL (LD_INDIRECT_NN_A) {
 
             int     nn;
 
             READ_NN (nn);
             WRITE_BYTE (nn, A);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_A_I_LD_A_R: {
+        case LD_A_I_LD_A_R: Z80_LABEL (LD_A_I_LD_A_R) {
 
             int     a, f;
 
@@ -685,11 +1033,11 @@ int Z80::emulate (
 
             elapsed_cycles++;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_I_A_LD_R_A: {
+        case LD_I_A_LD_R_A: Z80_LABEL (LD_I_A_LD_R_A) {
 
             if (opcode == OPCODE_LD_I_A)
 
@@ -704,108 +1052,108 @@ int Z80::emulate (
 
             elapsed_cycles++;
 
-            break;
+            Z80_NEXT
 
         }
 
                             /* 16-bit load group. */
 
-        case LD_RR_NN: {
+        case LD_RR_NN: Z80_LABEL (LD_RR_NN) {
 
             READ_NN (RR (P (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_HL_INDIRECT_NN: {
+        case LD_HL_INDIRECT_NN: Z80_LABEL (LD_HL_INDIRECT_NN) {
 
             int     nn;
 
             READ_NN (nn);
             READ_WORD (nn, HL_IX_IY);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_RR_INDIRECT_NN: {
+        case LD_RR_INDIRECT_NN: Z80_LABEL (LD_RR_INDIRECT_NN) {
 
             int     nn;
 
             READ_NN (nn);
             READ_WORD (nn, RR (P (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_NN_HL: {
+        case LD_INDIRECT_NN_HL: Z80_LABEL (LD_INDIRECT_NN_HL) {
 
             int     nn;
 
             READ_NN (nn);
             WRITE_WORD (nn, HL_IX_IY);
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_INDIRECT_NN_RR: {
+        case LD_INDIRECT_NN_RR: Z80_LABEL (LD_INDIRECT_NN_RR) {
 
             int     nn;
 
             READ_NN (nn);
             WRITE_WORD (nn, RR (P (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case LD_SP_HL: {
+        case LD_SP_HL: Z80_LABEL (LD_SP_HL) {
 
             SP = HL_IX_IY;
             elapsed_cycles += 2;
-            break;
+            Z80_NEXT
 
         }
 
-        case PUSH_SS: {
+        case PUSH_SS: Z80_LABEL (PUSH_SS) {
 
             PUSH (SS (P (opcode)));
             elapsed_cycles++;
-            break;
+            Z80_NEXT
 
         }
 
-        case POP_SS: {
+        case POP_SS: Z80_LABEL (POP_SS) {
 
             POP (SS (P (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
                      /* Exchange, block transfer and search group. */
 
-        case EX_DE_HL: {
+        case EX_DE_HL: Z80_LABEL (EX_DE_HL) {
 
             EXCHANGE (DE, HL);
-            break;
+            Z80_NEXT
 
         }
 
-        case EX_AF_AF_PRIME: {
+        case EX_AF_AF_PRIME: Z80_LABEL (EX_AF_AF_PRIME) {
 
             EXCHANGE (AF, state->alternates[Z80_AF]);
-            break;
+            Z80_NEXT
 
         }
 
-        case EXX: {
+        case EXX: Z80_LABEL (EXX) {
 
             EXCHANGE (BC, state->alternates[Z80_BC]);
             EXCHANGE (DE, state->alternates[Z80_DE]);
             EXCHANGE (HL, state->alternates[Z80_HL]);
-            break;
+            Z80_NEXT
 
         }
 
-        case EX_INDIRECT_SP_HL: {
+        case EX_INDIRECT_SP_HL: Z80_LABEL (EX_INDIRECT_SP_HL) {
 
             unsigned short t;
 
@@ -818,7 +1166,7 @@ int Z80::emulate (
             break;
         }
 
-        case LDI_LDD: {
+        case LDI_LDD: Z80_LABEL (LDI_LDD) {
 
             int     n, f;
             unsigned short d;
@@ -846,11 +1194,11 @@ int Z80::emulate (
 
             elapsed_cycles += 2;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case LDIR_LDDR: {
+        case LDIR_LDDR: Z80_LABEL (LDIR_LDDR) {
 
             int     d, f, bc, de, hl, n;
 
@@ -935,11 +1283,11 @@ int Z80::emulate (
 
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case CPI_CPD: {
+        case CPI_CPD: Z80_LABEL (CPI_CPD) {
 
             int     a, n, z, f;
 
@@ -966,11 +1314,11 @@ int Z80::emulate (
 
             elapsed_cycles += 5;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case CPIR_CPDR: {
+        case CPIR_CPDR: Z80_LABEL (CPIR_CPDR) {
 
             int     d, a, bc, hl, n, z, f;
 
@@ -1032,236 +1380,236 @@ int Z80::emulate (
             f |= bc ? Z80_P_FLAG : 0;
             F = (unsigned char)(f | Z80_N_FLAG | (F & Z80_C_FLAG));
 
-            break;
+            Z80_NEXT
 
         }
 
                         /* 8-bit arithmetic and logical group. */
 
-        case ADD_R: {
+        case ADD_R: Z80_LABEL (ADD_R) {
 
             ADD (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case ADD_N: {
+        case ADD_N: Z80_LABEL (ADD_N) {
 
             int     n;
 
             READ_N (n);
             ADD (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case ADD_INDIRECT_HL: {
+        case ADD_INDIRECT_HL: Z80_LABEL (ADD_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             ADD (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case ADC_R: {
+        case ADC_R: Z80_LABEL (ADC_R) {
 
             ADC (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case ADC_N: {
+        case ADC_N: Z80_LABEL (ADC_N) {
 
             int     n;
 
             READ_N (n);
             ADC (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case ADC_INDIRECT_HL: {
+        case ADC_INDIRECT_HL: Z80_LABEL (ADC_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             ADC (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case SUB_R: {
+        case SUB_R: Z80_LABEL (SUB_R) {
 
             SUB (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SUB_N: {
+        case SUB_N: Z80_LABEL (SUB_N) {
 
             int     n;
 
             READ_N (n);
             SUB (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case SUB_INDIRECT_HL: {
+        case SUB_INDIRECT_HL: Z80_LABEL (SUB_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             SUB (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case SBC_R: {
+        case SBC_R: Z80_LABEL (SBC_R) {
 
             SBC (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SBC_N: {
+        case SBC_N: Z80_LABEL (SBC_N) {
 
             int     n;
 
             READ_N (n);
             SBC (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case SBC_INDIRECT_HL: {
+        case SBC_INDIRECT_HL: Z80_LABEL (SBC_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             SBC (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case AND_R: {
+        case AND_R: Z80_LABEL (AND_R) {
 
             AND (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case AND_N: {
+        case AND_N: Z80_LABEL (AND_N) {
 
             int     n;
 
             READ_N (n);
             AND (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case AND_INDIRECT_HL: {
+        case AND_INDIRECT_HL: Z80_LABEL (AND_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             AND (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case OR_R: {
+        case OR_R: Z80_LABEL (OR_R) {
 
             OR (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case OR_N: {
+        case OR_N: Z80_LABEL (OR_N) {
 
             int     n;
 
             READ_N (n);
             OR (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case OR_INDIRECT_HL: {
+        case OR_INDIRECT_HL: Z80_LABEL (OR_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             OR (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case XOR_R: {
+        case XOR_R: Z80_LABEL (XOR_R) {
 
             XOR (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case XOR_N: {
+        case XOR_N: Z80_LABEL (XOR_N) {
 
             int     n;
 
             READ_N (n);
             XOR (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case XOR_INDIRECT_HL: {
+        case XOR_INDIRECT_HL: Z80_LABEL (XOR_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             XOR (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case CP_R: {
+        case CP_R: Z80_LABEL (CP_R) {
 
             CP (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case CP_N: {
+        case CP_N: Z80_LABEL (CP_N) {
 
             int     n;
 
             READ_N (n);
             CP (n);
-            break;
+            Z80_NEXT
 
         }
 
-        case CP_INDIRECT_HL: {
+        case CP_INDIRECT_HL: Z80_LABEL (CP_INDIRECT_HL) {
 
             int     x;
 
             READ_INDIRECT_HL (x);
             CP (x);
-            break;
+            Z80_NEXT
 
         }
 
-        case INC_R: {
+        case INC_R: Z80_LABEL (INC_R) {
 
             INC (R (Y (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case INC_INDIRECT_HL: {
+        case INC_INDIRECT_HL: Z80_LABEL (INC_INDIRECT_HL) {
 
             int     x;
 
@@ -1287,18 +1635,18 @@ int Z80::emulate (
                 elapsed_cycles += 6;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case DEC_R: {
+        case DEC_R: Z80_LABEL (DEC_R) {
 
             DEC (R (Y (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case DEC_INDIRECT_HL: {
+        case DEC_INDIRECT_HL: Z80_LABEL (DEC_INDIRECT_HL) {
 
             int     x;
 
@@ -1324,13 +1672,13 @@ int Z80::emulate (
                 elapsed_cycles += 6;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
                               /* General-purpose arithmetic and CPU control group. */
 
-        case DAA: {
+        case DAA: Z80_LABEL (DAA) {
 
             int     a, c, d;
 
@@ -1359,11 +1707,11 @@ int Z80::emulate (
                 | (F & Z80_N_FLAG)
                 | c);
 
-            break;
+            Z80_NEXT
 
         }
 
-        case CPL: {
+        case CPL: Z80_LABEL (CPL) {
 
             A = ~A;
             F = (F & (SZPV_FLAGS | Z80_C_FLAG))
@@ -1376,11 +1724,11 @@ int Z80::emulate (
 
                 | Z80_H_FLAG | Z80_N_FLAG;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case NEG: {
+        case NEG: Z80_LABEL (NEG) {
 
             int     a, f, z, c;
 
@@ -1397,11 +1745,11 @@ int Z80::emulate (
             A = (unsigned char)z;
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case CCF: {
+        case CCF: Z80_LABEL (CCF) {
 
             int     c;
 
@@ -1417,11 +1765,11 @@ int Z80::emulate (
 
                 | (c ^ Z80_C_FLAG));
 
-            break;
+            Z80_NEXT
 
         }
 
-        case SCF: {
+        case SCF: Z80_LABEL (SCF) {
 
             F = (F & SZPV_FLAGS)
 
@@ -1433,17 +1781,17 @@ int Z80::emulate (
 
                 | Z80_C_FLAG;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case NOP: {
+        case NOP: Z80_LABEL (NOP) {
 
-            break;
+            Z80_NEXT
 
         }
 
-        case HALT: {
+        case HALT: Z80_LABEL (HALT) {
 
 #ifdef Z80_CATCH_HALT
 
@@ -1467,7 +1815,7 @@ int Z80::emulate (
 
         }
 
-        case DI: {
+        case DI: Z80_LABEL (DI) {
 
             state->iff1 = state->iff2 = 0;
 
@@ -1496,7 +1844,7 @@ int Z80::emulate (
 
         }
 
-        case EI: {
+        case EI: Z80_LABEL (EI) {
 
             state->iff1 = state->iff2 = 1;
 
@@ -1516,7 +1864,7 @@ int Z80::emulate (
 
         }
 
-        case IM_N: {
+        case IM_N: Z80_LABEL (IM_N) {
 
             /* "IM 0/1" (0xed prefixed opcodes 0x4e and
             * 0x6e) is treated like a "IM 0".
@@ -1534,13 +1882,13 @@ int Z80::emulate (
 
                 state->im = Z80_INTERRUPT_MODE_2;
 
-            break;
+            Z80_NEXT
 
         }
 
                    /* 16-bit arithmetic group. */
 
-        case ADD_HL_RR: {
+        case ADD_HL_RR: Z80_LABEL (ADD_HL_RR) {
 
             int     x, y, z, f, c;
 
@@ -1565,11 +1913,11 @@ int Z80::emulate (
 
             elapsed_cycles += 7;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case ADC_HL_RR: {
+        case ADC_HL_RR: Z80_LABEL (ADC_HL_RR) {
 
             int     x, y, z, f, c;
 
@@ -1596,11 +1944,11 @@ int Z80::emulate (
 
             elapsed_cycles += 7;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case SBC_HL_RR: {
+        case SBC_HL_RR: Z80_LABEL (SBC_HL_RR) {
 
             int x, y, z, f, c;
 
@@ -1629,11 +1977,11 @@ int Z80::emulate (
 
             elapsed_cycles += 7;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case INC_RR: {
+        case INC_RR: Z80_LABEL (INC_RR) {
 
             unsigned short x;
 
@@ -1643,11 +1991,11 @@ int Z80::emulate (
 
             elapsed_cycles += 2;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case DEC_RR: {
+        case DEC_RR: Z80_LABEL (DEC_RR) {
 
             unsigned short x;
 
@@ -1657,22 +2005,22 @@ int Z80::emulate (
 
             elapsed_cycles += 2;
 
-            break;
+            Z80_NEXT
 
         }
 
                      /* Rotate and shift group. */
 
-        case RLCA: {
+        case RLCA: Z80_LABEL (RLCA) {
 
             A = (A << 1) | (A >> 7);
             F = (F & SZPV_FLAGS)
                 | (A & (YX_FLAGS | Z80_C_FLAG));
-            break;
+            Z80_NEXT
 
         }
 
-        case RLA: {
+        case RLA: Z80_LABEL (RLA) {
 
             int     a, f;
 
@@ -1689,11 +2037,11 @@ int Z80::emulate (
             A = (unsigned char)(a | (F & Z80_C_FLAG));
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case RRCA: {
+        case RRCA: Z80_LABEL (RRCA) {
 
             int     c;
 
@@ -1709,11 +2057,11 @@ int Z80::emulate (
 
                 | c);
 
-            break;
+            Z80_NEXT
 
         }
 
-        case RRA: {
+        case RRA: Z80_LABEL (RRA) {
 
             int     c;
 
@@ -1729,18 +2077,18 @@ int Z80::emulate (
 
                 | c);
 
-            break;
+            Z80_NEXT
 
         }
 
-        case RLC_R: {
+        case RLC_R: Z80_LABEL (RLC_R) {
 
             RLC (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case RLC_INDIRECT_HL: {
+        case RLC_INDIRECT_HL: Z80_LABEL (RLC_INDIRECT_HL) {
 
             int     x;
 
@@ -1774,18 +2122,18 @@ int Z80::emulate (
 
             }
 
-            break;
+            Z80_NEXT
 
         }
 
-        case RL_R: {
+        case RL_R: Z80_LABEL (RL_R) {
 
             RL (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case RL_INDIRECT_HL: {
+        case RL_INDIRECT_HL: Z80_LABEL (RL_INDIRECT_HL) {
 
             int     x;
 
@@ -1818,18 +2166,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case RRC_R: {
+        case RRC_R: Z80_LABEL (RRC_R) {
 
             RRC (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case RRC_INDIRECT_HL: {
+        case RRC_INDIRECT_HL: Z80_LABEL (RRC_INDIRECT_HL) {
 
             int     x;
 
@@ -1862,18 +2210,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case RR_R: {
+        case RR_R: Z80_LABEL (RR_R) {
 
             RR_INSTRUCTION (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case RR_INDIRECT_HL: {
+        case RR_INDIRECT_HL: Z80_LABEL (RR_INDIRECT_HL) {
 
             int     x;
 
@@ -1906,18 +2254,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case SLA_R: {
+        case SLA_R: Z80_LABEL (SLA_R) {
 
             SLA (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SLA_INDIRECT_HL: {
+        case SLA_INDIRECT_HL: Z80_LABEL (SLA_INDIRECT_HL) {
 
             int     x;
 
@@ -1950,18 +2298,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case SLL_R: {
+        case SLL_R: Z80_LABEL (SLL_R) {
 
             SLL (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SLL_INDIRECT_HL: {
+        case SLL_INDIRECT_HL: Z80_LABEL (SLL_INDIRECT_HL) {
 
             int     x;
 
@@ -1994,18 +2342,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case SRA_R: {
+        case SRA_R: Z80_LABEL (SRA_R) {
 
             SRA (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SRA_INDIRECT_HL: {
+        case SRA_INDIRECT_HL: Z80_LABEL (SRA_INDIRECT_HL) {
 
             int     x;
 
@@ -2038,18 +2386,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case SRL_R: {
+        case SRL_R: Z80_LABEL (SRL_R) {
 
             SRL (R (Z (opcode)));
-            break;
+            Z80_NEXT
 
         }
 
-        case SRL_INDIRECT_HL: {
+        case SRL_INDIRECT_HL: Z80_LABEL (SRL_INDIRECT_HL) {
 
             int     x;
 
@@ -2082,11 +2430,11 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case RLD_RRD: {
+        case RLD_RRD: Z80_LABEL (RLD_RRD) {
 
             int     x, y;
 
@@ -2105,13 +2453,13 @@ int Z80::emulate (
 
             elapsed_cycles += 4;
 
-            break;
+            Z80_NEXT
 
         }
 
                       /* Bit set, reset, and test group. */
 
-        case BIT_B_R: {
+        case BIT_B_R: Z80_LABEL (BIT_B_R) {
 
             int     x;
 
@@ -2128,11 +2476,11 @@ int Z80::emulate (
                 | Z80_H_FLAG
                 | (F & Z80_C_FLAG);
 
-            break;
+            Z80_NEXT
 
         }
 
-        case BIT_B_INDIRECT_HL: {
+        case BIT_B_INDIRECT_HL: Z80_LABEL (BIT_B_INDIRECT_HL) {
 
             int     d, x;
 
@@ -2168,18 +2516,18 @@ int Z80::emulate (
                 | Z80_H_FLAG
                 | (F & Z80_C_FLAG);
 
-            break;
+            Z80_NEXT
 
         }
 
-        case SET_B_R: {
+        case SET_B_R: Z80_LABEL (SET_B_R) {
 
             R (Z (opcode)) |= 1 << Y (opcode);
-            break;
+            Z80_NEXT
 
         }
 
-        case SET_B_INDIRECT_HL: {
+        case SET_B_INDIRECT_HL: Z80_LABEL (SET_B_INDIRECT_HL) {
 
             int     x;
 
@@ -2212,18 +2560,18 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case RES_B_R: {
+        case RES_B_R: Z80_LABEL (RES_B_R) {
 
             R (Z (opcode)) &= ~(1 << Y (opcode));
-            break;
+            Z80_NEXT
 
         }
 
-        case RES_B_INDIRECT_HL: {
+        case RES_B_INDIRECT_HL: Z80_LABEL (RES_B_INDIRECT_HL) {
 
             int     x;
 
@@ -2256,13 +2604,13 @@ int Z80::emulate (
                 elapsed_cycles += 5;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
                                 /* Jump group. */
 
-        case JP_NN: {
+        case JP_NN: Z80_LABEL (JP_NN) {
 
             int     nn;
 
@@ -2272,11 +2620,11 @@ int Z80::emulate (
             elapsed_cycles += 6;
             Z80_CHECK_PC
 
-                break;
+                Z80_NEXT
 
         }
 
-        case JP_CC_NN: {
+        case JP_CC_NN: Z80_LABEL (JP_CC_NN) {
 
             int     nn;
 
@@ -2302,11 +2650,11 @@ int Z80::emulate (
 
             elapsed_cycles += 6;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case JR_E: {
+        case JR_E: Z80_LABEL (JR_E) {
 
             int     e;
 
@@ -2316,11 +2664,11 @@ int Z80::emulate (
             elapsed_cycles += 8;
 
             Z80_CHECK_PC
-                break;
+                Z80_NEXT
 
         }
 
-        case JR_DD_E: {
+        case JR_DD_E: Z80_LABEL (JR_DD_E) {
 
             int     e;
 
@@ -2347,21 +2695,21 @@ int Z80::emulate (
                 elapsed_cycles += 3;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case JP_HL: {
+        case JP_HL: Z80_LABEL (JP_HL) {
 
             pc = HL_IX_IY;
 
             Z80_CHECK_PC
 
-                break;
+                Z80_NEXT
 
         }
 
-        case DJNZ_E: {
+        case DJNZ_E: Z80_LABEL (DJNZ_E) {
 
             int     e;
 
@@ -2387,13 +2735,13 @@ int Z80::emulate (
                 elapsed_cycles += 4;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
                      /* Call and return group. */
 
-        case CALL_NN: {
+        case CALL_NN: Z80_LABEL (CALL_NN) {
 
             int     nn;
 
@@ -2406,11 +2754,11 @@ int Z80::emulate (
 
             Z80_CHECK_PC
 
-                break;
+                Z80_NEXT
 
         }
 
-        case CALL_CC_NN: {
+        case CALL_CC_NN: Z80_LABEL (CALL_CC_NN) {
 
             int     nn;
 
@@ -2438,22 +2786,22 @@ int Z80::emulate (
                 elapsed_cycles += 6;
 
             }
-            break;
+            Z80_NEXT
 
         }
 
-        case RET: {
+        case RET: Z80_LABEL (RET) {
 
         doret:
             POP (pc);
 
             Z80_CHECK_PC
 
-                break;
+                Z80_NEXT
 
         }
 
-        case RET_CC: {
+        case RET_CC: Z80_LABEL (RET_CC) {
 
             if (CC (Y (opcode))) {
 
@@ -2464,11 +2812,11 @@ int Z80::emulate (
             elapsed_cycles++;
 
 
-            break;
+            Z80_NEXT
 
         }
 
-        case RETI_RETN: {
+        case RETI_RETN: Z80_LABEL (RETI_RETN) {
 
             state->iff1 = state->iff2;
             POP (pc);
@@ -2498,18 +2846,18 @@ int Z80::emulate (
 
         }
 
-        case RST_P: {
+        case RST_P: Z80_LABEL (RST_P) {
 
             PUSH (pc);
             pc = RST_TABLE[Y (opcode)];
             elapsed_cycles++;
-            break;
+            Z80_NEXT
 
         }
 
                     /* Input and output group. */
 
-        case IN_A_N: {
+        case IN_A_N: Z80_LABEL (IN_A_N) {
 
             int     n;
 
@@ -2518,11 +2866,11 @@ int Z80::emulate (
 
             elapsed_cycles += 4;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case IN_R_C: {
+        case IN_R_C: Z80_LABEL (IN_R_C) {
 
             int     x = 0;
             Z80_INPUT_BYTE (C, x);
@@ -2534,7 +2882,7 @@ int Z80::emulate (
 
             elapsed_cycles += 4;
 
-            break;
+            Z80_NEXT
 
         }
 
@@ -2545,7 +2893,7 @@ int Z80::emulate (
                      * Undocumented Z80 Documented Version 0.91".
                      */
 
-        case INI_IND: {
+        case INI_IND: Z80_LABEL (INI_IND) {
 
             int     x = 0;
             int f;
@@ -2574,11 +2922,11 @@ int Z80::emulate (
 
             elapsed_cycles += 5;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case INIR_INDR: {
+        case INIR_INDR: Z80_LABEL (INIR_INDR) {
 
             int     d, b, f;
             unsigned short hl;
@@ -2658,11 +3006,11 @@ int Z80::emulate (
                 & Z80_P_FLAG;
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case OUT_N_A: {
+        case OUT_N_A: Z80_LABEL (OUT_N_A) {
 
             int     n;
 
@@ -2672,11 +3020,11 @@ int Z80::emulate (
 
                 elapsed_cycles += 4;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case OUT_C_R: {
+        case OUT_C_R: Z80_LABEL (OUT_C_R) {
             // ReSharper disable once CppEntityNeverUsed
             int x = Y (opcode) != INDIRECT_HL
                 ? R (Y (opcode))
@@ -2685,11 +3033,11 @@ int Z80::emulate (
 
                 elapsed_cycles += 4;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case OUTI_OUTD: {
+        case OUTI_OUTD: Z80_LABEL (OUTI_OUTD) {
 
             int     x, f;
 
@@ -2706,11 +3054,11 @@ int Z80::emulate (
                 & Z80_P_FLAG;
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
-        case OTIR_OTDR: {
+        case OTIR_OTDR: Z80_LABEL (OTIR_OTDR) {
 
             int     d, b, x, f;
             unsigned short hl;
@@ -2766,13 +3114,13 @@ int Z80::emulate (
                 & Z80_P_FLAG;
             F = (unsigned char)f;
 
-            break;
+            Z80_NEXT
 
         }
 
                         /* Prefix group. */
 
-        case CB_PREFIX: {
+        case CB_PREFIX: Z80_LABEL (CB_PREFIX) {
 
             /* Special handling if the 0xcb prefix is
             * prefixed by a 0xdd or 0xfd prefix.
@@ -2801,7 +3149,7 @@ int Z80::emulate (
 
         }
 
-        case DD_PREFIX: {
+        case DD_PREFIX: Z80_LABEL (DD_PREFIX) {
 
             registers = state->dd_register_table;
 
@@ -2837,7 +3185,7 @@ int Z80::emulate (
 
         }
 
-        case FD_PREFIX: {
+        case FD_PREFIX: Z80_LABEL (FD_PREFIX) {
 
             registers = state->fd_register_table;
 
@@ -2869,7 +3217,7 @@ int Z80::emulate (
 
         }
 
-        case ED_PREFIX: {
+        case ED_PREFIX: Z80_LABEL (ED_PREFIX) {
 
             registers = state->register_table;
             Z80_FETCH_BYTE (pc, opcode);
@@ -2882,7 +3230,7 @@ int Z80::emulate (
 
                         /* Special/pseudo instruction group. */
 
-        case ED_UNDEFINED: {
+        case ED_UNDEFINED: Z80_LABEL (ED_UNDEFINED) {
 
 #ifdef Z80_CATCH_ED_UNDEFINED
 
@@ -2912,6 +3260,12 @@ int Z80::emulate (
 
 stop_emulation:
 
+    if (m_prof != NULL)
+    {
+        m_prof->cycles[m_prof->last] += elapsed_cycles - m_prof->lastElapsed;
+        m_prof->lastElapsed = elapsed_cycles;
+    }
+
     state->r = (state->r & 0x80) | (r & 0x7f);
     state->pc = pc & 0xffff;
 
@@ -2932,64 +3286,265 @@ int Z80::check_pcZ80 (void)
     return 0;
 }
 
+const char *Z80::Z80CallName (unsigned short)
+{
+    return NULL;
+}
+
+// Monotonic host clock, in nanoseconds.
+unsigned long long Z80::Z80Clock (void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+// Start gathering a profile, discarding any earlier one.  The emulator
+// must not be running.
+void Z80::Z80ProfileStart (void)
+{
+    if (m_prof == NULL)
+    {
+        m_prof = new Z80Profile;
+    }
+    memset (m_prof, 0, sizeof (Z80Profile));
+    m_prof->start = Z80Clock ();
+}
+
+// Stop profiling and discard the profile.  The emulator must not be
+// running.
+void Z80::Z80ProfileStop (void)
+{
+    delete m_prof;
+    m_prof = NULL;
+}
+
+// check_pcZ80, counted and timed.
+int Z80::Z80ProfileCall (void)
+{
+    const int pc = state->pc;
+    const unsigned long long start = Z80Clock ();
+    unsigned long long t;
+    int ret;
+
+    ret = check_pcZ80 ();
+    t = Z80Clock () - start;
+    m_prof->calls[pc]++;
+    m_prof->callTime[pc] += t;
+    m_prof->callTotal += t;
+    return ret;
+}
+
+// The owner calls these when it stops the emulator to let the resident
+// catch up (r.exec), and when it resumes.
+void Z80::Z80YieldStart (void)
+{
+    if (m_prof != NULL)
+    {
+        m_prof->yieldStart = Z80Clock ();
+    }
+}
+
+void Z80::Z80YieldEnd (void)
+{
+    if (m_prof != NULL && m_prof->yieldStart != 0)
+    {
+        m_prof->yieldTime += Z80Clock () - m_prof->yieldStart;
+        m_prof->yields++;
+        m_prof->yieldStart = 0;
+    }
+}
+
+// Name of a trapped address for the profile files, without the
+// padding; its address if it has no name.
+static const char *profileName (const char *name, int pc, char *buf)
+{
+    int len;
+
+    if (name == NULL)
+    {
+        sprintf (buf, "%04x", pc);
+        return buf;
+    }
+    for (len = 0; len < 15 && name[len] != '\0'; len++)
+    {
+        buf[len] = name[len];
+    }
+    while (len > 0 && buf[len - 1] == ' ')
+    {
+        len--;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static std::vector<int> profileSort (const unsigned long long *key)
+{
+    std::vector<int> v;
+    int i;
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        if (key[i] != 0)
+        {
+            v.push_back (i);
+        }
+    }
+    std::stable_sort (v.begin (), v.end (),
+                      [key] (int a, int b) { return key[a] > key[b]; });
+    return v;
+}
+
+// Write out the profile gathered so far.  "flat" gets a readable flat
+// profile: the trapped calls by time, then the instructions by cycles.
+// "folded" gets the same in the collapsed stack format taken by
+// flamegraph.pl and similar tools, weighted by host nanoseconds; the
+// emulation time is spread over the instructions by their cycles.
+// Either name may be NULL.  Returns false if a file can't be written.
+// The emulator must not be running.
+bool Z80::Z80ProfileWrite (const char *flat, const char *folded)
+{
+    const Z80Profile *p = m_prof;
+    unsigned long long total, cycles = 0, count = 0, cum = 0;
+    char buf[16];
+    FILE *f;
+    bool ok = true;
+
+    if (p == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < 0x10000; i++)
+    {
+        cycles += p->cycles[i];
+        count += p->count[i];
+    }
+    total = Z80Clock () - p->start;
+
+    std::vector<int> calls = profileSort (p->callTime);
+    std::vector<int> code = profileSort (p->cycles);
+
+    if (flat != NULL && (f = fopen (flat, "w")) != NULL)
+    {
+        fprintf (f, "Elapsed          %12.3f ms\n"
+                 "Emulation        %12.3f ms\n"
+                 "Calls            %12.3f ms\n"
+                 "Yielded          %12.3f ms, %llu times\n"
+                 "Instructions     %12llu\n"
+                 "Cycles           %12llu\n\n",
+                 total / 1e6, p->emulateTime / 1e6, p->callTotal / 1e6,
+                 p->yieldTime / 1e6, p->yields, count, cycles);
+
+        fprintf (f, "addr  name              calls     total ms    "
+                 "avg us   %%calls\n");
+        for (int pc : calls)
+        {
+            fprintf (f, "%04x  %-12s %10llu %12.3f %9.3f %8.2f\n",
+                     pc, profileName (Z80CallName (pc), pc, buf),
+                     p->calls[pc], p->callTime[pc] / 1e6,
+                     p->callTime[pc] / 1e3 / p->calls[pc],
+                     100.0 * p->callTime[pc] / p->callTotal);
+        }
+
+        fprintf (f, "\naddr          count       cycles  %%cycles     cum%%\n");
+        for (int pc : code)
+        {
+            cum += p->cycles[pc];
+            fprintf (f, "%04x   %12llu %12llu %8.2f %8.2f\n",
+                     pc, p->count[pc], p->cycles[pc],
+                     100.0 * p->cycles[pc] / cycles, 100.0 * cum / cycles);
+        }
+        ok = (fclose (f) == 0) && ok;
+    }
+    else if (flat != NULL)
+    {
+        ok = false;
+    }
+
+    if (folded != NULL && (f = fopen (folded, "w")) != NULL)
+    {
+        for (int pc : code)
+        {
+            fprintf (f, "mtutor;z80;%02x00;%04x %llu\n", pc >> 8, pc,
+                     (unsigned long long)
+                     ((double) p->emulateTime * p->cycles[pc] / cycles));
+        }
+        for (int pc : calls)
+        {
+            fprintf (f, "mtutor;resident;%s %llu\n",
+                     profileName (Z80CallName (pc), pc, buf),
+                     p->callTime[pc]);
+        }
+        if (p->yieldTime != 0)
+        {
+            fprintf (f, "mtutor;yield %llu\n", p->yieldTime);
+        }
+        ok = (fclose (f) == 0) && ok;
+    }
+    else if (folded != NULL)
+    {
+        ok = false;
+    }
+    return ok;
+}
+
 void Z80::PatchL2 ()
 {
     // Call resident and wxWidgets for brief pause
-    RAM[Level2Pause] = CALL8080;
-    RAM[Level2Pause + 1] = R_WAIT16;
-    RAM[Level2Pause + 2] = 0;
+    Poke (Level2Pause, CALL8080);
+    Poke (Level2Pause + 1, R_WAIT16);
+    Poke (Level2Pause + 2, 0);
 
     // remove off-line check for calling r.exec - 
     // only safe place to give up control..
-    RAM[Level2Xplato] = 0;
-    RAM[Level2Xplato + 1] = 0;
-    RAM[Level2Xplato + 2] = 0;
+    Poke (Level2Xplato, 0);
+    Poke (Level2Xplato + 1, 0);
+    Poke (Level2Xplato + 2, 0);
 
     // patch xerror tight getkey loop problem in mtutor
     // top 32K of ram was for memory mapped video on ist 2/3
     // so that's safe for us to use
-    RAM[0x5d26] = 0x10;
-    RAM[0x5d26 + 1] = 0x80; // jmp just above interp
+    Poke (0x5d26, 0x10);
+    Poke (0x5d26 + 1, 0x80); // jmp just above interp
                             // to a call to xplato and r.exec
-    RAM[0x8010] = CALL8080;  // call
-    RAM[0x8010 + 1] = 0x2f;
-    RAM[0x8010 + 2] = 0x60;  // xplato
+    Poke (0x8010, CALL8080);  // call
+    Poke (0x8010 + 1, 0x2f);
+    Poke (0x8010 + 2, 0x60);  // xplato
                              // jump back to call getkey
-    RAM[0x8010 + 3] = JUMP8080; // jmp
-    RAM[0x8010 + 4] = 0x22;
-    RAM[0x8010 + 5] = 0x5d;  // back to loop - getkey
+    Poke (0x8010 + 3, JUMP8080); // jmp
+    Poke (0x8010 + 4, 0x22);
+    Poke (0x8010 + 5, 0x5d);  // back to loop - getkey
 }
 
 void Z80::PatchL3 ()
 {
     // Call resident and wxWidgets for brief pause
-    RAM[Level3Pause] = CALL8080;
-    RAM[Level3Pause + 1] = R_WAIT16;
-    RAM[Level3Pause + 2] = 0;
+    Poke (Level3Pause, CALL8080);
+    Poke (Level3Pause + 1, R_WAIT16);
+    Poke (Level3Pause + 2, 0);
 
     // remove off-line check for calling r.exec - 
     // only safe place to give up control..  
     // was a z80 jr - 2 bytes only
-    RAM[Level3Xplato] = 0;
-    RAM[Level3Xplato + 1] = 0;
+    Poke (Level3Xplato, 0);
+    Poke (Level3Xplato + 1, 0);
 
-    RAM[0x600d] = RET8080;  // ret to disable ist-3 screen print gunk
+    Poke (0x600d, RET8080);  // ret to disable ist-3 screen print gunk
 }
 
 void Z80::PatchL4 ()
 {
     // Call resident and wxWidgets for brief pause
-    RAM[Level4Pause] = CALL8080;
-    RAM[Level4Pause + 1] = R_WAIT16;
-    RAM[Level4Pause + 2] = 0;
+    Poke (Level4Pause, CALL8080);
+    Poke (Level4Pause + 1, R_WAIT16);
+    Poke (Level4Pause + 2, 0);
 
     // remove off-line check for calling r.exec - 
     // only safe place to give up control..  
     // was a z80 jr - 2 bytes only
-    RAM[Level4Xplato] = 0;
-    RAM[Level4Xplato + 1] = 0;
+    Poke (Level4Xplato, 0);
+    Poke (Level4Xplato + 1, 0);
 
-    RAM[0x5f5c] = RET8080;  // ret to disable ist-3 screen print gunk
+    Poke (0x5f5c, RET8080);  // ret to disable ist-3 screen print gunk
 
     PatchColor (0xe5);
 
@@ -2998,17 +3553,17 @@ void Z80::PatchL4 ()
 void Z80::PatchL5 ()
 {
     // Call resident and wxWidgets for brief pause
-    RAM[Level5Pause] = CALL8080;
-    RAM[Level5Pause + 1] = R_WAIT16;
-    RAM[Level5Pause + 2] = 0;
+    Poke (Level5Pause, CALL8080);
+    Poke (Level5Pause + 1, R_WAIT16);
+    Poke (Level5Pause + 2, 0);
 
     // remove off-line check for calling r.exec - 
     // only safe place to give up control..  
     // was a z80 jr - 2 bytes only
-    RAM[Level5Xplato] = 0;
-    RAM[Level5Xplato + 1] = 0;
+    Poke (Level5Xplato, 0);
+    Poke (Level5Xplato + 1, 0);
 
-    RAM[0x5f5c] = RET8080;  // ret to disable ist-3 screen print gunk
+    Poke (0x5f5c, RET8080);  // ret to disable ist-3 screen print gunk
 
     PatchColor (0xeb);
 }
@@ -3016,17 +3571,17 @@ void Z80::PatchL5 ()
 void Z80::PatchL6 ()
 {
     // Call resident and wxWidgets for brief pause
-    RAM[Level5Pause] = CALL8080;
-    RAM[Level5Pause + 1] = R_WAIT16;
-    RAM[Level5Pause + 2] = 0;
+    Poke (Level5Pause, CALL8080);
+    Poke (Level5Pause + 1, R_WAIT16);
+    Poke (Level5Pause + 2, 0);
 
     // remove off-line check for calling r.exec - 
     // only safe place to give up control..  
     // was a z80 jr - 2 bytes only
-    RAM[Level5Xplato] = 0;
-    RAM[Level5Xplato + 1] = 0;
+    Poke (Level5Xplato, 0);
+    Poke (Level5Xplato + 1, 0);
 
-    RAM[0x5f5c] = RET8080;  // ret to disable ist-3 screen print gunk
+    Poke (0x5f5c, RET8080);  // ret to disable ist-3 screen print gunk
 
     PatchColor (0xeb);
 }
@@ -3034,52 +3589,52 @@ void Z80::PatchL6 ()
 void Z80::PatchColor (unsigned char low_getvar)
 {
     // color display
-    RAM[0x66aa] = JUMP8080;
-    RAM[0x66ab] = 0x00;
-    RAM[0x66ac] = 0x80;         // color patch jump
-
-    RAM[0x8000] = CALL8080;
-    RAM[0x8001] = 0xb0;
-    RAM[0x8002] = 0x66;         // fcolor
-    RAM[0x8003] = 0x21;
-    RAM[0x8004] = 0x25;
-    RAM[0x8005] = 0x7d;         // floating acc
-    RAM[0x8006] = CALL8080;
-    RAM[0x8007] = 0x90;
-    RAM[0x8008] = 0x00;         // r.fcolor + 2
-
-    RAM[0x8009] = CALL8080;
-    RAM[0x800a] = low_getvar;
-    RAM[0x800b] = 0x71;         // getvar
-
-    RAM[0x800c] = CALL8080;
-    RAM[0x800d] = 0xbd;
-    RAM[0x800e] = 0x66;         // bcolor
-
-    RAM[0x800f] = 0x21;
-    RAM[0x8010] = 0x25;
-    RAM[0x8011] = 0x7d;         // floating acc
-
-    RAM[0x8012] = CALL8080;
-    RAM[0x8013] = 0x93;
-    RAM[0x8014] = 0x00;         // r.bcolor + 2
-
-    RAM[0x8015] = JUMP8080;
-    RAM[0x8016] = 0x52;
-    RAM[0x8017] = 0x61;         // pincg
+    Poke (0x66aa, JUMP8080);
+    Poke (0x66ab, 0x00);
+    Poke (0x66ac, 0x80);         // color patch jump
+
+    Poke (0x8000, CALL8080);
+    Poke (0x8001, 0xb0);
+    Poke (0x8002, 0x66);         // fcolor
+    Poke (0x8003, 0x21);
+    Poke (0x8004, 0x25);
+    Poke (0x8005, 0x7d);         // floating acc
+    Poke (0x8006, CALL8080);
+    Poke (0x8007, 0x90);
+    Poke (0x8008, 0x00);         // r.fcolor + 2
+
+    Poke (0x8009, CALL8080);
+    Poke (0x800a, low_getvar);
+    Poke (0x800b, 0x71);         // getvar
+
+    Poke (0x800c, CALL8080);
+    Poke (0x800d, 0xbd);
+    Poke (0x800e, 0x66);         // bcolor
+
+    Poke (0x800f, 0x21);
+    Poke (0x8010, 0x25);
+    Poke (0x8011, 0x7d);         // floating acc
+
+    Poke (0x8012, CALL8080);
+    Poke (0x8013, 0x93);
+    Poke (0x8014, 0x00);         // r.bcolor + 2
+
+    Poke (0x8015, JUMP8080);
+    Poke (0x8016, 0x52);
+    Poke (0x8017, 0x61);         // pincg
 
                                 // paint - flood fill
-    RAM[0x66c3] = 0x20;
-    RAM[0x66c4] = 0x80;
-
-    RAM[0x8020] = 0x21;
-    RAM[0x8021] = 0;
-    RAM[0x8022] = 0;
-    RAM[0x8023] = CALL8080;
-    RAM[0x8024] = 0x94;
-    RAM[0x8025] = 0x00;         // r.paint
-    RAM[0x8026] = JUMP8080;
-    RAM[0x8027] = 0x5d;
-    RAM[0x8028] = 0x61;         // pinc1
+    Poke (0x66c3, 0x20);
+    Poke (0x66c4, 0x80);
+
+    Poke (0x8020, 0x21);
+    Poke (0x8021, 0);
+    Poke (0x8022, 0);
+    Poke (0x8023, CALL8080);
+    Poke (0x8024, 0x94);
+    Poke (0x8025, 0x00);         // r.paint
+    Poke (0x8026, JUMP8080);
+    Poke (0x8027, 0x5d);
+    Poke (0x8028, 0x61);         // pinc1
 }
 
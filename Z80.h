@@ -11,6 +11,52 @@
 
 #define state   (&(m_context.state))
 
+#ifdef Z80_BLOCK_CACHE
+
+// Decoded instruction cache, see z80config.h.  A block is a run of
+// straight-line code, decoded as it first runs, that ends at the first
+// instruction that can continue anywhere but the next one, or after
+// Z80BlockOps instructions.  Blocks are direct mapped by the address
+// of their first instruction.
+#define Z80BlockOps     16
+#define Z80Blocks       4096
+
+struct Z80Op
+{
+    void            **registers;    // register table for the prefix
+    unsigned short  pc;             // address of the first byte
+    unsigned char   opcode;
+    unsigned char   instruction;
+    unsigned char   m1;             // prefix and opcode bytes
+};
+
+struct Z80Block
+{
+    unsigned short  pc;
+    short           count;
+    bool            open;           // more can be added at the end
+    Z80Op           op[Z80BlockOps];
+};
+
+#endif
+
+// Execution profile, see Z80ProfileStart.  Times are host nanoseconds.
+struct Z80Profile
+{
+    unsigned long long  count[0x10000];     // instructions at each address
+    unsigned long long  cycles[0x10000];    // cycles of those instructions
+    unsigned long long  calls[0x10000];     // trapped calls to each address
+    unsigned long long  callTime[0x10000];  // time spent in those calls
+    unsigned long long  emulateTime;        // in emulate(), less calls
+    unsigned long long  callTotal;
+    unsigned long long  yieldTime;          // waiting to resume after r.exec
+    unsigned long long  yields;
+    unsigned long long  yieldStart;
+    unsigned long long  start;
+    int                 last;               // instruction being counted
+    int                 lastElapsed;        // cycle count when it started
+};
+
 class Z80
 {
 public:
@@ -18,7 +64,7 @@ public:
     Z80();
     virtual ~Z80();
 
-    bool m_giveupz80;
+    volatile bool m_giveupz80;  // may be set from another thread
     bool in_r_exec;
     bool ppt_running;
     long m_mtPLevel;
@@ -28,6 +74,26 @@ public:
     
     ZEXTEST m_context;
 
+    // One bit per address: set if a jump, call or return to there has
+    // to go through check_pcZ80 (resident entry points, patch points,
+    // breakpoints).  Branches to any other address skip the call.
+    unsigned char m_trap[0x10000 / 8];
+
+    // Profile being gathered, or NULL.
+    Z80Profile *m_prof;
+
+#ifdef Z80_BLOCK_CACHE
+    // Run from the block cache; clear to run the plain interpreter,
+    // which is what z80bench compares it with.
+    bool m_blockCache;
+
+    Z80Block *m_blocks;
+    unsigned char m_code[0x10000 / 8];  // bytes decoded into m_blocks
+
+    Z80Block *Z80BlockFind (int pc);
+    void Z80Decode (Z80Block *block, int pc);
+#endif
+
     int	emulate(int opcode,
         int elapsed_cycles, int number_cycles);
 
@@ -41,12 +107,61 @@ public:
 
     bool Z80BreakPoint (int pc, bool step);
 
+    void Z80Trap (int first, int last, bool on);
+    void Z80BlockFlush (void);
+
+    // Note a store into RAM other than by the emulated CPU.  If it
+    // changes code that has been decoded, the cache is emptied.
+    void Z80Written (unsigned short offset)
+    {
+#ifdef Z80_BLOCK_CACHE
+        if (Z80_DECODED (offset))
+        {
+            Z80BlockFlush ();
+        }
+#else
+        (void) offset;
+#endif
+    }
+
+    // Profiling.  While it is on, every instruction is counted by
+    // address along with its cycles, and every trapped call by address
+    // along with the host time check_pcZ80 takes.  The owner reports
+    // the time spent yielded between runs with Z80YieldStart/End.
+    void Z80ProfileStart (void);
+    void Z80ProfileStop (void);
+    bool Z80Profiling (void) const
+    {
+        return m_prof != NULL;
+    }
+    bool Z80ProfileWrite (const char *flat, const char *folded);
+    void Z80YieldStart (void);
+    void Z80YieldEnd (void);
+    static unsigned long long Z80Clock (void);
+
+    // Name of a trapped address for the profile, or NULL.
+    virtual const char *Z80CallName (unsigned short pc);
+
+    void Z80Count (int pc, int elapsed_cycles)
+    {
+        m_prof->cycles[m_prof->last] += elapsed_cycles - m_prof->lastElapsed;
+        m_prof->last = pc & 0xffff;
+        m_prof->lastElapsed = elapsed_cycles;
+        m_prof->count[m_prof->last]++;
+    }
+    int Z80ProfileCall (void);
+
     void PatchL2 (void);
     void PatchL3 (void);
     void PatchL4 (void);
     void PatchL5 (void);
     void PatchL6 (void);
     void PatchColor (unsigned char low_getvar);
+    void Poke (unsigned short offset, unsigned char data)
+    {
+        m_context.memory[offset] = data;
+        Z80Written (offset);
+    }
 
     virtual unsigned char inputZ80(unsigned char data);
 
@@ -67,10 +182,12 @@ public:
     {
 #ifdef Z80_HANDLE_SELF_MODIFYING_CODE
         m_context.memory[(offset)] = data;
+        Z80Written (offset);
 #else
         if ((offset) >= WORKRAM)
         {
             m_context.memory[(offset)] = data;
+            Z80Written (offset);
         }
         else
         {
@@ -85,11 +202,15 @@ public:
 #ifdef Z80_HANDLE_SELF_MODIFYING_CODE
         m_context.memory[(offset)] = data & 0xff;
         m_context.memory[(offset + 1)] = (data << 8) & 0xff;
+        Z80Written (offset);
+        Z80Written (offset + 1);
 #else
         if ((offset) >= WORKRAM)
         {
             m_context.memory[(offset)] = data & 0xff;
             m_context.memory[(offset + 1)] = (data >> 8) & 0xff;
+            Z80Written (offset);
+            Z80Written (offset + 1);
         }
         else
         {
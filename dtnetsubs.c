@@ -48,8 +48,17 @@
     #include <sys/socket.h>
     #include <netdb.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #include <pthread.h>
+    #include <sys/mman.h>
+#if defined(__linux__)
+    #include <sys/syscall.h>
+#endif
+#endif
+#if defined(DT_REACTOR)
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
 #endif
 
 /*
@@ -64,6 +73,8 @@
 **  -----------------
 */
 #define dtNC -1   /* connFd value for "socket was closed" */
+#define dtRaceDelay     250     /* ms between connection attempts */
+#define dtRaceTimeout   30000   /* ms before giving up on all of them */
 
 /*
 **  -----------------------
@@ -87,14 +98,27 @@
 **  ---------------------------
 */
 static dtThreadFun (dtThread, param);
+#if defined(DT_REACTOR)
+static int dtReactorAdd (NetFet *fet);
+static dtThreadFun (dtReactorThread, param);
+static void dtReactorEvent (NetFet *fet, u32 events);
+static bool dtReactorSend (NetFet *fet);
+static void dtReactorResume (NetFet *list);
+static void dtReactorSweep (NetFet **list);
+#else
 static dtThreadFun (dtDataThread, param);
 static dtThreadFun (dtSendThread, param);
+#endif
 static int dtBindSocket  (in_addr_t host, int port, int backlog);
+static int dtMsNow (void);
+static void dtSetBlocking (int connFd, bool block);
 static NetFet * dtAcceptSocket (int connFd, NetPortSet *ps);
 static void dtCloseSocket (int connFd, bool hard);
 static int dtGetw (NetFet *fet, void *buf, int len, bool read);
 static int dtSendo (NetFet *fet, u8 byte);
 static NetFet * dtNewFet (int fd, NetPortSet *ps, bool listen);
+static u8 * dtMirrorAlloc (int *size);
+static void dtFreeFet (NetFet *fet);
 static void dtActivateFet2 (NetFet *fet);
 
 /*
@@ -120,6 +144,12 @@ static pthread_attr_t dt_tattr;
 static const int true_opt = 1;
 #endif
 static bool dtInited;
+#if defined(DT_REACTOR)
+static int dtEpollFd = -1;              /* epoll instance of the reactor */
+static int dtWakeFd = -1;               /* eventfd for waking the reactor */
+static pthread_mutex_t dtReactorLock;   /* Reactor startup, new FETs, close */
+static NetFet *dtReactorNew;            /* FETs not yet seen by reactor */
+#endif
 
 /*
 **--------------------------------------------------------------------------
@@ -145,6 +175,9 @@ void dtInit (void)
 #if !defined(_WIN32)
         pthread_attr_init (&dt_tattr);
         pthread_attr_setdetachstate (&dt_tattr, PTHREAD_CREATE_JOINABLE);
+#endif
+#if defined(DT_REACTOR)
+        pthread_mutex_init (&dtReactorLock, NULL);
 #endif
         }
     }
@@ -236,6 +269,341 @@ NetFet * dtConnect (NetPortSet *ps, in_addr_t host, int port)
     return fet;
     }
 
+/*--------------------------------------------------------------------------
+**  Purpose:        Look up the addresses of a host
+**
+**  Parameters:     Name        Description.
+**                  host        Host name or numeric address
+**                  port        Port number to put in the addresses
+**                  addrs       Array to fill in
+**                  max         Size of that array
+**
+**  Returns:        Number of addresses found, 0 if the name is unknown.
+**
+**  Both IPv4 and IPv6 addresses are returned, where available.  They
+**  are put in the order dtConnectRace should try them: starting with
+**  the family the resolver put first, then alternating families
+**  (RFC 8305 section 4), so a broken path for one family only costs
+**  one attempt delay.  This call blocks, so don't use it in the GUI
+**  thread.
+**
+**------------------------------------------------------------------------*/
+int dtResolve (const char *host, int port, DtAddr *addrs, int max)
+#if defined(_WIN32)
+    {
+    struct hostent *hp;
+    int count;
+
+    hp = gethostbyname (host);
+    if (hp == NULL || hp->h_addrtype != AF_INET)
+        {
+        return 0;
+        }
+    for (count = 0; count < max && hp->h_addr_list[count] != NULL; count++)
+        {
+        memset (&addrs[count], 0, sizeof (DtAddr));
+        addrs[count].u.sin.sin_family = AF_INET;
+        addrs[count].u.sin.sin_port = htons (port);
+        memcpy (&addrs[count].u.sin.sin_addr, hp->h_addr_list[count], 4);
+        addrs[count].len = sizeof (struct sockaddr_in);
+        }
+    return count;
+    }
+#else
+    {
+    struct addrinfo hints, *res, *ai;
+    DtAddr first[DtMaxAddrs], other[DtMaxAddrs];
+    int nfirst = 0, nother = 0, count = 0;
+    int family = AF_UNSPEC;
+    char portstr[8];
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    sprintf (portstr, "%d", port);
+    if (getaddrinfo (host, portstr, &hints, &res) != 0)
+        {
+        return 0;
+        }
+
+    /*
+    **  Sort the addresses into the first family seen and the other one.
+    */
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+        {
+        if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) ||
+            ai->ai_addrlen > sizeof (first[0].u))
+            {
+            continue;
+            }
+        if (family == AF_UNSPEC)
+            {
+            family = ai->ai_family;
+            }
+        if (ai->ai_family == family && nfirst < DtMaxAddrs)
+            {
+            memcpy (&first[nfirst].u, ai->ai_addr, ai->ai_addrlen);
+            first[nfirst++].len = ai->ai_addrlen;
+            }
+        else if (ai->ai_family != family && nother < DtMaxAddrs)
+            {
+            memcpy (&other[nother].u, ai->ai_addr, ai->ai_addrlen);
+            other[nother++].len = ai->ai_addrlen;
+            }
+        }
+    freeaddrinfo (res);
+
+    /*
+    **  Now interleave them.
+    */
+    while (count < max && (nfirst > 0 || nother > 0))
+        {
+        if (nfirst > 0)
+            {
+            addrs[count++] = first[0];
+            memmove (first, first + 1, --nfirst * sizeof (DtAddr));
+            }
+        if (count < max && nother > 0)
+            {
+            addrs[count++] = other[0];
+            memmove (other, other + 1, --nother * sizeof (DtAddr));
+            }
+        }
+    return count;
+    }
+#endif
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Establish an outbound connection to the first of
+**                  several addresses that answers
+**
+**  Parameters:     Name        Description.
+**                  ps          Pointer to NetPortSet to use
+**                  addrs       Addresses to try, in order (see dtResolve)
+**                  count       Number of addresses
+**                  cancel      Pointer to a flag another thread may set
+**                              to stop trying, or NULL
+**                  which       Pointer to where to return the index of
+**                              the address that answered, or NULL
+**
+**  Returns:        Pointer to NetFet, or NULL if failure (all attempts
+**                  failed, timed out, or were canceled)
+**
+**  This is "Happy Eyeballs" (RFC 8305) connection racing: an attempt is
+**  started for the next address every dtRaceDelay ms, or right away
+**  when one fails, while the earlier ones are still in progress.  The
+**  first connection to complete wins and the others are abandoned, so
+**  a dead address costs a fraction of a second rather than a full TCP
+**  connect timeout.  This call blocks, so don't use it in the GUI
+**  thread.
+**
+**------------------------------------------------------------------------*/
+NetFet * dtConnectRace (NetPortSet *ps, const DtAddr *addrs, int count,
+                        volatile int *cancel, int *which)
+    {
+    int fds[DtMaxAddrs];
+    int next = 0, pending = 0, winner = -1;
+    int i, fd, err, maxfd;
+    int start, now, nextStart, wait;
+    socklen_t errlen;
+    fd_set wfds, efds;
+    struct timeval tv;
+    NetFet *fet;
+
+    if (count > DtMaxAddrs)
+        {
+        count = DtMaxAddrs;
+        }
+    start = nextStart = dtMsNow ();
+    dtErrno = ETIMEDOUT;
+    
+    while (winner < 0)
+        {
+        now = dtMsNow ();
+        if ((cancel != NULL && *cancel) || now - start >= dtRaceTimeout)
+            {
+            break;
+            }
+        
+        /*
+        **  Start the next attempt if it is time for it, or if nothing
+        **  is in progress any more.
+        */
+        if (next < count && (pending == 0 || now - nextStart >= 0))
+            {
+            i = next++;
+            nextStart = now + dtRaceDelay;
+            fds[i] = fd = socket (addrs[i].u.sa.sa_family, SOCK_STREAM, 0);
+            if (fd < 0)
+                {
+                dtErrno = errno;
+                fds[i] = dtNC;
+                continue;
+                }
+            dtSetBlocking (fd, FALSE);
+            if (connect (fd, &addrs[i].u.sa, addrs[i].len) == 0)
+                {
+                winner = i;
+                break;
+                }
+#if defined(_WIN32)
+            err = WSAGetLastError ();
+            if (err != WSAEWOULDBLOCK)
+#else
+            err = errno;
+            if (err != EINPROGRESS)
+#endif
+                {
+                dtErrno = err;
+                dtCloseSocket (fd, TRUE);
+                fds[i] = dtNC;
+                continue;
+                }
+            pending++;
+            }
+        if (pending == 0)
+            {
+            if (next == count)
+                {
+                /*
+                **  Every address failed.
+                */
+                break;
+                }
+            continue;
+            }
+
+        /*
+        **  Wait for a connection attempt to finish, until it is time
+        **  to start the next one.  Wake up now and then regardless, to
+        **  check for cancel.
+        */
+        FD_ZERO (&wfds);
+        FD_ZERO (&efds);
+        maxfd = 0;
+        for (i = 0; i < next; i++)
+            {
+            if (fds[i] != dtNC)
+                {
+                FD_SET (fds[i], &wfds);
+                FD_SET (fds[i], &efds);
+                if (fds[i] > maxfd)
+                    {
+                    maxfd = fds[i];
+                    }
+                }
+            }
+        wait = (next < count) ? nextStart - now : 100;
+        if (wait > 100)
+            {
+            wait = 100;
+            }
+        if (wait < 0)
+            {
+            wait = 0;
+            }
+        tv.tv_sec = 0;
+        tv.tv_usec = wait * 1000;
+        if (select (maxfd + 1, NULL, &wfds, &efds, &tv) <= 0)
+            {
+            continue;
+            }
+        
+        for (i = 0; i < next; i++)
+            {
+            fd = fds[i];
+            if (fd == dtNC ||
+                (!FD_ISSET (fd, &wfds) && !FD_ISSET (fd, &efds)))
+                {
+                continue;
+                }
+            err = 0;
+            errlen = sizeof (err);
+            getsockopt (fd, SOL_SOCKET, SO_ERROR, (char *) &err, &errlen);
+            if (err == 0 && !FD_ISSET (fd, &efds))
+                {
+                winner = i;
+                break;
+                }
+            
+            /*
+            **  This one failed; go on to the next address right away.
+            */
+            dtErrno = (err != 0) ? err : ECONNREFUSED;
+            dtCloseSocket (fd, TRUE);
+            fds[i] = dtNC;
+            pending--;
+            nextStart = dtMsNow ();
+            }
+        }
+
+    /*
+    **  Abandon the attempts that didn't win.
+    */
+    for (i = 0; i < next; i++)
+        {
+        if (i != winner && fds[i] != dtNC)
+            {
+            dtCloseSocket (fds[i], TRUE);
+            }
+        }
+    if (winner < 0)
+        {
+        return NULL;
+        }
+
+    /*
+    **  We always want the data socket to be blocking since it will
+    **  be served by separate threads.
+    */
+    fd = fds[winner];
+    dtSetBlocking (fd, TRUE);
+    fet = dtNewFet (fd, ps, FALSE);
+    if (fet == NULL)
+        {
+        dtCloseSocket (fd, TRUE);
+        return NULL;
+        }
+    if (addrs[winner].u.sa.sa_family == AF_INET)
+        {
+        fet->from = addrs[winner].u.sin.sin_addr;
+        fet->fromPort = addrs[winner].u.sin.sin_port;
+        }
+    if (which != NULL)
+        {
+        *which = winner;
+        }
+    return fet;
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Format an address from dtResolve for display
+**
+**  Parameters:     Name        Description.
+**                  addr        Address
+**                  buf         Buffer for the string
+**                  len         Length of buffer
+**
+**  Returns:        buf
+**
+**------------------------------------------------------------------------*/
+const char *dtAddrString (const DtAddr *addr, char *buf, int len)
+    {
+#if defined(_WIN32)
+    const u8 *a = (const u8 *) &addr->u.sin.sin_addr;
+
+    _snprintf (buf, len, "%d.%d.%d.%d", a[0], a[1], a[2], a[3]);
+#else
+    if (getnameinfo (&addr->u.sa, addr->len, buf, len, NULL, 0,
+                     NI_NUMERICHOST) != 0)
+        {
+        buf[0] = '\0';
+        }
+#endif
+    return buf;
+    }
+
 /*--------------------------------------------------------------------------
 **  Purpose:        Create a thread.
 **
@@ -330,6 +698,10 @@ int dtCreateThread (dtThreadFunPtr (fp), void *param, pthread_t *id)
 **                  FALSE to allow connections from anywhere.
 **      ringSize    FET receive buffer size for each port.
 **      sendringSize FET transmit buffer size for each port.
+**      mirrorRing  TRUE to map the receive buffer twice in a row,
+**                  so the data in it is always contiguous (see
+**                  dtMirrorAlloc).  ringSize is rounded up to a
+**                  multiple of the page size if so.
 **
 **  The other fields of the NetPortSet struct are filled in by this function,
 **  or by the thread it creates that actually does the listening to
@@ -512,19 +884,43 @@ void dtClose (NetFet *fet, bool hard)
     */
     if (fet->closing != 1)
         {
+#if defined(DT_REACTOR)
+        /*
+        **  The reactor must not touch the descriptor while we close it,
+        **  or it might end up operating on a new socket that reused it.
+        */
+        pthread_mutex_lock (&dtReactorLock);
+#endif
         dtCloseSocket (fet->connFd, hard);
         fet->connFd = dtNC;        /* Indicate connection is closed */
+#if defined(DT_REACTOR)
+        pthread_mutex_unlock (&dtReactorLock);
+#endif
         }
 
     /*
     **  If we have threads, tell the threads to go away.  (If there is
     **  no send thread, that part is a NOP).  The receive thread will
-    **  free the FET.
+    **  free the FET.  It may be waiting for ring space or for this
+    **  close, so wake it up first.
     */
     if (useThread)
         {
+#if defined(DT_REACTOR)
+        sem_post (rsemp (fet));
+        dtReactorWake ();
+#else
+#if defined(__APPLE__)
+        if (fsemp (fet) != NULL)
+            {
+            sem_post (fsemp (fet));
+            }
+#else
+        sem_post (fsemp (fet));
+#endif
         sem_post (ssemp (fet));
         sem_post (rsemp (fet));
+#endif
         }
 
     /*
@@ -532,7 +928,7 @@ void dtClose (NetFet *fet, bool hard)
     */
     if (!useThread)
         {
-        free (fet);
+        dtFreeFet (fet);
         }
     }
 
@@ -865,7 +1261,9 @@ int dtSend (NetFet *fet, const void *buf, int len)
     ** Update the IN pointer, then wake the send thread.
     */
     fet->sendin = in;
-#if defined(__APPLE__)
+#if defined(DT_REACTOR)
+    dtReactorWake ();
+#elif defined(__APPLE__)
     if (ssemp (fet) != NULL)
     {
         sem_post (ssemp (fet));
@@ -981,6 +1379,7 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
     int rsize, tsize, fsize;
     int rc;
     int psi = -1;
+    u8 *mirror;
 
     /*
     **  Find an empty slot in the portVec.
@@ -1002,19 +1401,39 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
         tsize = ps->sendRingSize;
 
         /*
-        **  Set Keepalive if not a listen socket
+        **  Set Keepalive if not a listen socket.  Also turn off the
+        **  Nagle algorithm; the traffic is interactive, and callers
+        **  that have a lot to send give it to dtSend in big pieces.
         */
         setsockopt(connFd, SOL_SOCKET, SO_KEEPALIVE,
                    (char *) &true_opt, sizeof (true_opt));
+        setsockopt(connFd, IPPROTO_TCP, TCP_NODELAY,
+                   (char *) &true_opt, sizeof (true_opt));
         }
     
+    /*
+    **  If asked for, get a double-mapped receive ring.  If that can't
+    **  be done, fall back to the ordinary kind.
+    */
+    mirror = NULL;
+    if (rsize > 0 && ps->mirrorRing)
+        {
+        mirror = dtMirrorAlloc (&rsize);
+        }
+
     /*
     **  Figure out the FET size, and allocate it.
     */
-    fsize = sizeof (NetFet) + rsize + tsize;
+    fsize = sizeof (NetFet) + ((mirror != NULL) ? 0 : rsize) + tsize;
     fet = (NetFet *) malloc (fsize);
     if (fet == NULL)
         {
+#if !defined(_WIN32)
+        if (mirror != NULL)
+            {
+            munmap (mirror, 2 * rsize);
+            }
+#endif
         dtErrno = ENOMEM;
         return NULL;
         }
@@ -1032,17 +1451,31 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
     **  Initialize the ring pointers.  The receive and transmit rings
     **  go after the base NetFet in the same memory block.
     */
-    fet->in = fet->out = fet->first = (u8 *) fet + sizeof (NetFet);
-    fet->sendin = fet->sendout = fet->sendfirst = fet->end = fet->first + rsize;
+    if (mirror != NULL)
+        {
+        fet->in = fet->out = fet->first = mirror;
+        fet->end = mirror + rsize;
+        fet->mirror = TRUE;
+        fet->sendin = fet->sendout = fet->sendfirst = 
+            (u8 *) fet + sizeof (NetFet);
+        }
+    else
+        {
+        fet->in = fet->out = fet->first = (u8 *) fet + sizeof (NetFet);
+        fet->sendin = fet->sendout = fet->sendfirst = fet->end = 
+            fet->first + rsize;
+        }
     fet->sendend = fet->sendfirst + tsize;
     
 #ifdef __APPLE__
     /* Semaphores are initialized in the thread that uses them. */
     rsemp (fet) = NULL;
     ssemp (fet) = NULL;
+    fsemp (fet) = NULL;
 #else
     sem_init (rsemp (fet), 0, 0);
     sem_init (ssemp (fet), 0, 0);
+    sem_init (fsemp (fet), 0, 0);
 #endif
     
     /*
@@ -1056,6 +1489,25 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
         ps->curPorts++;
         }
     
+#if defined(DT_REACTOR)
+    /*
+    **  Hand the connection to the reactor thread, which does the
+    **  receive and transmit work for all of them.  The socket has to
+    **  be non-blocking for that.
+    */
+    if (rsize > 0)
+        {
+        fcntl (connFd, F_SETFL, O_NONBLOCK);
+        rc = dtReactorAdd (fet);
+        if (rc != 0)
+            {
+            dtErrno = rc;
+            fet->sendend = fet->first;      /* Not in the reactor */
+            dtClose (fet, TRUE);
+            return NULL;
+            }
+        }
+#else
     /*
     **  Create the data receive and transmit threads, if needed
     */
@@ -1081,6 +1533,7 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
             return NULL;
             }
         }
+#endif
 
     /* 
     ** Tell connection watcher (like operators) about the new connection
@@ -1103,6 +1556,52 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
     return fet;
     }
 
+#if defined(DT_REACTOR)
+/*--------------------------------------------------------------------------
+**  Purpose:        Wake the reactor thread
+**
+**  Parameters:     none
+**
+**  Returns:        nothing
+**
+**  The reactor looks at all its connections each time it wakes up,
+**  so this is used whenever something changed that it needs to act
+**  on: new data in a send ring, space in a receive ring, a close.
+**
+**------------------------------------------------------------------------*/
+void dtReactorWake (void)
+    {
+    u64 one = 1;
+
+    if (write (dtWakeFd, &one, sizeof (one)) < 0)
+        {
+        /*
+        **  Only fails if the counter would overflow, in which case
+        **  the reactor has plenty of wakeups pending already.
+        */
+        }
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Stop reading from a connection for now
+**
+**  Parameters:     Name        Description.
+**                  fet         NetFet pointer
+**
+**  Returns:        nothing
+**
+**  For use by a data callback that has nowhere to put more data; it
+**  must not wait for room, since the reactor thread it runs on serves
+**  every connection.  No more data is read for the FET until the next
+**  dtReactorWake, after which the callback is called again.
+**
+**------------------------------------------------------------------------*/
+void dtReadHold (NetFet *fet)
+    {
+    fet->rhold = TRUE;
+    }
+#endif
+
 /*
 **--------------------------------------------------------------------------
 **
@@ -1119,9 +1618,11 @@ NetFet * dtNewFet (int connFd, NetPortSet *ps, bool listen)
 **
 **  Returns:        >=0 if ok, value is count of bytes received
 **                  -1 if disconnected
-**                  -2 if some other error
+**                  -2 if some other error, or no data on a
+**                     non-blocking socket
 **
-**  This function waits for data or error.
+**  This function waits for data or error, unless the socket is
+**  non-blocking (reactor mode).
 **
 **------------------------------------------------------------------------*/
 static int dtRead (NetFet *fet)
@@ -1136,7 +1637,16 @@ static int dtRead (NetFet *fet)
     in = (u8 *) (fet->in);
     out = (u8 *) (fet->out);
 
-    if (in < out)
+    if (fet->mirror)
+        {
+        /*
+        **  The ring is mapped twice in a row, so all of the free space
+        **  is contiguous starting at the in pointer.
+        */
+        size = (out > in) ? out - in - 1 
+                          : (fet->end - fet->first) - (in - out) - 1;
+        }
+    else if (in < out)
         {
         /*
         **  If the out pointer is beyond the in pointer, we can
@@ -1170,13 +1680,19 @@ static int dtRead (NetFet *fet)
     if (i > 0)
         {
         nextin = in + i;
-        if (nextin == fet->end)
+        if (nextin >= fet->end)
             {
-            nextin = fet->first;
+            nextin -= fet->end - fet->first;
             }
         fet->in = nextin;
         return i;
         }
+#if defined(DT_REACTOR)
+    else if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+        return -2;
+        }
+#endif
     else
         {
         return(-1);
@@ -1247,6 +1763,7 @@ static dtThreadFun (dtThread, param)
         }
     }
 
+#if !defined(DT_REACTOR)
 /*--------------------------------------------------------------------------
 **  Purpose:        Thread for listening for new data on a connection
 **
@@ -1265,8 +1782,9 @@ static dtThreadFun (dtDataThread, param)
     struct pollfd pfd;
 #ifdef __APPLE__
     char semname[64];
+    char fsemname[64];
 
-    /* Initialize the semaphore */
+    /* Initialize the semaphores */
     sprintf (semname, "/dtrsem_%p", np);
     rsemp (np) = sem_open (semname, O_CREAT, 0600, 0);
     if (rsemp (np) == (void *) SEM_FAILED)
@@ -1274,6 +1792,13 @@ static dtThreadFun (dtDataThread, param)
         perror ("sem_open failed");
         exit (1);
     }
+    sprintf (fsemname, "/dtfsem_%p", np);
+    fsemp (np) = sem_open (fsemname, O_CREAT, 0600, 0);
+    if (fsemp (np) == (void *) SEM_FAILED)
+    {
+        perror ("sem_open failed");
+        exit (1);
+    }
 #endif
     
     /*
@@ -1325,14 +1850,12 @@ static dtThreadFun (dtDataThread, param)
         if (!(np->connected))
             {
             /*
-            **  If connection was closed by other end earlier, sleep
-            **  a second to let other threads see it and deal with it.
+            **  If connection was closed by other end earlier, the
+            **  callback has been told already.  Wait for dtClose to
+            **  wake us, then go back to the top to exit.
             */
-#if defined(_WIN32)
-            Sleep (1000);
-#else
-            usleep (10000000);
-#endif
+            sem_wait (fsemp (np));
+            continue;
             }
         else
             {
@@ -1351,16 +1874,19 @@ static dtThreadFun (dtDataThread, param)
             else if (bytes == 0)
                 {
                 /*
-                **  Buffer is full.
-                **  Sleep 10 ms to let other threads see it and deal with it.
-                **  Note: we want to sleep only briefly, otherwise when there
-                **  is a flood of traffic we may keep falling behind.
+                **  Buffer is full.  Wait for the reader to take some
+                **  data out; it posts the semaphore when it advances
+                **  "out" and sees the wait flag.  The flag is set before
+                **  the check, so a read that happens in between is not
+                **  missed (it just costs one extra trip around the loop).
                 */
-#if defined(_WIN32)
-                Sleep (10);
-#else
-                usleep (100000);
-#endif
+                np->rcvWait = TRUE;
+                dtMemBarrier ();
+                if (dtFull (np) && dtActive (np))
+                    {
+                    sem_wait (fsemp (np));
+                    }
+                np->rcvWait = FALSE;
                 }
             else if (bytes < 0)
                 {
@@ -1417,12 +1943,15 @@ static dtThreadFun (dtDataThread, param)
 #if !defined(__APPLE__)
     sem_destroy (rsemp (np));
     sem_destroy (ssemp (np));
+    sem_destroy (fsemp (np));
 #else
     sem_close (rsemp (np));
     sem_unlink (semname);
+    sem_close (fsemp (np));
+    sem_unlink (fsemname);
 #endif
     
-    free (np);
+    dtFreeFet (np);
 
     ThreadReturn;
     }
@@ -1551,13 +2080,459 @@ static dtThreadFun (dtSendThread, param)
     ThreadReturn;
     }
 
+#endif /* !DT_REACTOR */
+
+#if defined(DT_REACTOR)
 /*--------------------------------------------------------------------------
-**  Purpose:        Open a network socket to listen
+**  Purpose:        Give a new connection to the reactor thread
 **
 **  Parameters:     Name        Description.
-**                  host        IP address to listen to (0.0.0.0 or 127.0.0.1)
-**                  port        Port number to connect to
-**                  backlog     Listen backlog
+**                  fet         NetFet pointer
+**
+**  Returns:        0 if ok, errno value if the reactor could not
+**                  be started.
+**
+**  The reactor (epoll instance, wakeup eventfd and thread) is started
+**  when the first connection is made.
+**
+**------------------------------------------------------------------------*/
+static int dtReactorAdd (NetFet *fet)
+    {
+    struct epoll_event ev;
+    int rc = 0;
+
+    pthread_mutex_lock (&dtReactorLock);
+    if (dtEpollFd < 0)
+        {
+        dtEpollFd = epoll_create1 (EPOLL_CLOEXEC);
+        dtWakeFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;             /* NULL means the wakeup fd */
+        if (dtEpollFd < 0 || dtWakeFd < 0 ||
+            epoll_ctl (dtEpollFd, EPOLL_CTL_ADD, dtWakeFd, &ev) < 0)
+            {
+            rc = errno;
+            }
+        else
+            {
+            rc = dtCreateThread (dtReactorThread, NULL, NULL);
+            }
+        if (rc != 0)
+            {
+            perror ("dtReactorAdd: Can't start reactor");
+            if (dtEpollFd >= 0)
+                {
+                close (dtEpollFd);
+                }
+            if (dtWakeFd >= 0)
+                {
+                close (dtWakeFd);
+                }
+            dtEpollFd = dtWakeFd = -1;
+            pthread_mutex_unlock (&dtReactorLock);
+            return rc;
+            }
+        }
+
+    /*
+    **  Queue the FET; the reactor moves it to its own list when it
+    **  wakes up.
+    */
+    fet->rnext = dtReactorNew;
+    dtReactorNew = fet;
+    pthread_mutex_unlock (&dtReactorLock);
+    dtReactorWake ();
+
+    return 0;
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Reactor thread, servicing all connections
+**
+**  Parameters:     Name        Description.
+**                  param       unused
+**
+**  Returns:        Nothing.
+**
+**  This does the work of dtDataThread and dtSendThread for every FET,
+**  using level-triggered epoll on non-blocking sockets.  After each
+**  batch of events it sweeps the list of FETs to finish closes, free
+**  FETs released by dtClose, and set which events each one wants.
+**
+**------------------------------------------------------------------------*/
+static dtThreadFun (dtReactorThread, param)
+    {
+    struct epoll_event events[64];
+    NetFet *fets = NULL;
+    NetFet *fet;
+    u64 count;
+    int i, n;
+
+    (void) param;
+    
+    while (emulationActive)
+        {
+        n = epoll_wait (dtEpollFd, events, 64, -1);
+        for (i = 0; i < n; i++)
+            {
+            fet = (NetFet *) events[i].data.ptr;
+            if (fet == NULL)
+                {
+                /*
+                **  Wakeup request; the sweep below does the work.
+                */
+                if (read (dtWakeFd, &count, sizeof (count)) < 0)
+                    {
+                    /* Nothing pending, that's fine. */
+                    }
+                continue;
+                }
+            dtReactorEvent (fet, events[i].events);
+            }
+        dtReactorResume (fets);
+
+        pthread_mutex_lock (&dtReactorLock);
+        while (dtReactorNew != NULL)
+            {
+            fet = dtReactorNew;
+            dtReactorNew = fet->rnext;
+            fet->rnext = fets;
+            fets = fet;
+            }
+        dtReactorSweep (&fets);
+        pthread_mutex_unlock (&dtReactorLock);
+        }
+
+    ThreadReturn;
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Handle epoll events for one connection
+**
+**  Parameters:     Name        Description.
+**                  np          NetFet pointer
+**                  events      epoll event bits
+**
+**  Returns:        Nothing.
+**
+**------------------------------------------------------------------------*/
+static void dtReactorEvent (NetFet *np, u32 events)
+    {
+    NetPortSet *ps = np->ps;
+    bool broken;
+    int bytes;
+
+    if (np->closing == 2)
+        {
+        return;
+        }
+
+    if (!np->ractive)
+        {
+        /*
+        **  Socket is writable (or failed), so the connect is complete.
+        **  As in dtDataThread, a failure marks the FET for close
+        **  instead of activating it.
+        */
+        if (events & (EPOLLHUP | EPOLLERR))
+            {
+            np->closing = 2;
+            }
+        else
+            {
+            np->ractive = TRUE;
+            dtActivateFet2 (np);
+            }
+        return;
+        }
+
+    if ((events & (EPOLLHUP | EPOLLERR)) && !np->connected)
+        {
+        /*
+        **  Nobody left to send to, so drop anything still queued,
+        **  otherwise the hangup would keep firing.
+        */
+        np->sendout = np->sendin;
+        return;
+        }
+    
+    /*
+    **  The socket calls are made holding dtReactorLock, so dtClose
+    **  can't close the descriptor (and a new connection reuse it) in
+    **  the middle of one.  The lock is dropped again before calling
+    **  back, since the callback may well call dtClose.
+    */
+    if (events & EPOLLOUT)
+        {
+        pthread_mutex_lock (&dtReactorLock);
+        broken = dtReactorSend (np);
+        pthread_mutex_unlock (&dtReactorLock);
+        if (broken && ps->dataCallBack != NULL)
+            {
+            (*ps->dataCallBack) (np, -1, ps->dataCallArg);
+            }
+        }
+    
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+        np->connected && np->closing == 0 && !np->rhold)
+        {
+        pthread_mutex_lock (&dtReactorLock);
+        bytes = (np->connFd == dtNC) ? -2 : dtRead (np);
+        pthread_mutex_unlock (&dtReactorLock);
+        if (bytes == -2)
+            {
+            /*
+            **  Nothing there after all, or closed meanwhile.
+            */
+            return;
+            }
+        if (bytes == -1)
+            {
+            /*
+            **  Indicate connection closed by other end.
+            */
+            np->connected = FALSE;
+            }
+        if (bytes != 0 && ps->dataCallBack != NULL)
+            {
+            (*ps->dataCallBack) (np, bytes, ps->dataCallArg);
+            }
+        }
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Send as much pending transmit data as the socket takes
+**
+**  Parameters:     Name        Description.
+**                  np          NetFet pointer
+**
+**  Returns:        TRUE if the connection broke, which the caller
+**                  reports to the data callback.
+**
+**  Called with dtReactorLock held.
+**
+**------------------------------------------------------------------------*/
+static bool dtReactorSend (NetFet *np)
+    {
+    u8 *in, *out, *nextout;
+    int size;
+    int bytes;
+
+    if (np->connFd == dtNC)
+        {
+        return FALSE;
+        }
+    
+    while (!dtSendEmpty (np))
+        {
+        /*
+        **  Copy the pointers, since they are volatile.
+        */
+        in = (u8 *) (np->sendin);
+        out = (u8 *) (np->sendout);
+
+        if (out < in)
+            {
+            size = in - out;
+            }
+        else
+            {
+            size = np->sendend - out;
+            }
+        bytes = send (np->connFd, out, size, MSG_NOSIGNAL);
+        if (bytes < 0)
+            {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                return FALSE;
+                }
+            
+            /*
+            **  The connection is broken.  Throw away what's left, and
+            **  report it the way a close by the other end is reported.
+            */
+            np->sendout = np->sendin;
+            if (np->connected)
+                {
+                np->connected = FALSE;
+                return TRUE;
+                }
+            return FALSE;
+            }
+        nextout = out + bytes;
+        if (nextout == np->sendend)
+            {
+            nextout = np->sendfirst;
+            }
+        np->sendout = nextout;
+        }
+
+    return FALSE;
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Call back again for connections put on hold
+**
+**  Parameters:     Name        Description.
+**                  list        Head of the reactor's FET list
+**
+**  Returns:        Nothing.
+**
+**  A data callback that can't take any more data right now calls
+**  dtReadHold rather than waiting, since that would stall every other
+**  connection.  Reading stops until the owner makes room and calls
+**  dtReactorWake, which gets us here to offer the data again.  If
+**  there is still no room the callback simply holds again.  Only the
+**  reactor thread changes the list, so no lock is needed to walk it.
+**
+**------------------------------------------------------------------------*/
+static void dtReactorResume (NetFet *list)
+    {
+    NetPortSet *ps;
+    NetFet *np;
+
+    for (np = list; np != NULL; np = np->rnext)
+        {
+        if (!np->rhold)
+            {
+            continue;
+            }
+        np->rhold = FALSE;
+        ps = np->ps;
+        if (np->closing == 0 && ps->dataCallBack != NULL)
+            {
+            (*ps->dataCallBack) (np, dtFetData (np), ps->dataCallArg);
+            }
+        }
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Update the reactor's connections after events
+**
+**  Parameters:     Name        Description.
+**                  list        Pointer to head of the reactor's FET list
+**
+**  Returns:        Nothing.
+**
+**  Called with dtReactorLock held, so dtClose isn't closing sockets
+**  while we look at them.
+**
+**------------------------------------------------------------------------*/
+static void dtReactorSweep (NetFet **list)
+    {
+    struct epoll_event ev;
+    NetFet *np;
+    u32 mask;
+    int op;
+
+    while ((np = *list) != NULL)
+        {
+        /*
+        **  A soft close (shutdown) is done once the send ring is empty.
+        */
+        if (np->closing == 1 && dtSendEmpty (np))
+            {
+            if (np->rmask != 0)
+                {
+                epoll_ctl (dtEpollFd, EPOLL_CTL_DEL, np->connFd, NULL);
+                np->rmask = 0;
+                }
+            dtCloseSocket (np->connFd, FALSE);
+            np->connFd = dtNC;          /* Indicate socket is closed */
+            np->closing = 2;
+            }
+
+        if (np->closing == 2)
+            {
+            /*
+            **  Stop watching the socket.  If dtClose closed it, that
+            **  removed it from the epoll set already.
+            */
+            if (np->rmask != 0 && np->connFd != dtNC)
+                {
+                epoll_ctl (dtEpollFd, EPOLL_CTL_DEL, np->connFd, NULL);
+                }
+            np->rmask = 0;
+
+            /*
+            **  Free the FET once dtClose says we may.
+            */
+            if (sem_trywait (rsemp (np)) == 0)
+                {
+                *list = np->rnext;
+                sem_destroy (rsemp (np));
+                sem_destroy (ssemp (np));
+                sem_destroy (fsemp (np));
+                dtFreeFet (np);
+                continue;
+                }
+            list = &np->rnext;
+            continue;
+            }
+
+        /*
+        **  Work out which events we want now.  Until the connection is
+        **  activated, that's writable (connect complete).  Then it is
+        **  readable if there is room in the receive ring (if not, the
+        **  reader wakes us when it makes room) and the owner hasn't
+        **  put it on hold, and writable if there is data to send.
+        */
+        mask = 0;
+        if (!np->ractive)
+            {
+            mask = EPOLLOUT;
+            }
+        else
+            {
+            if (np->connected && np->closing == 0 && !np->rhold)
+                {
+                np->rcvWait = TRUE;
+                dtMemBarrier ();
+                if (!dtFull (np))
+                    {
+                    np->rcvWait = FALSE;
+                    mask |= EPOLLIN;
+                    }
+                }
+            if (!dtSendEmpty (np))
+                {
+                mask |= EPOLLOUT;
+                }
+            }
+
+        if (mask != np->rmask && np->connFd != dtNC)
+            {
+            if (np->rmask == 0)
+                {
+                op = EPOLL_CTL_ADD;
+                }
+            else if (mask == 0)
+                {
+                op = EPOLL_CTL_DEL;
+                }
+            else
+                {
+                op = EPOLL_CTL_MOD;
+                }
+            memset (&ev, 0, sizeof (ev));
+            ev.events = mask;
+            ev.data.ptr = np;
+            epoll_ctl (dtEpollFd, op, np->connFd, &ev);
+            np->rmask = mask;
+            }
+        list = &np->rnext;
+        }
+    }
+#endif
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Open a network socket to listen
+**
+**  Parameters:     Name        Description.
+**                  host        IP address to listen to (0.0.0.0 or 127.0.0.1)
+**                  port        Port number to connect to
+**                  backlog     Listen backlog
 **
 **  Returns:        Socket number, or -1 if error.
 **
@@ -1659,6 +2634,157 @@ NetFet * dtAcceptSocket (int connFd, NetPortSet *ps)
     return acceptFet;
     }
 
+/*--------------------------------------------------------------------------
+**  Purpose:        Current time in milliseconds, for timeouts
+**
+**  Parameters:     none
+**
+**  Returns:        Millisecond count, from an arbitrary start
+**
+**------------------------------------------------------------------------*/
+static int dtMsNow (void)
+    {
+#if defined(_WIN32)
+    return (int) GetTickCount64 ();
+#else
+    struct timespec ts;
+
+    /*
+    **  Monotonic, so a change of the time of day doesn't upset the
+    **  timeouts.
+    */
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Set a socket to blocking or non-blocking
+**
+**  Parameters:     Name        Description.
+**                  connFd      socket fd
+**                  block       TRUE for blocking, FALSE for non-blocking
+**
+**  Returns:        Nothing.
+**
+**------------------------------------------------------------------------*/
+static void dtSetBlocking (int connFd, bool block)
+    {
+#if defined(_WIN32)
+    ioctlsocket (connFd, FIONBIO, block ? &false_opt : &true_opt);
+#else
+    fcntl (connFd, F_SETFL, block ? 0 : O_NONBLOCK);
+#endif
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Allocate a double-mapped receive ring
+**
+**  Parameters:     Name        Description.
+**                  size        Pointer to the ring size wanted; it is
+**                              rounded up to a multiple of the page size
+**
+**  Returns:        Pointer to the ring, or NULL if it can't be done.
+**
+**  The same memory is mapped twice, one copy right after the other,
+**  so the byte at first + n + ring size is the byte at first + n.
+**  That means the data in the ring, and the free space, are always
+**  contiguous: recv can fill all the free space in one call, and
+**  dtReadSpan can hand out all the data at once.  The in and out
+**  pointers still wrap at "end" as usual, so the other ring code
+**  works unchanged.  It also costs nothing to make the ring large.
+**
+**------------------------------------------------------------------------*/
+static u8 * dtMirrorAlloc (int *size)
+#if defined(_WIN32)
+    {
+    return NULL;
+    }
+#else
+    {
+#if !defined(__linux__) || !defined(SYS_memfd_create)
+    static int seq;
+    char name[32];
+#endif
+    long page;
+    int fd, len;
+    u8 *base;
+
+    page = sysconf (_SC_PAGESIZE);
+    len = (*size + page - 1) & ~(page - 1);
+
+    /*
+    **  Get an anonymous shared memory object of the ring size.
+    */
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = syscall (SYS_memfd_create, "dtring", 0);
+#else
+    sprintf (name, "/dtring.%d.%d", getpid (), __sync_fetch_and_add (&seq, 1));
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        {
+        shm_unlink (name);
+        }
+#endif
+    if (fd < 0)
+        {
+        return NULL;
+        }
+    if (ftruncate (fd, len) < 0)
+        {
+        close (fd);
+        return NULL;
+        }
+
+    /*
+    **  Reserve address space for two copies, then map the object
+    **  into each half.
+    */
+    base = mmap (NULL, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == MAP_FAILED)
+        {
+        close (fd);
+        return NULL;
+        }
+    if (mmap (base, len, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap (base + len, len, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+        munmap (base, 2 * len);
+        close (fd);
+        return NULL;
+        }
+
+    /*
+    **  The mappings keep the memory around, we don't need the fd.
+    */
+    close (fd);
+    *size = len;
+    return base;
+    }
+#endif
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Free a FET and its receive ring
+**
+**  Parameters:     Name        Description.
+**                  fet         NetFet pointer
+**
+**  Returns:        Nothing.
+**
+**------------------------------------------------------------------------*/
+static void dtFreeFet (NetFet *fet)
+    {
+#if !defined(_WIN32)
+    if (fet->mirror)
+        {
+        munmap (fet->first, 2 * (fet->end - fet->first));
+        }
+#endif
+    free (fet);
+    }
+
 /*--------------------------------------------------------------------------
 **  Purpose:        Close a network socket
 **
@@ -1712,6 +2838,26 @@ static int dtGetw (NetFet *fet, void *buf, int len, bool read)
         return -1;
         }
 
+    /*
+    **  With a double-mapped ring the data is contiguous, so it is one
+    **  copy and a wrap check on the pointer.
+    */
+    if (fet->mirror)
+        {
+        memcpy (to, out, len);
+        if (read)
+            {
+            out += len;
+            if (out >= fet->end)
+                {
+                out -= fet->end - fet->first;
+                }
+            fet->out = out;
+            dtRcvWake (fet);
+            }
+        return 0;
+        }
+
     /*
     **  We now know we have enough data to satisfy the request.
     **  See how many bytes there are between the current "out"
@@ -1742,6 +2888,10 @@ static int dtGetw (NetFet *fet, void *buf, int len, bool read)
         */
         if (len == 0)
             {
+            if (read)
+                {
+                dtRcvWake (fet);
+                }
             return 0;
             }
         }
@@ -1754,6 +2904,7 @@ static int dtGetw (NetFet *fet, void *buf, int len, bool read)
     if (read)
         {
         fet->out = out + len;
+        dtRcvWake (fet);
         }
     return 0;
     }
@@ -9,11 +9,32 @@
 
 extern bool emulationActive;
 
+/*
+**  Socket address of either family, as returned by dtResolve.
+*/
+#define DtMaxAddrs 16
+typedef struct DtAddr_s
+    {
+    union
+        {
+        struct sockaddr     sa;
+        struct sockaddr_in  sin;
+#if !defined(_WIN32)
+        struct sockaddr_in6 sin6;
+#endif
+        } u;
+    int         len;                    /* Length of the address */
+    } DtAddr;
+
 /*
 **  dtnetsubs.c
 */
 void dtInit(void);
 NetFet * dtConnect(NetPortSet *ps, in_addr_t host, int portnum);
+int dtResolve(const char *host, int port, DtAddr *addrs, int max);
+NetFet * dtConnectRace(NetPortSet *ps, const DtAddr *addrs, int count,
+                       volatile int *cancel, int *which);
+const char *dtAddrString(const DtAddr *addr, char *buf, int len);
 void dtInitPortset(NetPortSet *ps);
 void dtClose(NetFet *np, bool hard);
 
@@ -30,6 +51,10 @@ int dtReadw(NetFet *fet, void *buf, int len);
 int dtPeekw(NetFet *fet, void *buf, int len);
 int dtReadmax(NetFet *fet, void *buf, int len);
 int dtReadtlv(NetFet *fet, void *buf, int len);
+#if defined(DT_REACTOR)
+void dtReactorWake(void);
+void dtReadHold(NetFet *fet);
+#endif
 
 /* We could do these as functions but they are short, so... */
 #define dtEmpty(fet) \
@@ -59,9 +84,44 @@ int dtReadtlv(NetFet *fet, void *buf, int len);
 #define dtConnected(fet) \
     (dtActive (fet) && (fet)->connected)
 
+/*
+**  Full memory barrier, so that a ring pointer update is visible to
+**  the other thread before we look at its "waiting" flag.
+*/
+#if defined(_WIN32)
+#define dtMemBarrier() MemoryBarrier ()
+#else
+#define dtMemBarrier() __sync_synchronize ()
+#endif
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Wake the receive thread (or the reactor thread)
+**                  if it is waiting for space in the receive ring.
+**                  Called after "out" is advanced.
+**
+**  Parameters:     Name        Description.
+**                  fet         NetFet pointer
+**
+**  Returns:        nothing
+**
+**------------------------------------------------------------------------*/
+static inline void dtRcvWake (NetFet *fet)
+    {
+    dtMemBarrier ();
+    if (fet->rcvWait)
+        {
+        fet->rcvWait = FALSE;
+#if defined(DT_REACTOR)
+        dtReactorWake ();
+#else
+        sem_post (fsemp (fet));
+#endif
+        }
+    }
+
 /* This goes with dtReadoi */
 #define dtUpdateOut(fet,outidx) \
-    (fet)->out = (outidx) + fet->first
+    ((fet)->out = (outidx) + (fet)->first, dtRcvWake (fet))
 
 /*--------------------------------------------------------------------------
 **  Purpose:        Read one byte from the network buffer
@@ -97,7 +157,70 @@ static inline int dtReado (NetFet *fet)
         }
     b = *out;
     fet->out = nextout;
+    dtRcvWake (fet);
     return b;
     }
 
+/*--------------------------------------------------------------------------
+**  Purpose:        Find the data that can be read in place from the
+**                  network buffer, i.e., up to "in" or the end of the
+**                  ring, whichever comes first.  For a double-mapped
+**                  ring (see dtMirrorAlloc) that is all the data.
+**
+**  Parameters:     Name        Description.
+**                  fet         NetFet pointer
+**                  p           Pointer to where to return the data
+**                              pointer
+**
+**  Returns:        Number of bytes at *p.
+**
+**------------------------------------------------------------------------*/
+static inline int dtReadSpan (NetFet *fet, const u8 **p)
+    {
+    u8 *in, *out;
+    
+    /*
+    **  Copy the pointers, since they are volatile.
+    */
+    in = (u8 *) (fet->in);
+    out = (u8 *) (fet->out);
+
+    *p = out;
+    if (in >= out)
+        {
+        return in - out;
+        }
+
+    /*
+    **  The data wraps.  If the ring is double-mapped the rest of it
+    **  is right there anyway, otherwise stop at the end of the ring.
+    */
+    return (fet->mirror) ? fet->end - out + in - fet->first 
+                         : fet->end - out;
+    }
+
+/*--------------------------------------------------------------------------
+**  Purpose:        Discard bytes from the network buffer, typically
+**                  after using them in place (see dtReadSpan).
+**
+**  Parameters:     Name        Description.
+**                  fet         NetFet pointer
+**                  len         Number of bytes, no more than dtFetData
+**
+**  Returns:        nothing
+**
+**------------------------------------------------------------------------*/
+static inline void dtReadSkip (NetFet *fet, int len)
+    {
+    u8 *out;
+    
+    out = (u8 *) (fet->out) + len;
+    if (out >= fet->end)
+        {
+        out -= fet->end - fet->first;
+        }
+    fet->out = out;
+    dtRcvWake (fet);
+    }
+
 #endif /* DTNETSUBS_H */
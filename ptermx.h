@@ -27,6 +27,7 @@
 #define DEFAULTHOST     wxT ("cyberserv.org")
 #define DEFAULTSEARCH   wxT ("http://www.google.com/search?q=")
 #define BufSiz          4096  //  test drs 2048
+#define NetRingSize     65536 // network receive ring, double-mapped
 #define RINGSIZE        5000
 #define RINGXON1        (RINGSIZE / 3)
 #define RINGXON2        (RINGSIZE / 4)
@@ -133,6 +134,7 @@
 //tab4
 #define PREF_FANCYSCALE  "fancyscale"
 #define PREF_SCALE       "scale"
+#define PREF_FRAMERATE   "frameRate"
 #define PREF_STATUSBAR   "statusbar"
 #define PREF_MENUBAR     "menubar"
 #define PREF_NOCOLOR     "noColor"
@@ -240,6 +240,7 @@ typedef struct NetFet_s
     volatile u8 *in;                    /* Fill (write) pointer */
     volatile u8 *out;                   /* Empty (read) pointer */
     u8          *end;                   /* End of ring buffer + 1 */
+    int         mirror;                 /* Receive ring is double-mapped */
     u8          *sendfirst;             /* Start of transmit ring buffer */
     volatile u8 *sendin;                /* Fill (write) pointer */
     volatile u8 *sendout;               /* Empty (read) pointer */
@@ -248,13 +249,24 @@ typedef struct NetFet_s
 #if defined(__APPLE__)
     sem_t       *_rsemp;                /* Allows rcv thread to exit */
     sem_t       *_ssemp;                /* For waking send thread */
+    sem_t       *_fsemp;                /* For waking rcv thread */
 #define rsemp(fet) ((fet)->_rsemp)
 #define ssemp(fet) ((fet)->_ssemp)
+#define fsemp(fet) ((fet)->_fsemp)
 #else
     sem_t       rsem;                   /* Allows rcv thread to exit */
     sem_t       ssem;                   /* For waking send thread */
+    sem_t       fsem;                   /* For waking rcv thread */
 #define rsemp(fet) (&((fet)->rsem))
 #define ssemp(fet) (&((fet)->ssem))
+#define fsemp(fet) (&((fet)->fsem))
+#endif
+    volatile bool rcvWait;              /* Rcv thread waiting for space */
+#if defined(DT_REACTOR)
+    struct NetFet_s *rnext;             /* Next FET serviced by reactor */
+    u32         rmask;                  /* epoll events being watched */
+    bool        ractive;                /* Connection activation done */
+    bool        rhold;                  /* Owner wants no data for now */
 #endif
     struct in_addr from;                /* Remote IP address */
     int         fromPort;               /* Remote TCP port number */
@@ -310,6 +322,7 @@ typedef struct NetPortSet_s
     void        *dataCallArg;           /* argument to the above */
     const char  *kind;                  /* What is this portset for? */
     bool        localOnly;              /* TRUE to listen on 127.0.0.1 */
+    bool        mirrorRing;             /* TRUE for double-mapped rings */
     } NetPortSet;
 
 /*
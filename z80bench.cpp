@@ -0,0 +1,760 @@
+////////////////////////////////////////////////////////////////////////////
+// Name:        z80bench.cpp
+// Purpose:     Headless z80 emulator conformance and speed test
+// Authors:     Paul Koning, Joe Stanton, Bill Galcher, Steve Zoppi, Dale Sinder
+// Created:     10/17/2026
+// Copyright:   (c) Paul Koning, Joe Stanton, Dale Sinder
+// Licence:     see pterm-license.txt
+/////////////////////////////////////////////////////////////////////////////
+
+// This runs the z80 emulator in Z80.cpp on its own, without wxWidgets
+// or the rest of pterm.
+//
+//  z80bench [-c program.com]... [-m image.mte] [-n cycles] [-p]
+//
+//  -c  Run a CP/M program, such as the ZEXDOC or ZEXALL instruction
+//      exercisers, with just enough of CP/M (console output) for them.
+//      The test fails if the program prints ERROR.  If the emulator is
+//      built with Z80_BLOCK_CACHE, the program is run again from the
+//      block cache, which must print the same and end in the same state.
+//  -m  Boot a MicroTutor image (default ptermhelp.mte) the way pterm
+//      does, and run it for -n cycles (default 1000000000) with a few
+//      keys pressed along the way.  This is done once for each way the
+//      emulator can run: profiling, trapping only the resident entry
+//      points, and trapping every jump, call and return, which is how
+//      it ran before the trap bitmap, and from the block cache if that
+//      is built in.  All runs must end in the same state.
+//  -p  Write the profile of the MicroTutor run to z80bench.prof and
+//      z80bench.folded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Z80.h"
+#include "ppt.h"
+
+#define RAM     m_context.memory
+
+#define BenchSlice      100000000   // cycles per Z80Emulate call
+#define MtImageSize     (128L * 64L * 154L)
+
+// Emulator with what the tests have in common: a hash of the machine
+// state, so runs can be compared, and a run timer.
+class BenchZ80 : public Z80
+{
+public:
+    BenchZ80 ();
+
+    unsigned long long Hash (void);
+    double Seconds (void) const
+    {
+        return m_time / 1e9;
+    }
+
+    long long   m_cycles;
+    long        m_calls;
+
+protected:
+    void Mix (unsigned int v)
+    {
+        m_hash = (m_hash ^ v) * 1099511628211ULL;
+    }
+
+    unsigned long long m_hash;
+    unsigned long long m_time;
+};
+
+// A CP/M program.  Address 5 is the BDOS entry; a jump to 0 (warm
+// boot) ends the program.
+class CpmZ80 : public BenchZ80
+{
+public:
+    CpmZ80 ();
+    bool Load (const char *fn);
+    void Run (void);
+
+    int         m_errors;
+    bool        m_quiet;        // check the output but don't print it
+
+private:
+    int check_pcZ80 (void);
+    void Put (char c);
+
+    int         m_match;        // characters of "ERROR" seen so far
+};
+
+// MicroTutor booted from an .mte image.  The disk controller ports are
+// done as in PtermFrame::inputZ80/outputZ80, reading the image from
+// memory the way MTFile does for the help image.  The resident calls
+// are done just far enough for the lesson to run: the ones that only
+// draw are counted into the hash and returned from.
+class MtutorZ80 : public BenchZ80
+{
+public:
+    MtutorZ80 (const unsigned char *image);
+    int Boot (void);
+    void Run (long long cycles);
+
+    long        m_execs;
+
+private:
+    unsigned char inputZ80 (unsigned char data);
+    void outputZ80 (unsigned char data, unsigned char acc);
+    int check_pcZ80 (void);
+    const char *Z80CallName (unsigned short pc);
+
+    void Seek (long loc);
+    void ReadReset (void);
+    unsigned char ReadByte (void);
+    void CalcCheck (unsigned char b);
+
+    const unsigned char *m_image;
+    long        m_position;
+    int         m_rcnt;
+    unsigned short m_chkSum;
+
+    int         m_func;
+    int         m_temp;
+    int         m_phase;
+    int         m_track;
+    int         m_sector;
+    int         m_canresp;
+    int         m_single;
+    bool        m_clockPhase;
+    int         m_x, m_y;
+    int         m_key;          // next in the key script
+};
+
+BenchZ80::BenchZ80 ()
+    : m_cycles (0),
+      m_calls (0),
+      m_hash (1469598103934665603ULL),
+      m_time (0)
+{
+}
+
+// Hash of the memory, registers and pc, on top of the resident calls
+// mixed in along the way.  This is for the end of a run.
+unsigned long long BenchZ80::Hash (void)
+{
+    int i;
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        Mix (RAM[i]);
+    }
+    for (i = 0; i < 7; i++)
+    {
+        Mix (state->registers.word[i]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        Mix (state->alternates[i]);
+    }
+    Mix (state->pc);
+    return m_hash;
+}
+
+CpmZ80::CpmZ80 ()
+    : m_errors (0),
+      m_quiet (false),
+      m_match (0)
+{
+    Z80Trap (0, 0, true);
+    Z80Trap (5, 5, true);
+}
+
+// Load a .com file at 0x100.  The BDOS returns right away if it is
+// reached other than through the trap, and the word at 6, which CP/M
+// programs take as the top of memory, gives them a stack.
+bool CpmZ80::Load (const char *fn)
+{
+    FILE *f;
+
+    f = fopen (fn, "rb");
+    if (f == NULL)
+    {
+        fprintf (stderr, "Failure opening %s\n", fn);
+        return false;
+    }
+    memset (RAM, 0, sizeof (RAM));
+    fread (RAM + 0x100, 1, 0x10000 - 0x100, f);
+    fclose (f);
+
+    RAM[5] = 0xc9;              // ret
+    RAM[6] = 0x00;
+    RAM[7] = 0xf0;
+    Z80Reset ();
+    state->pc = 0x100;
+    state->registers.word[Z80_SP] = 0xf000;
+    return true;
+}
+
+// Run the program to the end.  This doesn't use Z80Emulate, which
+// would apply the MicroTutor patches.
+void CpmZ80::Run (void)
+{
+    const unsigned long long start = Z80Clock ();
+    int pc, opcode;
+
+    ppt_running = true;
+    while (ppt_running)
+    {
+        state->status = 0;
+        pc = state->pc;
+        opcode = RAM[pc];
+        state->pc = pc + 1;
+        m_cycles += emulate (opcode, 0, BenchSlice);
+    }
+    m_time = Z80Clock () - start;
+}
+
+void CpmZ80::Put (char c)
+{
+    static const char error[] = "ERROR";
+
+    Mix (c);
+    if (!m_quiet)
+    {
+        putchar (c);
+        if (c == '\n')
+        {
+            fflush (stdout);
+        }
+    }
+    if (c == error[m_match])
+    {
+        if (++m_match == 5)
+        {
+            m_errors++;
+            m_match = 0;
+        }
+    }
+    else
+    {
+        m_match = (c == error[0]) ? 1 : 0;
+    }
+}
+
+int CpmZ80::check_pcZ80 (void)
+{
+    int i;
+
+    m_calls++;
+    if (state->pc == 0)
+    {
+        return 2;
+    }
+    switch (state->registers.byte[Z80_C])
+    {
+    case 2:
+        Put (state->registers.byte[Z80_E]);
+        break;
+    case 9:
+        for (i = state->registers.word[Z80_DE]; RAM[i & 0xffff] != '$'; i++)
+        {
+            Put (RAM[i & 0xffff]);
+        }
+        break;
+    default:
+        break;
+    }
+    return 1;
+}
+
+MtutorZ80::MtutorZ80 (const unsigned char *image)
+    : m_execs (0),
+      m_image (image),
+      m_position (0),
+      m_rcnt (1),
+      m_chkSum (0),
+      m_func (0),
+      m_temp (0xcb),
+      m_phase (0),
+      m_track (0),
+      m_sector (0),
+      m_canresp (0),
+      m_single (0),
+      m_clockPhase (true),
+      m_x (0),
+      m_y (0),
+      m_key (0)
+{
+    Z80Trap (0, WORKRAM - 1, true);
+}
+
+// Load the interpreter, as PtermFrame::BootMtutor does.  Returns the
+// level of the image, or 0 if it can't be booted.
+int MtutorZ80::Boot (void)
+{
+    unsigned short address = 0x5300;
+    int level, sectors, bytes, readnum;
+
+    Seek (25);
+    if (ReadByte () == 0)
+    {
+        return 0;
+    }
+    Seek (36);
+    level = ReadByte ();
+    ReadReset ();
+    readnum = (level == 2) ? 80 : (level == 3) ? 81 : 82;
+    if (level < 2 || level > 6)
+    {
+        return 0;
+    }
+
+    Seek (21504);
+    for (sectors = 0; sectors < readnum; sectors++)
+    {
+        for (bytes = 0; bytes < 128; bytes++)
+        {
+            RAM[address++] = ReadByte ();
+        }
+        ReadByte ();
+        ReadByte ();
+    }
+    state->pc = 0x5306;
+    m_mtutorBoot = true;
+    return level;
+}
+
+// Run for the given number of cycles, or until the z80 stops.  Giving
+// up at r.exec just ends a Z80Emulate call, as it does in pterm.
+void MtutorZ80::Run (long long cycles)
+{
+    const unsigned long long start = Z80Clock ();
+    long long left;
+
+    ppt_running = true;
+    while (ppt_running && m_cycles < cycles)
+    {
+        left = cycles - m_cycles;
+        m_cycles += Z80Emulate ((left > BenchSlice) ? BenchSlice : left);
+    }
+    m_time = Z80Clock () - start;
+}
+
+void MtutorZ80::Seek (long loc)
+{
+    m_position = loc;
+    m_rcnt = 1;
+}
+
+void MtutorZ80::ReadReset (void)
+{
+    m_rcnt = 1;
+    m_chkSum = 0;
+}
+
+// Next byte from the image, with the two check bytes after every 128
+// as in MTFile.
+unsigned char MtutorZ80::ReadByte (void)
+{
+    unsigned char b;
+
+    if (m_rcnt == 129)
+    {
+        m_rcnt++;
+        return m_chkSum & 0xff;
+    }
+    if (m_rcnt == 130)
+    {
+        b = m_chkSum >> 8;
+        ReadReset ();
+        return b;
+    }
+    b = (m_position >= 0 && m_position < MtImageSize) ?
+        m_image[m_position] : 0;
+    m_position++;
+    m_rcnt++;
+    CalcCheck (b);
+    return b;
+}
+
+void MtutorZ80::CalcCheck (unsigned char b)
+{
+    unsigned char cu = m_chkSum >> 8;
+    unsigned char cl = m_chkSum & 0xff;
+
+    cu ^= b;
+    cu = (cu << 1) | (cu >> 7);
+    cl ^= b;
+    cl = (cl >> 1) | (cl << 7);
+    m_chkSum = (cu << 8) | cl;
+}
+
+unsigned char MtutorZ80::inputZ80 (unsigned char data)
+{
+    unsigned char retval = 0;
+
+    switch (data)
+    {
+    case 0x2a:
+        return 0x37;
+    case 0x2b:
+        return 1;
+    case 0xaa:
+        return 0x38;
+    case 0xab:
+        return 1;
+    case 0xae:          // cdc disk data port
+        switch (m_func)
+        {
+        case 0:
+            retval = ReadByte ();
+            break;
+        case 11:
+            // The millisecond clock doesn't run here.
+            m_clockPhase = !m_clockPhase;
+            break;
+        case 4:
+            retval = m_single;
+            break;
+        default:
+            break;
+        }
+        return retval;
+    case 0xaf:          // cdc disk control port
+        retval = m_canresp;
+        if (m_func == 0 || m_func == 2 || m_func == 11)
+        {
+            m_canresp = 0x50;
+        }
+        return retval;
+    default:
+        return 0;
+    }
+}
+
+void MtutorZ80::outputZ80 (unsigned char data, unsigned char acc)
+{
+    switch (data)
+    {
+    case 0xae:          // cdc disk data port
+        if (m_func != 0 && m_func != 2)
+        {
+            break;
+        }
+        switch (m_phase++)
+        {
+        case 1:         // unit
+            break;
+        case 2:
+            m_track = acc;
+            break;
+        case 3:
+            m_sector = acc;
+            break;
+        case 4:
+        case 5:
+        case 6:
+            break;
+        case 7:
+            Seek (128L * 64L * m_track + 128L * (m_sector - 1));
+            break;
+        default:
+            m_canresp = 0x50;
+            break;
+        }
+        break;
+    case 0xaf:          // cdc disk control port
+        if ((unsigned char) ~acc != m_temp)
+        {
+            // First half of a command
+            m_temp = acc;
+            m_canresp = 0x48;
+            break;
+        }
+        m_func = m_temp;
+        m_temp = 0xcb;
+        m_phase = 1;
+        switch (m_func)
+        {
+        case 0:
+        case 2:
+        case 10:
+        case 11:
+            m_canresp = 0x4a;
+            m_clockPhase = true;
+            break;
+        case 4:
+            m_canresp = 0x4a;
+            m_single = 2;
+            break;
+        case 8:
+            m_canresp = 0x50;
+            break;
+        default:
+            m_single = 2;
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+int MtutorZ80::check_pcZ80 (void)
+{
+    // Keys for successive r.input calls (-1 for none): mostly NEXT,
+    // with a BACK and a few others, so the help lesson pages around.
+    static const int keys[] =
+    {
+        0x16, -1, -1, 0x0c, -1, 0x41, 0x16, -1, 0x1a, -1, 0x16
+    };
+    const int pc = state->pc;
+    int key;
+
+    if (pc >= WORKRAM)
+    {
+        return 0;
+    }
+    m_calls++;
+    Mix (pc);
+    Mix (state->registers.word[Z80_DE]);
+    Mix (state->registers.word[Z80_HL]);
+
+    switch (pc)
+    {
+    case R_MAIN:
+    case R_INIT:
+        return 2;
+    case R_INPX:
+        state->registers.word[Z80_HL] = m_x;
+        return 1;
+    case R_INPY:
+        state->registers.word[Z80_HL] = m_y;
+        return 1;
+    case R_OUTX:
+        m_x = state->registers.word[Z80_HL] & 0x1ff;
+        return 1;
+    case R_OUTY:
+        m_y = state->registers.word[Z80_HL] & 0x1ff;
+        return 1;
+    case R_DOT:
+    case R_LINE:
+        m_x = state->registers.word[Z80_HL] & 0x1ff;
+        m_y = state->registers.word[Z80_DE] & 0x1ff;
+        return 1;
+    case R_INPUT:
+        key = keys[m_key++ % (sizeof (keys) / sizeof (keys[0]))];
+        state->registers.word[Z80_HL] = key & 0xffff;
+        return 1;
+    case R_EXEC:
+        m_execs++;
+        m_giveupz80 = true;
+        return 1;
+    case R_SSF:
+        state->registers.byte[Z80_L] = 0x40;
+        return 1;
+    default:
+        // Anything else in the jump table just returns; a jump
+        // anywhere else in low memory is a wild jump.
+        return (pc <= R_DUMMY3) ? 1 : 2;
+    }
+}
+
+const char *MtutorZ80::Z80CallName (unsigned short pc)
+{
+    static const char *const names[] =
+    {
+        "r.main", "r.init", "r.dot", "r.line", "r.chars", "r.block",
+        "r.inpx", "r.inpy", "r.outx", "r.outy", "r.xmit", "r.mode",
+        "r.stepx", "r.stepy", "r.we", "r.dir", "r.input", "r.ssf",
+        "r.ccr", "r.extout", "r.exec", "r.gjob", "r.xjob", "r.return",
+        "r.chrcv", "r.alarm", "r.print", "r.fcolor", "r.bcolor",
+        "r.paint", "r.wait16", "r.dummy2", "r.dummy3"
+    };
+
+    if (pc < R_MAIN || pc > R_DUMMY3 || (pc - R_MAIN) % 3 != 0)
+    {
+        return NULL;
+    }
+    return names[(pc - R_MAIN) / 3];
+}
+
+// Run a CP/M program.  With the block cache built in, it is run first
+// by the interpreter and then from the cache.  Returns the number of
+// failures.
+static int cpmBench (const char *fn)
+{
+    unsigned long long hash = 0, end;
+    CpmZ80 *cpm;
+    int pass, failed = 0;
+
+#ifdef Z80_BLOCK_CACHE
+    const int passes = 2;
+#else
+    const int passes = 1;
+#endif
+
+    for (pass = 0; pass < passes; pass++)
+    {
+        cpm = new CpmZ80;
+        if (!cpm->Load (fn))
+        {
+            delete cpm;
+            return 1;
+        }
+#ifdef Z80_BLOCK_CACHE
+        cpm->m_blockCache = (pass == 1);
+#endif
+        cpm->m_quiet = (pass == 1);
+        cpm->Run ();
+        printf ("%s%s: %lld cycles, %.3f seconds, %.2f Mcycles/s, "
+                "%d errors\n", fn, (pass == 1) ? " (block cache)" : "",
+                cpm->m_cycles, cpm->Seconds (),
+                cpm->m_cycles / cpm->Seconds () / 1e6, cpm->m_errors);
+        if (cpm->m_errors != 0)
+        {
+            failed++;
+        }
+        end = cpm->Hash ();
+        if (pass == 0)
+        {
+            hash = end;
+        }
+        else if (end != hash)
+        {
+            printf ("%s: block cache state %016llx, interpreter %016llx "
+                    "MISMATCH\n", fn, end, hash);
+            failed++;
+        }
+        delete cpm;
+    }
+    return failed;
+}
+
+static void usage (void)
+{
+    fprintf (stderr, "usage: z80bench [-c program.com]... [-m image.mte] "
+             "[-n cycles] [-p]\n");
+    exit (2);
+}
+
+// Boot and run the MicroTutor image in each of the ways the emulator
+// can run.  Returns the number of failures.
+static int mtutorBench (const char *fn, long long cycles, bool profile)
+{
+    static const char *const modes[] =
+    {
+        "profile", "resident traps", "trap all", "block cache"
+    };
+#ifdef Z80_BLOCK_CACHE
+    const int nmodes = 4;
+#else
+    const int nmodes = 3;
+#endif
+    static unsigned char image[MtImageSize];
+    unsigned long long hash[4], instructions = 0;
+    MtutorZ80 *z;
+    FILE *f;
+    int mode, level = 0, failed = 0;
+
+    f = fopen (fn, "rb");
+    if (f == NULL)
+    {
+        fprintf (stderr, "Failure opening %s\n", fn);
+        return 1;
+    }
+    fread (image, 1, sizeof (image), f);
+    fclose (f);
+
+    // The help context, as PtermApp sets it for the help window.
+    image[124] = 3;
+    image[125] = 0;
+
+    for (mode = 0; mode < nmodes; mode++)
+    {
+        z = new MtutorZ80 (image);
+#ifdef Z80_BLOCK_CACHE
+        z->m_blockCache = (mode == 3);
+#endif
+        level = z->Boot ();
+        if (level == 0)
+        {
+            fprintf (stderr, "Cannot boot %s\n", fn);
+            delete z;
+            return 1;
+        }
+        if (mode == 0)
+        {
+            z->Z80ProfileStart ();
+        }
+        else if (mode == 2)
+        {
+            z->Z80Trap (0, 0xffff, true);
+        }
+
+        z->Run (cycles);
+        hash[mode] = z->Hash ();
+
+        if (mode == 0)
+        {
+            for (int pc = 0; pc < 0x10000; pc++)
+            {
+                instructions += z->m_prof->count[pc];
+            }
+            if (profile &&
+                !z->Z80ProfileWrite ("z80bench.prof", "z80bench.folded"))
+            {
+                fprintf (stderr, "Error writing profile\n");
+                failed++;
+            }
+            printf ("%s level %d: %lld cycles, %llu instructions, "
+                    "%ld resident calls, %ld r.exec\n",
+                    fn, level, z->m_cycles, instructions,
+                    z->m_calls, z->m_execs);
+            printf ("  %-16s %9s %10s %10s  %s\n",
+                    "", "seconds", "Minstr/s", "Mcycles/s", "state");
+        }
+        printf ("  %-16s %9.3f %10.2f %10.2f  %016llx%s\n",
+                modes[mode], z->Seconds (),
+                instructions / z->Seconds () / 1e6,
+                z->m_cycles / z->Seconds () / 1e6,
+                hash[mode], (hash[mode] == hash[0]) ? "" : " MISMATCH");
+        if (hash[mode] != hash[0])
+        {
+            failed++;
+        }
+        delete z;
+    }
+    return failed;
+}
+
+int main (int argc, char **argv)
+{
+    const char *mte = "ptermhelp.mte";
+    long long cycles = 1000000000LL;
+    bool profile = false;
+    int i, failed = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp (argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            failed += cpmBench (argv[++i]);
+        }
+        else if (strcmp (argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            mte = argv[++i];
+        }
+        else if (strcmp (argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            cycles = atoll (argv[++i]);
+        }
+        else if (strcmp (argv[i], "-p") == 0)
+        {
+            profile = true;
+        }
+        else
+        {
+            usage ();
+        }
+    }
+
+    failed += mtutorBench (mte, cycles, profile);
+    return (failed == 0) ? 0 : 1;
+}
@@ -80,4 +80,17 @@
 
 /* #define Z80_MASK_IM2_VECTOR_ADDRESS */
 
+/* Instructions can be kept decoded in a cache of blocks of straight-line
+ * code, so the prefixes and opcode of code that runs again are not decoded
+ * again; with GCC, each instruction also jumps straight to the next one in
+ * its block.  Giving up (m_giveupz80) is only checked between blocks, and
+ * blocks end at every jump, call, return and I/O instruction.  Execution
+ * is otherwise the same; z80bench checks this.  Writes by the emulated CPU
+ * and through WriteRAM, WriteRAMW and Poke empty the cache if they hit a
+ * decoded byte; other stores into code must call Z80BlockFlush.  Not for
+ * use with Z80_PREFIX_FAILSAFE or DEBUG_Z80.
+ */
+
+/* #define Z80_BLOCK_CACHE */
+
 #endif
@@ -109,9 +109,35 @@ extern "C" {
 
 #define Z80_FETCH_WORD(address, x)		Z80_READ_WORD((address), (x))
 
+/* With the block cache, a write to a byte that has been decoded into it
+* empties the cache and ends the block being run, see z80config.h.
+*/
+
+#ifdef Z80_BLOCK_CACHE
+
+#define Z80_DECODED(address)                                            \
+    (m_code[((address) & 0xffff) >> 3] & (1 << ((address) & 7)))
+
+#define Z80_CODE_WRITE(address)                                         \
+{                                                                       \
+    if (Z80_DECODED (address))                                          \
+    {                                                                   \
+        Z80BlockFlush ();                                               \
+        block = NULL;                                                   \
+        bend = bop;                                                     \
+    }                                                                   \
+}
+
+#else
+
+#define Z80_CODE_WRITE(address)
+
+#endif
+
 #define Z80_WRITE_BYTE(address, x)                                      \
 {                                                                       \
     ((ZEXTEST *) context)->memory[(address) & 0xffff] = (unsigned char) (x);  \
+    Z80_CODE_WRITE (address)                                            \
 }
 
 #define Z80_WRITE_WORD(address, x)                                      \
@@ -121,11 +147,24 @@ extern "C" {
 	memory = ((ZEXTEST *) context)->memory;				                \
         memory[(address) & 0xffff] = (unsigned char) (x);               \
         memory[((address) + 1) & 0xffff] = (unsigned char) ((x) >> 8); 	\
+        Z80_CODE_WRITE (address)                                        \
+        Z80_CODE_WRITE ((address) + 1)                                  \
 }
 
 #define Z80_READ_WORD_INTERRUPT(address, x)     Z80_READ_WORD((address), (x))
 
-#define Z80_WRITE_WORD_INTERRUPT(address, x)    Z80_WRITE_WORD((address), (x))
+/* Interrupts are taken outside emulate(), between blocks. */
+
+#define Z80_WRITE_WORD_INTERRUPT(address, x)                            \
+{                                                                       \
+	unsigned char	*memory;					                        \
+									                                    \
+	memory = ((ZEXTEST *) context)->memory;				                \
+        memory[(address) & 0xffff] = (unsigned char) (x);               \
+        memory[((address) + 1) & 0xffff] = (unsigned char) ((x) >> 8); 	\
+        Z80Written ((address) & 0xffff);                                \
+        Z80Written (((address) + 1) & 0xffff);                          \
+}
 
 #define Z80_INPUT_BYTE(port, x)                                         \
 {                                                                       \
@@ -138,16 +177,26 @@ extern "C" {
     outputZ80((unsigned char) port, (unsigned char) x);                 \
 }
 
+/* Only addresses with their bit set in m_trap go through check_pcZ80; the
+* test is done inline so ordinary branches don't pay for a virtual call.
+*/
+
+#define Z80_TRAPPED(address)                                            \
+    (m_trap[((address) & 0xffff) >> 3] & (1 << ((address) & 7)))
+
 #define Z80_CHECK_PC                                                    \
 {                                                                       \
-    state->pc = pc & 0xffff;                                            \
-    switch (check_pcZ80())                                              \
+    if (Z80_TRAPPED (pc))                                               \
     {                                                                   \
-    case 1:                                                             \
-        goto doret;                                                     \
-    case 2:                                                             \
-        ppt_running = false;                                            \
-        goto stop_emulation;                                            \
+        state->pc = pc & 0xffff;                                        \
+        switch ((m_prof == NULL) ? check_pcZ80() : Z80ProfileCall())    \
+        {                                                               \
+        case 1:                                                         \
+            goto doret;                                                 \
+        case 2:                                                         \
+            ppt_running = false;                                        \
+            goto stop_emulation;                                        \
+        }                                                               \
     }                                                                   \
 }
 